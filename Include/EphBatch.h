@@ -0,0 +1,72 @@
+/* EphBatch.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef EPHBATCH_H_INCLUDED
+#define EPHBATCH_H_INCLUDED
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "EphCache.h"
+
+/*  Batch ephemeris
+
+    planets() fills the single planet_info table; almanacs, searches and
+    path overlays want many instants at once. planetsBatch() takes an
+    array of times and fills one row of EPHBODIES positions per time,
+    sharing the work out among a pool of threads. The caller works on the
+    batch too, so a pool of no threads (or none at all) runs it in line.
+
+    Times are handed out in runs of EPHBATCHRUN consecutive entries. With
+    the times in order, a run stays in the hourly nutation and obliquity
+    samples of its thread's epoch cache, which every body of every epoch
+    in the run shares. Evenly spaced times are recognised and each run is
+    sampled with a vsopGrid, one series rotation per epoch instead of two
+    series sums (positions agree to a few 1e-6 arcsec).
+
+    A pool runs one batch at a time.
+*/
+
+#define EPHBATCHRUN     64              // Epochs handed out at a time
+#define EPHBATCHGRID    8               // Shortest run worth a grid
+#define EPHBATCHSLACK   1e-9            // Spacing error of evenly spaced times (days)
+
+struct ephPool {
+    pthread_t *threads;
+    int     nThreads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    // Batch in progress
+    const double *jd;
+    struct planet (*pi)[EPHBODIES];
+    int     n, qPC;
+    double  step;                       // Spacing of evenly spaced times, else 0
+    int     run;                        // Epochs handed out at a time
+    int     next;                       // First epoch not yet handed out
+    int     busy;                       // Threads on the batch
+    int     bStop;
+};
+
+extern int ephPoolOpen(struct ephPool *pp, int nThreads);
+extern void ephPoolClose(struct ephPool *pp);
+extern void planetsBatch(struct ephPool *pp, const double *jd, int n, int qPC, struct planet (*pi)[EPHBODIES]);
+
+#endif // EPHBATCH_H_INCLUDED
@@ -0,0 +1,112 @@
+/* EphCache.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef EPHCACHE_H_INCLUDED
+#define EPHCACHE_H_INCLUDED
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*  Ephemeris cache
+
+    Apparent geocentric places change smoothly, so instead of running the
+    series (twice per body, for light time) every frame, the right
+    ascension, declination and distance of the Sun, Moon and planets are
+    fitted with Chebyshev polynomials over segments of EPHSEGDAYS. A frame
+    then costs a Clenshaw sum of EPHDEGREE terms per coordinate.
+
+    A worker thread fits the segment holding the last requested time and
+    the one after it, so the window moves forward a segment at a time
+    without the display loop waiting. Until a segment is ready positions
+    come from the series directly. The fit follows the series to 1e-4
+    arcsec or better (checked by the EPH_TEST_PROGRAM build of EphCache.c).
+
+    Only ra, dec and dist are fitted; the heliocentric fields are those of
+    the fit sample nearest the middle of the segment.
+
+    For a span of years the fits can instead be made ahead of time by
+    skypi-ephem and read from a memory-mapped file: a header followed by
+    one record of coefficients per segment, in the manner of the JPL DE
+    files. Inside the span of the file no series are evaluated at all.
+    The file keeps no heliocentric fields (they read as zero).
+*/
+
+#define EPHBODIES   7
+#define EPHDEGREE   8                   // Chebyshev terms per coordinate
+#define EPHSEGDAYS  1.0                 // Segment length (days)
+#define EPHSEGS     2                   // Segments kept (current and next)
+
+#define EPHMAGIC    0x68704553          // "SEph"
+#define EPHVERSION  1
+#define EPHQUICK    0x0001              // Fitted from shortcut series
+
+struct ephHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nBodies;
+    uint32_t degree;
+    uint32_t nSegs;
+    uint32_t flags;
+    double  jdStart;                    // Start of first segment
+    double  segDays;
+};
+
+struct ephRecord {
+    double  coef[EPHBODIES][3][EPHDEGREE];  // RA (unwrapped), Dec, distance
+};
+
+struct ephSegment {
+    double  jd0;                        // Start of segment
+    int     bValid;
+    struct ephRecord fit;
+    struct planet mid[EPHBODIES];       // Sample nearest the middle
+};
+
+struct ephCache {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct ephSegment seg[EPHSEGS];     // Indexed by segment number mod EPHSEGS
+    double  want;                       // Last time asked for
+    int     bQuick;                     // Shortcut series
+    int     bStop;
+    uint32_t hits, misses, fits;
+};
+
+struct ephFile {
+    void    *base;                      // Mapped file
+    size_t  size;
+    const struct ephHeader *hdr;
+    const struct ephRecord *recs;
+};
+
+extern int ephOpen(struct ephCache *ec, int bQuick);
+extern void ephClose(struct ephCache *ec);
+extern int ephPlanets(struct ephCache *ec, double jd, struct planet *pi);
+extern void ephFit(struct ephSegment *seg, double jd0, int bQuick);
+extern void ephEval(const struct ephSegment *seg, double jd, struct planet *pi);
+
+extern int writeEphFile(const char *fname, double jdStart, uint32_t nSegs, int bQuick, int nJobs);
+extern int openEphFile(const char *fname, struct ephFile *ef);
+extern void closeEphFile(struct ephFile *ef);
+extern int ephFilePlanets(const struct ephFile *ef, double jd, struct planet *pi);
+
+#endif // EPHCACHE_H_INCLUDED
@@ -0,0 +1,77 @@
+/* SkyLabel.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef SKYLABEL_H_INCLUDED
+#define SKYLABEL_H_INCLUDED
+
+#include <stdint.h>
+
+/*  Label layout
+
+    Labels are collected during a frame and placed once everything else is
+    drawn. The screen is covered by a uniform grid of LABELCELL pixel cells
+    kept as two occupancy bitmaps: hard (placed labels, planets, bright
+    star glyphs, the clock) and soft (grid, ecliptic and constellation
+    lines). Each label tries LABELCANDS positions around its object, taking
+    the first one clear of both, else the first one clear of hard cells,
+    else it is dropped. Labels are placed in priority order (planets and
+    targets first, then stars brightest first) using a bucket sort, so a
+    frame costs O(n) in labels.
+
+    Text widths come from a font metrics table filled once per font
+    instead of asking the display for every string.
+*/
+
+#define LABELCELL   2               // Occupancy cell size (pixels)
+#define LABELCOLS   ((SCRWIDTH + LABELCELL - 1) / LABELCELL)
+#define LABELROWS   ((SCRHEIGHT + LABELCELL - 1) / LABELCELL)
+#define LABELWORDS  ((LABELCOLS + 63) / 64)
+#define MAXLABELS   512
+#define LABELCANDS  8
+#define LABELBUCKETS 64             // Priority buckets
+#define LABELPRIMIN -4.0            // Priority (magnitude) range of buckets
+#define LABELPRIMAX 12.0
+
+struct fontMetrics {
+    unsigned char width[128];       // Advance of each character (pixels)
+    unsigned char height;
+};
+
+struct skyLabel {
+    short   x, y;                   // Object position
+    short   r;                      // Object radius
+    short   lx, ly;                 // Placed text origin (top left)
+    short   w, h;                   // Text size
+    float   pri;                    // Placement priority (lower first)
+    uint16_t color;
+    const char *text;
+    int     bPlaced;
+};
+
+extern void clearLabels(void);
+extern void labelBlock(int x0, int y0, int x1, int y1, int bHard);
+extern void labelLine(int x0, int y0, int x1, int y1);
+extern int addLabel(int x, int y, int r, const char *text, uint16_t color, float pri);
+extern int textWidth(const struct fontMetrics *fm, const char *text);
+extern int placeLabels(const struct fontMetrics *fm);
+extern struct skyLabel *getLabel(int k);
+
+#endif // SKYLABEL_H_INCLUDED
@@ -0,0 +1,68 @@
+/* SkyLayer.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef SKYLAYER_H_INCLUDED
+#define SKYLAYER_H_INCLUDED
+
+#include <stdint.h>
+
+/*  Object layers
+
+    Everything plotted from a catalog is a layer: the star field, deep-sky
+    objects, site-specific target lists. Each layer is a catalog in the
+    starmap DB format (CSV or binary, resident or tiled) with its own glyph
+    style and magnitude limit, and is indexed by the same HEALPix sky
+    cells as the stars. All layers are rotated by the one frame matrix and
+    culled cell by cell, visiting only the cells its horizon timeline has
+    above the horizon, so a layer only adds its visible objects to the
+    cost of a frame.
+
+    For deep-sky layers the "spectral class" field holds the object type:
+    G(alaxy), N(ebula), P(lanetary nebula), O(pen) or C (globular) cluster.
+*/
+
+#define MAXLAYERS   8
+
+enum layer_style {
+    LAYER_STARS = 0,                // Merged star glyphs
+    LAYER_DSO,                      // Deep-sky object outlines
+    LAYER_MARKS                     // Labelled target markers
+};
+
+struct skyLayer {
+    char    fname[200];             // Catalog path
+    int     style;
+    double  magLimit;               // Faintest object drawn
+    struct starCat cat;
+    struct starStore ss;            // Resident objects (not tiled)
+    struct starTiles tiles;         // Tile cache (tiled)
+    int     bTiled;
+    struct riseSet rs;              // Cells above the horizon
+};
+
+extern int parseLayer(const char *arg, int style, double magLimit, struct skyLayer *ly);
+extern int openLayer(struct skyLayer *ly);
+extern void closeLayer(struct skyLayer *ly);
+extern void layerEpoch(struct skyLayer *ly, double years);
+extern int layerHorizon(struct skyLayer *ly, double app[3][3], double siteLat);
+extern uint32_t layerMaxRun(const struct skyLayer *ly);
+
+#endif // SKYLAYER_H_INCLUDED
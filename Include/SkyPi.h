@@ -68,6 +68,27 @@
 #define max(a,b)	((a) > (b) ? (a) : (b))
 #define min(a,b)	((a) < (b) ? (a) : (b))
 
+/*  Precision of star positions and screen projection.  Ephemeris and the
+    per-frame rotation matrix are always double.  */
+
+#ifdef SKYPI_FLOAT32
+typedef float   vreal;
+#define vsin    sinf
+#define vcos    cosf
+#define vacos   acosf
+#define vatan2  atan2f
+#define vsqrt   sqrtf
+#define vfloor  floorf
+#else
+typedef double  vreal;
+#define vsin    sin
+#define vcos    cos
+#define vacos   acos
+#define vatan2  atan2
+#define vsqrt   sqrt
+#define vfloor  floor
+#endif
+
 struct planet {                 // Planet information entry
     double hlong;               // FK5 Heliocentric longitude
     double hlat;                // FK5 Heliocentric latitude
@@ -84,6 +105,23 @@ struct planet {                 // Planet information entry
 };
 extern struct planet planet_info[7];		// Calculated planetary information
 
+struct ephContext {             // Reentrant planet calculation state
+    int     qPC;                // Shortcut series
+    double  prec;               // Precision target (arcsec), 0 for the full series
+    double  siteLat, siteLon;   // Observer (radians)
+    struct planet *pi;          // Positions of the 7 bodies
+};
+
+struct vsopGrid {               // Planets sampled at jd0 + k * step
+    double  jd0, step;
+    int     k;                  // Next sample
+    int     qPC;                // Shortcut series
+    int     nTerms;
+    double  *cs, *sn;           // Cosine and sine of each term's argument
+    double  *cd, *sd;           // Cosine and sine of each term's step
+    double  y[7][3][3];         // Series sums and first two derivatives
+};
+
 struct pplanet {
     char    *Name;
     short   Color;
@@ -101,6 +139,7 @@ enum planet_idx {
 };
 
 extern void highmoon(double jd, double *l, double *b, double *r, int qPC);
+extern void highmoonCtx(const struct ephContext *ec, double jd, double *l, double *b, double *r);
 extern double obliqeq(double jd);
 extern void ecliptoeq(double jd, double Lambda, double Beta, double *Ra, double *Dec);
 extern void set_tm_time(struct tm *t, int islocal);
@@ -108,11 +147,33 @@ extern double jtime(struct tm *t);
 extern void jyear(double td, long *yy, int *mm, int *dd);
 extern void jhms(double j, int *h, int *m, int *s);
 extern double gmst(double jd);
+extern void horizmatrix(double jd, double siteLat, double siteLon, double m[3][3]);
+extern void eqtohoriz(double m[3][3], double ra, double dec, double h[3]);
+extern void horizazalt(const double h[3], double *az, double *alt);
+extern void precessmatrix(double jd, double m[3][3]);
+extern void nutatematrix(double jd, double m[3][3]);
+extern void matmul3(double a[3][3], double b[3][3], double m[3][3]);
+extern void apparentmatrix(double jd, double m[3][3]);
 extern double ucttoj(long year, int mon, int mday, int hour, int min, int sec);
 extern void sunpos(double jd, int apparent, double *ra, double *dec, double *rv, double *slong);
 extern void planets(double jd);             /* Update planetary positions */
+extern void planetsAt(double jd, int qPC, struct planet *pi);
+extern int vsopGridOpen(struct vsopGrid *g, double jd0, double step, int qPC);
+extern void vsopGridClose(struct vsopGrid *g);
+extern void planetsGrid(struct vsopGrid *g, struct planet *pi);
+extern void horizPlanets(double jd, double siteLat, double siteLon);
 extern void nutation(double jd, double *deltaPsi, double *deltaEpsilon);
+extern double epochObliquity(double jd);    /* Per-epoch cache */
+extern void epochNutation(double jd, double *deltaPsi, double *deltaEpsilon);
+extern double epochGmst(double jd);
+extern void epochPrecess(double jd, double m[3][3]);
 
 void calcPlanets(double jd, double siteLat, double siteLon, int qPC);
 
+/* Context versions of planets(), horizPlanets() and calcPlanets() */
+extern void ephContextInit(struct ephContext *ec, struct planet *pi, int qPC, double siteLat, double siteLon);
+extern void planetsCtx(const struct ephContext *ec, double jd);
+extern void horizPlanetsCtx(const struct ephContext *ec, double jd);
+extern void calcPlanetsCtx(const struct ephContext *ec, double jd);
+
 #endif // SKYPI_H_INCLUDED
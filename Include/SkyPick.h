@@ -0,0 +1,60 @@
+/* SkyPick.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef SKYPICK_H_INCLUDED
+#define SKYPICK_H_INCLUDED
+
+#include <stdint.h>
+
+/*  Touch identification
+
+    Every object drawn in a frame is recorded with its screen position.
+    The first tap after a frame arranges the records in place into a 2-d
+    tree (median split, alternating x and y), so building costs
+    O(n log n) once per frame and only when the user asks. A tap is then
+    answered by a nearest neighbour search; among the objects within
+    PICKSLACK pixels of the nearest one the brightest wins, so a tap on a
+    bright star is not stolen by a faint neighbour.
+*/
+
+#define PICKRADIUS  12                  // Farthest a tap may be from an object (pixels)
+#define PICKSLACK   3                   // Distance treated as a tie (pixels)
+#define PICKPLANETMAG -30.0             // Planets win ties
+
+enum pick_kind {
+    PICK_STAR = 0,
+    PICK_OBJECT,                        // Deep-sky object or target mark
+    PICK_PLANET
+};
+
+struct skyPick {
+    short   x, y;                       // Screen position
+    short   kind;
+    short   layer;                      // Object layer (planet index for planets)
+    uint32_t id;                        // Catalog index within layer
+    float   mag;                        // Sort key for ties (lower wins)
+};
+
+extern void clearPicks(void);
+extern int addPick(int x, int y, int kind, int layer, uint32_t id, float mag);
+extern const struct skyPick *nearestPick(int x, int y, int radius);
+
+#endif // SKYPICK_H_INCLUDED
@@ -0,0 +1,102 @@
+/* SkyProj.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef SKYPROJ_H_INCLUDED
+#define SKYPROJ_H_INCLUDED
+
+#include <stdint.h>
+
+/*  Batch star projection
+
+    Rotates equatorial unit vectors into the horizon frame, projects them
+    onto the display and culls everything outside the viewport. The
+    projection is the azimuthal equidistant one used by XYFromAzAlt,
+    centred on the south point of the horizon:
+
+        r = CentralAngle * PROJSCALE,   cos(CentralAngle) = h[0]
+
+    The factor CentralAngle / sin(CentralAngle) is evaluated with a
+    polynomial in h[0], so the kernels need no acos/sin/cos.
+
+    With SKYPI_FLOAT32 the star vectors and kernels are single precision,
+    doubling the SIMD width. Projected positions then stay within
+    PROJERRBOUND pixels of the exact double projection (checked by the
+    PROJ_TEST_PROGRAM build of SkyProj.c).
+*/
+
+// Display geometry (480w x 272h)
+#define SCRWIDTH    480
+#define SCRHEIGHT   272
+#define SCRCX       240                 // Screen column of the south point
+#define SCRCY       271                 // Screen row of the horizon
+#define PROJSCALE   (272 / dtr(90))     // Pixels per radian
+
+#define PROJXMIN    -0.52               // Smallest h[0] that can reach the screen
+#define PROJERRBOUND 0.01               // Worst projection error (pixels)
+
+struct starCell;
+
+/*  Horizon timeline
+
+    Whether a sky cell reaches above the horizon depends only on its
+    declination, the site latitude and the hour angle. Once a day (with
+    precession) each cell gets the local sidereal times at which it rises
+    and sets, or is marked circumpolar or never rising. The rise/set events
+    are sorted by sidereal time and swept forward as the LST advances, so
+    the set of cells above the horizon is kept up to date with a few bit
+    flips per frame and the cull pass visits only those cells.
+*/
+
+#define RISEMARGIN  1e-3                // Hour angle margin (radians)
+
+struct riseEvent {
+    double  lst;                        // Local sidereal time (radians)
+    uint32_t cell;
+    uint32_t bRise;                     // Rise (else set)
+};
+
+struct riseSet {
+    uint32_t nCells;
+    uint32_t nWords;
+    uint64_t *up;                       // Cells above the horizon (bitmap)
+    signed char *kind;                  // 1 circumpolar, -1 never rises, 0 rises and sets
+    double  *rise, *set;                // Rise / set LST of each cell
+    struct riseEvent *events;           // Sorted by LST
+    uint32_t nEvents;
+    uint32_t next;                      // Next event of the sweep
+    double  lst;                        // Sweep position
+    int     bValid;                     // Sweep state matches lst
+};
+
+extern void projInit(void);
+extern uint32_t projectStars(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                             uint32_t n, short *px, short *py, uint32_t *idx);
+extern uint32_t projectRange(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                             uint32_t first, uint32_t last, short *px, short *py, uint32_t *idx,
+                             uint32_t nOut);
+extern int cellVisible(double m[3][3], const struct starCell *sc);
+
+extern int riseSetInit(struct riseSet *rs, const struct starCell *cells, uint32_t nCells,
+                       double app[3][3], double siteLat);
+extern void riseSetSweep(struct riseSet *rs, double lst);
+extern void freeRiseSet(struct riseSet *rs);
+
+#endif // SKYPROJ_H_INCLUDED
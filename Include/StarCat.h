@@ -0,0 +1,250 @@
+/* StarCat.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef STARCAT_H_INCLUDED
+#define STARCAT_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Binary star catalog
+
+    The CSV starmap DB is compiled once into a packed binary image which
+    is cached next to it and memory-mapped at startup. The cache is
+    rebuilt whenever the CSV modification time or size changes.
+
+    File layout:    catHeader
+                    catStar[nStars]
+                    catSeg[nSegs]       constellation line vertices
+                    char names[nameSize]
+                    tile index          tiled catalogs only (see below)
+*/
+
+#define CATMAGIC    0x43796b53      // "SkyC"
+#define CATVERSION  2
+
+#define CATLINEMAG  -10.0           // CSV magnitude of a line drawing entry
+
+#define CATTILED    0x0001          // Stars ordered in tiles, tile index follows
+
+struct catHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nStars;
+    uint32_t nSegs;
+    uint32_t nameSize;
+    uint32_t flags;
+    int64_t  srcMtime;              // Source CSV modification time
+    int64_t  srcSize;               // Source CSV size
+};
+
+struct catStar {
+    uint32_t ra;                    // Right ascension, 2^32 = full circle
+    int32_t  dec;                   // Declination, 2^31 = PI
+    int16_t  mag;                   // Visual magnitude * 100
+    char     spect;                 // Spectral class letter
+    char     pad;
+    uint32_t name;                  // Offset into name table
+    int16_t  pmRA;                  // Proper motion RA * cos(Dec), mas/yr
+    int16_t  pmDec;                 // Proper motion Dec, mas/yr
+};
+
+struct catSeg {
+    uint32_t ra;
+    int32_t  dec;
+    char     type;                  // 'S'tart, 'N'ext or 'E'nd of line
+    char     pad[3];
+};
+
+// Unpack quantized catalog values
+#define CATANGLE        (PI / 2147483648.0)
+#define catRA(s)        ((s)->ra * CATANGLE)
+#define catDec(s)       ((s)->dec * CATANGLE)
+#define catMag(s)       ((s)->mag / 100.0)
+#define catPM(pm)       ((pm) * (PI / (180.0 * 3600.0 * 1000.0)))  // mas/yr to rad/yr
+
+struct starCat {
+    void    *base;                  // Catalog image
+    size_t  size;
+    int     bMapped;                // munmap (else free) on close
+    const struct catHeader *hdr;
+    const struct catStar *stars;
+    const struct catSeg *segs;
+    const char *names;
+    const struct tileHeader *tiles; // Tile index (NULL if not tiled)
+};
+
+/*  Resident star store
+
+    Drawable stars are loaded once from the catalog into cache-line aligned
+    structure-of-arrays tables. Line drawing entries and stars fainter than
+    the magnitude limit are dropped at load time, glyph size and display
+    colour are resolved once, so the per-frame pass touches only contiguous
+    arrays of numbers.
+
+    The store is partitioned into HEALPix sky cells (nested scheme) and
+    sorted by magnitude inside each cell. Each cell records a bounding
+    cone, so whole cells below the horizon or outside the view window are
+    skipped with one test and per-frame work follows the visible stars.
+*/
+
+#define STORE_ALIGN     64          // Cache line size
+#define STORE_NSIDE     16          // HEALPix resolution (3072 cells, ~3.7 deg)
+#define CELLPAD         2e-3        // Cell cone margin (radians) for proper motion
+
+struct starCell {
+    uint32_t first;                 // First star of cell in store
+    uint32_t count;
+    double  cx, cy, cz;             // Bounding cone axis (unit vector)
+    double  sinr, cosr;             // Bounding cone half angle sine/cosine
+};
+
+// Sky cell / magnitude sort key
+struct storeKey {
+    uint32_t cell;
+    float   mag;
+    uint32_t k;                     // Catalog index
+};
+
+struct starStore {
+    uint32_t nStars;
+    vreal   *x, *y, *z;             // J2000 equatorial unit vectors
+    float   *mag;                   // Visual magnitude
+    uint16_t *color;                // RGB565 display colour
+    signed char *size;              // Glyph radius (0 = single pixel)
+    uint32_t *id;                   // Catalog star index
+    uint32_t nCells;
+    struct starCell *cells;         // Sky cells, in HEALPix order
+    void    *block;                 // Single allocation backing the arrays
+};
+
+/*  Tiled catalog
+
+    For catalogs too large to hold in memory the stars are written in
+    tile order: by sky cell, then by magnitude band, brightest first.
+    A tile is the run of stars of one cell in one band. The tile index
+    (8 byte aligned after the name table) gives the bounding cone of each
+    cell and the star range of each tile. Only the tiles a frame needs are
+    decoded, into a bounded LRU cache; the mapped file pages are released
+    once decoded.
+
+    Tile index:     tileHeader
+                    starCell[nCells]    cell star range and bounding cone
+                    tileDir[nCells * nBands]
+*/
+
+#define TILEMAXBANDS    8
+#define TILEBUDGET      250000      // Decoded stars held in the tile cache
+#define TILELOOKAHEAD   (5.0 / (24 * 60))   // Prefetch for 5 minutes ahead (days)
+
+struct tileHeader {
+    uint32_t nside;                 // HEALPix resolution
+    uint32_t nCells;
+    uint32_t nBands;
+    uint32_t maxTile;               // Stars in largest tile
+    float    bandMag[TILEMAXBANDS]; // Faint limit of each band
+};
+
+struct tileDir {
+    uint32_t first;                 // First star of tile
+    uint32_t count;
+};
+
+struct tileSlot {
+    int32_t  prev, next;            // LRU list links (-1 = end)
+    struct starStore ss;            // Decoded tile (block NULL if not cached)
+};
+
+struct starTiles {
+    const struct starCat *cat;
+    const struct tileHeader *th;
+    const struct starCell *cells;
+    const struct tileDir *dir;
+    struct tileSlot *slots;         // One per tile
+    int32_t  head, tail;            // Most / least recently used
+    uint32_t nCached;               // Decoded stars in cache
+    double  years;                  // Proper motion epoch of decoded tiles
+    uint32_t hits, misses;
+};
+
+// Growable buffer used while building a catalog
+struct growBuf {
+    char    *data;
+    size_t  used;
+    size_t  size;
+};
+
+/*  Constellation lines
+
+    Line figures are kept apart from the stars as a table of polylines
+    whose vertices refer to catalog stars, so vertices move with the
+    stars' proper motion and the star tables can be sorted freely. Each
+    polyline carries a bounding cone (a starCell over its vertex range)
+    and is culled and projected with the star frame matrix.
+
+    Line files (-C) hold one polyline per CSV line: a figure label, then
+    the names of the stars joined in order. Lines starting with '#' are
+    comments. Catalogs with line drawing entries (magnitude CATLINEMAG)
+    still supply a default line set.
+*/
+
+#define LINENOSTAR  0xffffffff      // Vertex without catalog star
+#define LINEMAXVERT 64              // Vertices per polyline
+
+struct lineSet {
+    uint32_t nLines;
+    uint32_t maxLine;               // Vertices in longest polyline
+    struct starCell *lines;         // Vertex range and bounding cone
+    struct starStore ss;            // Vertex unit vectors, catalog star (id)
+    struct catStar *verts;          // Vertex positions and proper motions
+};
+
+extern int csv_parse(char *sLine, char *sElems[], int nElem);
+extern size_t growAppend(struct growBuf *gb, const void *data, size_t len);
+extern void packStar(struct catStar *cs, double ra, double dec, double mag, char spect, double pmRA, double pmDec);
+extern int openStarCat(const char *fname, struct starCat *cat);
+extern int makeStarCat(const struct growBuf *stars, const struct growBuf *segs,
+                       const struct growBuf *names, struct starCat *cat);
+extern int writeStarCat(const struct starCat *cat, const char *fname);
+extern void closeStarCat(struct starCat *cat);
+extern int loadStarStore(const struct starCat *cat, double magLimit, struct starStore *ss);
+extern void freeStarStore(struct starStore *ss);
+extern uint32_t skyCell(uint32_t nside, double x, double y, double z);
+extern struct storeKey *cellOrder(const struct starCat *cat, uint32_t nside, double magLimit, uint32_t *n);
+extern int allocStarStore(struct starStore *ss, uint32_t n, uint32_t nCells);
+extern void setStoreStar(struct starStore *ss, uint32_t k, const struct catStar *cs, uint32_t id, double years);
+extern void properMotion(const struct starCat *cat, struct starStore *ss, double years);
+extern void storeCellBounds(struct starStore *ss, struct starCell *sc);
+
+extern int loadLineSet(const struct starCat *cat, const char *fname, struct lineSet *ls);
+extern void lineEpoch(struct lineSet *ls, double years);
+extern void freeLineSet(struct lineSet *ls);
+
+extern int writeStarTiles(const struct starCat *cat, const char *fname);
+extern int openStarTiles(const struct starCat *cat, struct starTiles *st);
+extern void closeStarTiles(struct starTiles *st);
+extern int tileNeeded(const struct starTiles *st, uint32_t tile, double magLimit);
+extern const struct starStore *getTile(struct starTiles *st, uint32_t tile);
+extern void tileEpoch(struct starTiles *st, double years);
+extern uint32_t tileStars(const struct starStore *ss, double magLimit);
+extern void prefetchTiles(struct starTiles *st, double m[3][3], double magLimit);
+
+#endif // STARCAT_H_INCLUDED
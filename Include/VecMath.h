@@ -0,0 +1,100 @@
+/* VecMath.h
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef VECMATH_H_INCLUDED
+#define VECMATH_H_INCLUDED
+
+/*  SIMD support
+
+    Vector kernels are compiled for every instruction set the compiler
+    can target and the best one the running CPU supports is selected
+    at run time.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+enum simd_level {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2,
+    SIMD_NEON,
+    SIMD_AVX2
+};
+
+extern int simdlevel(void);
+extern void simdforce(int level);
+extern const char *simdname(int level);
+
+/*  Batch elementary functions
+
+    vecsincos, vecatan2 and vecasin take arrays of n arguments (results may
+    overwrite them) and work a vector at a time on the best instruction
+    set, without fused multiply-add, so every level gives the same bits.
+    Errors against the exact values (checked against long double libm by
+    the VECMATH_TEST_PROGRAM build of VecMath.c):
+
+        sin, cos    |x| <= 2^20 pi/2        2 ulp   (larger |x|: libm)
+        atan2       finite y, x             2 ulp
+        asin        |x| <= 1                2.5 ulp
+
+    Quotients y / x below 2^-1022 in atan2 raise underflow, as libm
+    would for a result that small.
+
+    The sine and cosine reduce by pi/2 in three Cody-Waite steps and use
+    the fdlibm kernel polynomials, also used by the VSOP87 series kernels;
+    atan2 and asin use the fdlibm polynomial and rational approximations.
+*/
+
+#define VECMAGIC    6755399441055744.0          // 1.5 * 2^52, rounds to integer
+#define VECREDUCE   1647099.3291652855          // 2^20 pi/2
+#define VECTINY     7.450580596923828125e-09    // 2^-27: below it sin x = atan x = x
+#define TWOOPI      6.36619772367581382433e-01  // 2 / pi
+#define PIO2_1      1.57079632673412561417e+00  // First 33 bits of pi / 2
+#define PIO2_2      6.07710050630396597660e-11  // Next 33 bits
+#define PIO2_3      2.02226624871116645580e-21  // Next 33 bits
+
+#define SIN1    -1.66666666666666324348e-01
+#define SIN2     8.33333333332248946124e-03
+#define SIN3    -1.98412698298579493134e-04
+#define SIN4     2.75573137070700676789e-06
+#define SIN5    -2.50507602534068634195e-08
+#define SIN6     1.58969099521155010221e-10
+
+#define COS1     4.16666666666666019037e-02
+#define COS2    -1.38888888888741095749e-03
+#define COS3     2.48015872894767294178e-05
+#define COS4    -2.75573143513906633035e-07
+#define COS5     2.08757232129817482790e-09
+#define COS6    -1.13596475577881948265e-11
+
+extern void vecsincos(const double *x, double *sn, double *cs, int n);
+extern void vecatan2(const double *y, const double *x, double *r, int n);
+extern void vecasin(const double *x, double *r, int n);
+
+#endif // VECMATH_H_INCLUDED
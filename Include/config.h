@@ -3,3 +3,9 @@
 // Version info from CMake
 #define VERSION_MAJOR 0
 #define VERSION_MINOR 95
+
+// Single precision star and overlay projection
+#define SKYPI_FLOAT32
+
+// VSOP87 series amplitudes stored as float
+/* #undef SKYPI_VSOP_COMPACT */
@@ -8,7 +8,12 @@
 
 */
 
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
 #include "SkyPi.h"
+#include "VecMath.h"
 
 /*	Astronomical constants	*/
 
@@ -136,7 +141,9 @@ void jhms(double j, int *h, int *m, int *s)
 #ifdef JD_TEST_PROGRAM
 
 	/* Here's a little test program for UCTTOJ and JYEAR which runs
-	   the examples in Meeus and tests the March boundary as well. */
+	   the examples in Meeus and tests the March boundary as well:
+
+	     cc -O2 -DJD_TEST_PROGRAM -IInclude Lib/Astro.c Lib/VecMath.c -lm  */
 
 main()
 {
@@ -234,7 +241,7 @@ void sunpos(double jd, int apparent,
 
     /* Obliquity of the ecliptic. */
 
-    eps = obliqeq(jd);
+    eps = epochObliquity(jd);
 
     /* Corrections for Sun's apparent longitude, if desired. */
 
@@ -279,6 +286,62 @@ double gmst(double jd)
     return theta0;
 }
 
+/*  HORIZMATRIX  --  Compute the rotation matrix which takes an equatorial
+                     unit vector (x towards RA 0h, z towards the north
+                     celestial pole) into local horizon co-ordinates
+                     (x towards the south point, y west, z the zenith) for
+                     the given instant and site.  One matrix per frame
+                     replaces the per-object sidereal time, hour angle and
+                     spherical trigonometry.  */
+
+void horizmatrix(double jd, double siteLat, double siteLon, double m[3][3])
+{
+    double lst, lstsin, lstcos, latsin, latcos;
+
+    lst = dtr(epochGmst(jd) * 15.0) + siteLon;
+    lstsin = sin(lst);
+    lstcos = cos(lst);
+    latsin = sin(siteLat);
+    latcos = cos(siteLat);
+
+    m[0][0] = latsin * lstcos;
+    m[0][1] = latsin * lstsin;
+    m[0][2] = -latcos;
+
+    m[1][0] = lstsin;
+    m[1][1] = -lstcos;
+    m[1][2] = 0;
+
+    m[2][0] = latcos * lstcos;
+    m[2][1] = latcos * lstsin;
+    m[2][2] = latsin;
+}
+
+/*  EQTOHORIZ  --  Rotate the equatorial position RA, DEC (radians) into
+                   a horizon unit vector using a matrix from HORIZMATRIX.  */
+
+void eqtohoriz(double m[3][3], double ra, double dec, double h[3])
+{
+    double x, y, z;
+
+    x = cos(dec) * cos(ra);
+    y = cos(dec) * sin(ra);
+    z = sin(dec);
+
+    h[0] = m[0][0] * x + m[0][1] * y + m[0][2] * z;
+    h[1] = m[1][0] * x + m[1][1] * y + m[1][2] * z;
+    h[2] = m[2][0] * x + m[2][1] * y + m[2][2] * z;
+}
+
+/*  HORIZAZALT  --  Azimuth (from south, west positive) and altitude of a
+                    horizon unit vector.  */
+
+void horizazalt(const double h[3], double *az, double *alt)
+{
+    *az = atan2(h[1], h[0]);
+    *alt = asin(max(-1.0, min(1.0, h[2])));
+}
+
 /*  PHASE  --  Calculate phase of moon as a fraction:
 
     The  argument  is  the  time  for  which  the  phase is requested,
@@ -878,11 +941,81 @@ static long bTerms[NTERMS] = {
 		 107
 };
 
+/*  With a precision target the terms are taken by decreasing amplitude
+	(L and R together, B apart) and only as many as keep the amplitude
+	left out within the target: half of it each for longitude and latitude,
+	and the same fraction of the distance for R.  */
+
+static unsigned char lrOrder[NTERMS], bOrder[NTERMS], moonIdentity[NTERMS];
+static double lTail[NTERMS + 1], rTail[NTERMS + 1], bTail[NTERMS + 1];
+static pthread_once_t moonOnce = PTHREAD_ONCE_INIT;
+
+/*  MOONSORT  --  Order term indices by decreasing |key|.  */
+
+static void moonSort(unsigned char *ord, const long *key)
+{
+	int i, j, t;
+
+	for (i = 0; i < NTERMS; i++) {
+		t = ord[i] = i;
+		for (j = i; (j > 0) && (labs(key[ord[j - 1]]) < labs(key[t])); j--) {
+			ord[j] = ord[j - 1];
+		}
+		ord[j] = t;
+	}
+}
+
+/*  MOONINIT  --  Sorted orders and the amplitude left out after each
+				  count of terms.  */
+
+static void moonInit(void)
+{
+	int i;
+
+	moonSort(lrOrder, lTerms);
+	moonSort(bOrder, bTerms);
+
+	lTail[NTERMS] = rTail[NTERMS] = bTail[NTERMS] = 0;
+	for (i = NTERMS - 1; i >= 0; i--) {
+		moonIdentity[i] = i;
+		lTail[i] = lTail[i + 1] + labs(lTerms[lrOrder[i]]);
+		rTail[i] = rTail[i + 1] + labs(rTerms[lrOrder[i]]);
+		bTail[i] = bTail[i + 1] + labs(bTerms[bOrder[i]]);
+	}
+}
+
+/*  MOONTERMS  --  Fewest terms whose left-out amplitudes, scaled, are
+				   within the limits (tail2 may be NULL).  */
+
+static int moonTerms(const double *tail1, double lim1, const double *tail2, double lim2, double scale)
+{
+	int n = 0;
+
+	while ((n < NTERMS) && ((tail1[n] * scale > lim1) ||
+		   ((tail2 != NULL) && (tail2[n] * scale > lim2)))) {
+		n++;
+	}
+	return n;
+}
+
 void highmoon(double jd, double *l, double *b, double *r, int qPC)
+{
+	struct ephContext ec;
+
+	ec.qPC = qPC;
+	ec.prec = 0;
+	ec.siteLat = ec.siteLon = 0;
+	ec.pi = NULL;
+	highmoonCtx(&ec, jd, l, b, r);
+}
+
+void highmoonCtx(const struct ephContext *ec, double jd, double *l, double *b, double *r)
 {
 	double t, t2, t3, t4, lprime, d, m, mprime, f, a1, a2, a3, e[3],
-		   sigmaL, sigmaB, sigmaR, ang;
-	int nTerms, i;
+		   sigmaL, sigmaB, sigmaR, scale;
+	double ang[2 * NTERMS + 9], sn[2 * NTERMS + 9], cs[2 * NTERMS + 9], *xs;
+	const unsigned char *lrOrd, *bOrd;
+	int nLR, nB, i, k;
 
 	t = (jd - J2000) / JulianCentury;
 
@@ -924,26 +1057,65 @@ void highmoon(double jd, double *l, double *b, double *r, int qPC)
 
 	sigmaL = sigmaB = sigmaR = 0;
 
-    nTerms = (qPC) ? 10 : NTERMS;
-	for (i = 0; i < nTerms; i++) {
-		ang = lrCoeff[i][0] * d + lrCoeff[i][1] * m +
-			  lrCoeff[i][2] * mprime + lrCoeff[i][3] * f;
-		sigmaL += lTerms[i] * sin(ang) * e[abs(lrCoeff[i][1])];
+	pthread_once(&moonOnce, moonInit);
+	if (ec->qPC) {
+		nLR = nB = 10;
+		lrOrd = bOrd = moonIdentity;
+	} else if (ec->prec > 0) {
+		/* L and B in 1e-6 degree, R in 1e-3 km; e[2] is the largest factor */
+		scale = max(1.0, e[2]);
+		nLR = moonTerms(lTail, ec->prec / 2 / 3600.0 * 1e6,
+						rTail, 385000.0 * dtr(ec->prec / 3600.0) * 1e3, scale);
+		nB = moonTerms(bTail, ec->prec / 2 / 3600.0 * 1e6, NULL, 0, scale);
+		lrOrd = lrOrder;
+		bOrd = bOrder;
+	} else {
+		nLR = nB = NTERMS;
+		lrOrd = bOrd = moonIdentity;
+	}
+
+	/* Arguments of the L and R terms, the B terms and the additive
+	   terms, then their sines and cosines in one batch. */
+
+	for (k = 0; k < nLR; k++) {
+		i = lrOrd[k];
+		ang[k] = lrCoeff[i][0] * d + lrCoeff[i][1] * m +
+				 lrCoeff[i][2] * mprime + lrCoeff[i][3] * f;
+	}
+	for (k = 0; k < nB; k++) {
+		i = bOrd[k];
+		ang[nLR + k] = bCoeff[i][0] * d + bCoeff[i][1] * m +
+					   bCoeff[i][2] * mprime + bCoeff[i][3] * f;
+	}
+	xs = ang + nLR + nB;
+	xs[0] = a1;
+	xs[1] = lprime - f;
+	xs[2] = a2;
+	xs[3] = lprime;
+	xs[4] = a3;
+	xs[5] = a1 - f;
+	xs[6] = a1 + f;
+	xs[7] = lprime - mprime;
+	xs[8] = lprime + mprime;
+	vecsincos(ang, sn, cs, nLR + nB + 9);
+
+	for (k = 0; k < nLR; k++) {
+		i = lrOrd[k];
+		sigmaL += lTerms[i] * sn[k] * e[abs(lrCoeff[i][1])];
 		if (rTerms[i] != 0) {
-			sigmaR += rTerms[i] * cos(ang) * e[abs(lrCoeff[i][1])];
+			sigmaR += rTerms[i] * cs[k] * e[abs(lrCoeff[i][1])];
 		}
-
-		ang = bCoeff[i][0] * d + bCoeff[i][1] * m +
-			  bCoeff[i][2] * mprime + bCoeff[i][3] * f;
-		sigmaB += bTerms[i] * sin(ang) * e[abs(bCoeff[i][1])];
+	}
+	for (k = 0; k < nB; k++) {
+		i = bOrd[k];
+		sigmaB += bTerms[i] * sn[nLR + k] * e[abs(bCoeff[i][1])];
 	}
 
-	sigmaL += 3958.0 * sin(a1) + 1962.0 * sin(lprime - f) +
-			  318.0 * sin(a2);
+	xs = sn + nLR + nB;
+	sigmaL += 3958.0 * xs[0] + 1962.0 * xs[1] + 318.0 * xs[2];
 
-	sigmaB += -2235.0 * sin(lprime) + 382.0 * sin(a3) + 175.0 * sin(a1 - f) +
-			  175.0 * sin(a1 + f) + 127.0 * sin(lprime - mprime) -
-			  115.0 * sin(lprime + mprime);
+	sigmaB += -2235.0 * xs[3] + 382.0 * xs[4] + 175.0 * xs[5] +
+			  175.0 * xs[6] + 127.0 * xs[7] - 115.0 * xs[8];
 
 	*l = rtd(lprime) + sigmaL / 1000000.0;
 	*b = sigmaB / 1000000.0;
@@ -1137,7 +1309,7 @@ void nutation(double jd, double *deltaPsi, double *deltaEpsilon)
 	int i, j;
 	double t = (jd - 2451545.0) / 36525.0, t2, t3, to10;
 	double ta[5];
-	double dp = 0, de = 0, ang;
+	double dp = 0, de = 0, ang[NUTERMS], sn[NUTERMS], cs[NUTERMS];
 
 	t3 = t * (t2 = t * t);
 
@@ -1166,16 +1338,20 @@ void nutation(double jd, double *deltaPsi, double *deltaEpsilon)
 		ta[i] = fixangr(ta[i]);
 	}
 
-	to10 = t / 10.0;
 	for (i = 0; i < NUTERMS; i++) {
-		ang = 0;
+		ang[i] = 0;
 		for (j = 0; j < 5; j++) {
 			if (nutArgMult[i][j] != 0) {
-				ang += nutArgMult[i][j] * ta[j];
+				ang[i] += nutArgMult[i][j] * ta[j];
 			}
 		}
-		dp += (nutArgCoeff[i][0] + nutArgCoeff[i][1] * to10) * sin(ang);
-		de += (nutArgCoeff[i][2] + nutArgCoeff[i][3] * to10) * cos(ang);
+	}
+	vecsincos(ang, sn, cs, NUTERMS);
+
+	to10 = t / 10.0;
+	for (i = 0; i < NUTERMS; i++) {
+		dp += (nutArgCoeff[i][0] + nutArgCoeff[i][1] * to10) * sn[i];
+		de += (nutArgCoeff[i][2] + nutArgCoeff[i][3] * to10) * cs[i];
 	}
 
 	/* Return the result, converting from ten thousandths of arc
@@ -1185,6 +1361,103 @@ void nutation(double jd, double *deltaPsi, double *deltaEpsilon)
 	*deltaEpsilon = dtr(de / (3600.0 * 10000.0));
 }
 
+/*  PRECESSMATRIX  --  Rotation taking J2000 mean equatorial unit vectors
+                       to the mean equator and equinox of date, using the
+                       IAU 1976 angles zeta, z and theta (Meeus, chapter
+                       21).  */
+
+void precessmatrix(double jd, double m[3][3])
+{
+    double t = (jd - J2000) / JulianCentury, zeta, z, theta;
+    double zsin, zcos, ssin, scos, tsin, tcos;
+
+    zeta = dtr((2306.2181 * t + 0.30188 * t * t + 0.017998 * t * t * t) / 3600.0);
+    z = dtr((2306.2181 * t + 1.09468 * t * t + 0.018203 * t * t * t) / 3600.0);
+    theta = dtr((2004.3109 * t - 0.42665 * t * t - 0.041833 * t * t * t) / 3600.0);
+
+    ssin = sin(zeta);
+    scos = cos(zeta);
+    zsin = sin(z);
+    zcos = cos(z);
+    tsin = sin(theta);
+    tcos = cos(theta);
+
+    m[0][0] = scos * tcos * zcos - ssin * zsin;
+    m[0][1] = -ssin * tcos * zcos - scos * zsin;
+    m[0][2] = -tsin * zcos;
+
+    m[1][0] = scos * tcos * zsin + ssin * zcos;
+    m[1][1] = -ssin * tcos * zsin + scos * zcos;
+    m[1][2] = -tsin * zsin;
+
+    m[2][0] = scos * tsin;
+    m[2][1] = -ssin * tsin;
+    m[2][2] = tcos;
+}
+
+/*  NUTATEMATRIX  --  Rotation from the mean to the true equator and
+                      equinox of date.  */
+
+void nutatematrix(double jd, double m[3][3])
+{
+    double eps, epst, dpsi, deps;
+    double esin, ecos, etsin, etcos, psin, pcos;
+
+    epochNutation(jd, &dpsi, &deps);
+    eps = dtr(epochObliquity(jd));
+    epst = eps + deps;
+
+    esin = sin(eps);
+    ecos = cos(eps);
+    etsin = sin(epst);
+    etcos = cos(epst);
+    psin = sin(dpsi);
+    pcos = cos(dpsi);
+
+    m[0][0] = pcos;
+    m[0][1] = -psin * ecos;
+    m[0][2] = -psin * esin;
+
+    m[1][0] = psin * etcos;
+    m[1][1] = pcos * etcos * ecos + etsin * esin;
+    m[1][2] = pcos * etcos * esin - etsin * ecos;
+
+    m[2][0] = psin * etsin;
+    m[2][1] = pcos * etsin * ecos - etcos * esin;
+    m[2][2] = pcos * etsin * esin + etcos * ecos;
+}
+
+/*  MATMUL3  --  Product of 3x3 rotation matrices, m = a * b.  m may be
+                 the same array as a or b.  */
+
+void matmul3(double a[3][3], double b[3][3], double m[3][3])
+{
+    double t[3][3];
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            t[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+        }
+    }
+    memcpy(m, t, sizeof(t));
+}
+
+/*  APPARENTMATRIX  --  Rotation taking J2000 catalog positions to the
+                        true equator and equinox of date (precession
+                        followed by nutation), from the per-epoch cache.
+                        It changes slowly, so it is computed once a day and
+                        folded into the per-frame horizon matrix.  */
+
+void apparentmatrix(double jd, double m[3][3])
+{
+    double p[3][3];
+
+    epochPrecess(jd, p);
+    nutatematrix(jd, m);
+    matmul3(m, p, m);
+}
+
 /*  ECLIPTOEQ  --  Convert celestial (ecliptical) longitude and latitude into
 				   right ascension (in radians) and declination.  We must supply
 				   the time of the conversion in order to compensate correctly
@@ -1196,7 +1469,7 @@ void ecliptoeq(double jd, double Lambda, double Beta, double *Ra, double *Dec)
 
     /* Obliquity of the ecliptic. */
 
-    eps = dtr(obliqeq(jd));
+    eps = dtr(epochObliquity(jd));
 
     *Ra = fixangr(atan2((cos(eps) * sin(dtr(Lambda)) -
 					     (tan(dtr(Beta)) * sin(eps))), cos(dtr(Lambda))));
@@ -1204,3 +1477,196 @@ void ecliptoeq(double jd, double Lambda, double Beta, double *Ra, double *Dec)
 			     (sin(dtr(Beta)) * cos(eps)));
 
 }
+
+/*  Per-epoch cache
+
+    Obliquity, nutation, sidereal time and precession depend only on the
+    instant, yet the Sun, Moon and planets, the star matrix and the
+    ecliptic all ask for them.  They are kept here in tiers by how fast
+    they change:
+
+        mean obliquity and nutation     sampled on the hour, interpolated
+        sidereal time                   once per instant asked (a frame)
+        precession matrix               sampled at 0h UT, interpolated
+
+    Linear interpolation over an hour leaves some 1e-5 arcsec in the
+    nutation (its fastest term of note, 0.23 arcsec, has a period of 13.7
+    days) and over a day 1e-8 arcsec in the precession matrix; the
+    EPOCH_TEST_PROGRAM build of this file measures both.  The cache is per
+    thread, so the ephemeris worker does not disturb the display loop.  */
+
+#define EpochSteps  24                  /* Nutation samples per day */
+
+struct epochCache {
+    int     bHour, bDay;
+    double  hour;                       /* Sampled hour, jd * EpochSteps */
+    double  missHour, missJD;           /* Last time evaluated directly */
+    double  obliq[2], dpsi[2], deps[2]; /* At hour and the one after */
+    double  day;                        /* Sampled day, at 0h UT */
+    double  prec[2][3][3];              /* At day and the one after */
+    double  gmstJD[2], gmstVal[2];      /* Last instants asked for */
+    int     gmstNext;
+};
+
+static __thread struct epochCache epochc;
+
+/*  EPOCHSAMPLE  --  Sample obliquity and nutation at the given hour
+                     into slot k.  */
+
+static void epochSample(int k, double hour)
+{
+    double jd = hour / EpochSteps;
+
+    epochc.obliq[k] = obliqeq(jd);
+    nutation(jd, &epochc.dpsi[k], &epochc.deps[k]);
+}
+
+/*  EPOCHHOUR  --  Bring the hourly samples around jd and return the
+                   fraction of the hour elapsed, or -1 if jd is to be
+                   evaluated directly.  A jump away from the sampled hour
+                   is taken directly the first time: sampling sparser
+                   than hourly (the ephemeris fits) would otherwise pay
+                   for two samples at every step.  A second time in the
+                   same hour (not the same instant) moves the samples
+                   there.  */
+
+static double epochHour(double jd)
+{
+    double hour = floor(jd * EpochSteps);
+
+    if (!epochc.bHour || (hour != epochc.hour)) {
+        if (epochc.bHour && (hour == epochc.hour + 1)) {
+            epochc.obliq[0] = epochc.obliq[1];
+            epochc.dpsi[0] = epochc.dpsi[1];
+            epochc.deps[0] = epochc.deps[1];
+        } else if (!epochc.bHour || ((hour == epochc.missHour) && (jd != epochc.missJD))) {
+            epochSample(0, hour);
+        } else {
+            epochc.missHour = hour;
+            epochc.missJD = jd;
+            return -1;
+        }
+        epochSample(1, hour + 1);
+        epochc.hour = hour;
+        epochc.bHour = TRUE;
+    }
+    return jd * EpochSteps - hour;
+}
+
+/*  EPOCHOBLIQUITY  --  Mean obliquity of the ecliptic (degrees), as
+                        OBLIQEQ but from the cache.  */
+
+double epochObliquity(double jd)
+{
+    double f = epochHour(jd);
+
+    if (f < 0) {
+        return obliqeq(jd);
+    }
+    return epochc.obliq[0] + f * (epochc.obliq[1] - epochc.obliq[0]);
+}
+
+/*  EPOCHNUTATION  --  Nutation in longitude and obliquity (radians), as
+                       NUTATION but from the cache.  */
+
+void epochNutation(double jd, double *deltaPsi, double *deltaEpsilon)
+{
+    double f = epochHour(jd);
+
+    if (f < 0) {
+        nutation(jd, deltaPsi, deltaEpsilon);
+        return;
+    }
+    *deltaPsi = epochc.dpsi[0] + f * (epochc.dpsi[1] - epochc.dpsi[0]);
+    *deltaEpsilon = epochc.deps[0] + f * (epochc.deps[1] - epochc.deps[0]);
+}
+
+/*  EPOCHGMST  --  Greenwich mean sidereal time (hours), computed once for
+                   each of the last two instants asked for (the frame and
+                   the tile look-ahead).  */
+
+double epochGmst(double jd)
+{
+    int k;
+
+    for (k = 0; k < 2; k++) {
+        if (epochc.gmstJD[k] == jd) {
+            return epochc.gmstVal[k];
+        }
+    }
+    k = epochc.gmstNext;
+    epochc.gmstNext ^= 1;
+    epochc.gmstJD[k] = jd;
+    epochc.gmstVal[k] = gmst(jd);
+    return epochc.gmstVal[k];
+}
+
+/*  EPOCHPRECESS  --  Precession matrix as PRECESSMATRIX, interpolated
+                      between the matrices of 0h UT either side of jd.  */
+
+void epochPrecess(double jd, double m[3][3])
+{
+    double day = floor(jd - 0.5) + 0.5, f;
+    int i, j;
+
+    if (!epochc.bDay || (day != epochc.day)) {
+        if (epochc.bDay && (day == epochc.day + 1)) {
+            memcpy(epochc.prec[0], epochc.prec[1], sizeof(epochc.prec[0]));
+        } else {
+            precessmatrix(day, epochc.prec[0]);
+        }
+        precessmatrix(day + 1, epochc.prec[1]);
+        epochc.day = day;
+        epochc.bDay = TRUE;
+    }
+
+    f = jd - day;
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            m[i][j] = epochc.prec[0][i][j] + f * (epochc.prec[1][i][j] - epochc.prec[0][i][j]);
+        }
+    }
+}
+
+#ifdef EPOCH_TEST_PROGRAM
+
+	/* Compare the cached values with direct evaluation at random
+	   instants over two decades:
+
+	     cc -O2 -DEPOCH_TEST_PROGRAM -IInclude Lib/Astro.c Lib/VecMath.c -lm  */
+
+#include <stdio.h>
+
+int main(void)
+{
+    double jd = J2000, dp, de, dp1, de1, p[3][3], q[3][3];
+    double errObl = 0, errPsi = 0, errEps = 0, errPrec = 0;
+    int k, i, j;
+
+    srand(1);
+    for (k = 0; k < 1000000; k++) {
+        /* Walk forward a few minutes at a time, jumping now and then */
+        jd = (k % 1000 == 0) ? J2000 + (rand() % 7300) : jd + (rand() % 600) / 86400.0;
+
+        errObl = max(errObl, fabs(epochObliquity(jd) - obliqeq(jd)) * 3600.0);
+        epochNutation(jd, &dp, &de);
+        nutation(jd, &dp1, &de1);
+        errPsi = max(errPsi, fabs(rtd(dp - dp1)) * 3600.0);
+        errEps = max(errEps, fabs(rtd(de - de1)) * 3600.0);
+        if (k % 10 == 0) {
+            epochPrecess(jd, p);
+            precessmatrix(jd, q);
+            for (i = 0; i < 3; i++) {
+                for (j = 0; j < 3; j++) {
+                    errPrec = max(errPrec, fabs(rtd(p[i][j] - q[i][j])) * 3600.0);
+                }
+            }
+        }
+    }
+
+    printf("Worst error (arcsec): obliquity %.2g  dPsi %.2g  dEps %.2g  precession %.2g\n",
+           errObl, errPsi, errEps, errPrec);
+
+    return 0;
+}
+#endif
@@ -0,0 +1,301 @@
+/* EphBatch.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SkyPi.h"
+#include "EphBatch.h"
+
+//-------------------------------------------------------------------------------
+// batchStep    Spacing of the times if they are evenly spaced, else 0
+
+static double batchStep(const double *jd, int n)
+{
+    double step;
+    int k;
+
+    if (n < EPHBATCHGRID)
+        return 0;
+
+    step = (jd[n - 1] - jd[0]) / (n - 1);
+    if (step == 0)
+        return 0;
+    for (k = 1; k < n - 1; k++)
+    {
+        if (fabs(jd[k] - (jd[0] + k * step)) > EPHBATCHSLACK)
+            return 0;
+    }
+
+    return step;
+}
+
+// batchRun     Positions for epochs k0..k1-1 of the batch
+
+static void batchRun(const struct ephPool *pp, int k0, int k1)
+{
+    struct vsopGrid g;
+    int k;
+
+    if ((pp->step != 0) && (k1 - k0 >= EPHBATCHGRID) &&
+        (vsopGridOpen(&g, pp->jd[0] + k0 * pp->step, pp->step, pp->qPC) == 0))
+    {
+        for (k = k0; k < k1; k++)
+            planetsGrid(&g, pp->pi[k]);
+        vsopGridClose(&g);
+        return;
+    }
+
+    for (k = k0; k < k1; k++)
+        planetsAt(pp->jd[k], pp->qPC, pp->pi[k]);
+
+    return;
+}
+
+// batchWork    Take runs of the batch until none are left (lock held)
+
+static void batchWork(struct ephPool *pp)
+{
+    int k0, k1;
+
+    while (pp->next < pp->n)
+    {
+        k0 = pp->next;
+        k1 = min(k0 + pp->run, pp->n);
+        pp->next = k1;
+        pp->busy++;
+        pthread_mutex_unlock(&pp->lock);
+        batchRun(pp, k0, k1);
+        pthread_mutex_lock(&pp->lock);
+        if (--pp->busy == 0)
+            pthread_cond_broadcast(&pp->done);
+    }
+
+    return;
+}
+
+static void *poolWorker(void *arg)
+{
+    struct ephPool *pp = arg;
+
+    pthread_mutex_lock(&pp->lock);
+    while (!pp->bStop)
+    {
+        if (pp->next < pp->n)
+            batchWork(pp);
+        else
+            pthread_cond_wait(&pp->wake, &pp->lock);
+    }
+    pthread_mutex_unlock(&pp->lock);
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------
+// ephPoolOpen  Start nThreads workers besides the caller (-1 if they
+//              cannot be started)
+
+int ephPoolOpen(struct ephPool *pp, int nThreads)
+{
+    int k;
+
+    memset(pp, 0, sizeof(*pp));
+    pthread_mutex_init(&pp->lock, NULL);
+    pthread_cond_init(&pp->wake, NULL);
+    pthread_cond_init(&pp->done, NULL);
+
+    if (nThreads <= 0)
+        return 0;
+
+    pp->threads = calloc(nThreads, sizeof(pthread_t));
+    if (pp->threads == NULL)
+    {
+        printf("Out of memory for ephemeris pool\n");
+        ephPoolClose(pp);
+        return -1;
+    }
+    for (k = 0; k < nThreads; k++)
+    {
+        if (pthread_create(&pp->threads[k], NULL, poolWorker, pp) != 0)
+        {
+            printf("Cannot start ephemeris pool\n");
+            ephPoolClose(pp);
+            return -1;
+        }
+        pp->nThreads++;
+    }
+
+    return 0;
+}
+
+void ephPoolClose(struct ephPool *pp)
+{
+    int k;
+
+    pthread_mutex_lock(&pp->lock);
+    pp->bStop = TRUE;
+    pthread_cond_broadcast(&pp->wake);
+    pthread_mutex_unlock(&pp->lock);
+
+    for (k = 0; k < pp->nThreads; k++)
+        pthread_join(pp->threads[k], NULL);
+    free(pp->threads);
+
+    pthread_cond_destroy(&pp->done);
+    pthread_cond_destroy(&pp->wake);
+    pthread_mutex_destroy(&pp->lock);
+    memset(pp, 0, sizeof(*pp));
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// planetsBatch Positions of all bodies at jd[0..n-1] into pi[0..n-1], on
+//              the threads of pool pp and the caller's (in line if pp is
+//              NULL)
+
+void planetsBatch(struct ephPool *pp, const double *jd, int n, int qPC, struct planet (*pi)[EPHBODIES])
+{
+    struct ephPool job;
+    int k;
+
+    if (n <= 0)
+        return;
+
+    if (pp == NULL)
+    {
+        memset(&job, 0, sizeof(job));
+        job.jd = jd;
+        job.pi = pi;
+        job.n = n;
+        job.qPC = qPC;
+        job.step = batchStep(jd, n);
+        for (k = 0; k < n; k += EPHBATCHRUN)
+            batchRun(&job, k, min(k + EPHBATCHRUN, n));
+        return;
+    }
+
+    pthread_mutex_lock(&pp->lock);
+    pp->jd = jd;
+    pp->pi = pi;
+    pp->n = n;
+    pp->qPC = qPC;
+    pp->step = batchStep(jd, n);
+    pp->next = 0;
+
+    // Enough runs for every thread, but not so short a grid is not worth it
+    pp->run = (n + pp->nThreads) / (pp->nThreads + 1);
+    pp->run = max(EPHBATCHGRID, min(EPHBATCHRUN, pp->run));
+
+    pthread_cond_broadcast(&pp->wake);
+    batchWork(pp);
+    while (pp->busy > 0)
+        pthread_cond_wait(&pp->done, &pp->lock);
+    pp->n = 0;
+    pthread_mutex_unlock(&pp->lock);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+#ifdef EPHBATCH_TEST_PROGRAM
+
+/*  Compare batches with planetsAt() and time them on a pool (of a
+    thread per core besides the caller, or argv[1] threads):
+
+      cc -O2 -DEPHBATCH_TEST_PROGRAM -IInclude Lib/EphBatch.c Lib/Vsop87.c \
+         Lib/Astro.c Lib/VecMath.c -lm -lpthread  */
+
+#include <unistd.h>
+#include <time.h>
+
+static double secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double worstDiff(const double *jd, int n, struct planet (*pi)[EPHBODIES])
+{
+    struct planet ref[EPHBODIES];
+    double worst = 0;
+    int k, i;
+
+    for (k = 0; k < n; k++)
+    {
+        planetsAt(jd[k], FALSE, ref);
+        for (i = 0; i < EPHBODIES; i++)
+        {
+            worst = max(worst, fabs(remainder(pi[k][i].ra - ref[i].ra, PI * 2)) * cos(ref[i].dec));
+            worst = max(worst, fabs(pi[k][i].dec - ref[i].dec));
+        }
+    }
+
+    return rtd(worst) * 3600;
+}
+
+int main(int argc, char **argv)
+{
+    struct ephPool pool;
+    struct planet (*pi)[EPHBODIES];
+    double *jd, t0, tLine, tPool;
+    int k, n = 20000, bad = 0, pass, nThreads;
+
+    nThreads = (argc > 1) ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+    jd = malloc(n * sizeof(double));
+    pi = malloc(n * sizeof(*pi));
+    if ((jd == NULL) || (pi == NULL) ||
+        (ephPoolOpen(&pool, nThreads) < 0))
+        return EXIT_FAILURE;
+
+    // Evenly spaced (grid) and scattered times
+    for (pass = 0; pass < 2; pass++)
+    {
+        srand(1);
+        for (k = 0; k < n; k++)
+            jd[k] = pass ? J2000 + rand() % 36525 + (rand() % 1440) / 1440.0 : J2000 + k * 0.25;
+
+        t0 = secs();
+        planetsBatch(NULL, jd, n, FALSE, pi);
+        tLine = secs() - t0;
+        t0 = secs();
+        planetsBatch(&pool, jd, n, FALSE, pi);
+        tPool = secs() - t0;
+
+        printf("%s: worst %.2g arcsec, %.1f us per epoch in line, %.1f us on %d+1 threads\n",
+               pass ? "scattered" : "evenly spaced", worstDiff(jd, n, pi),
+               tLine / n * 1e6, tPool / n * 1e6, pool.nThreads);
+        bad += (worstDiff(jd, n, pi) > 1e-4);
+    }
+
+    ephPoolClose(&pool);
+    free(pi);
+    free(jd);
+
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,495 @@
+/* EphCache.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "SkyPi.h"
+#include "EphCache.h"
+
+// segStart     Start of the segment holding jd
+
+static double segStart(double jd)
+{
+    return floor(jd / EPHSEGDAYS) * EPHSEGDAYS;
+}
+
+static struct ephSegment *segSlot(struct ephCache *ec, double jd0)
+{
+    return &ec->seg[(int64_t)floor(jd0 / EPHSEGDAYS) % EPHSEGS];
+}
+
+//-------------------------------------------------------------------------------
+// ephNode      Time of the k'th Chebyshev node from the start of a segment
+
+static double ephNode(int k)
+{
+    return (cos(PI * (k + 0.5) / EPHDEGREE) + 1.0) * 0.5 * EPHSEGDAYS;
+}
+
+// fitSamples   Fit the segment starting at jd0 from positions at the nodes
+
+static void fitSamples(struct ephSegment *seg, double jd0, struct planet pi[EPHDEGREE][EPHBODIES])
+{
+    double f[EPHDEGREE], sum;
+    int i, j, k, c;
+
+    for (i = 0; i < EPHBODIES; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            for (k = 0; k < EPHDEGREE; k++)
+            {
+                f[k] = (c == 0) ? pi[k][i].ra : (c == 1) ? pi[k][i].dec : pi[k][i].dist;
+
+                // Nodes are adjacent in time, keep RA continuous
+                if ((c == 0) && (k > 0))
+                    f[k] -= PI * 2 * floor((f[k] - f[k - 1] + PI) / (PI * 2));
+            }
+
+            for (j = 0; j < EPHDEGREE; j++)
+            {
+                sum = 0;
+                for (k = 0; k < EPHDEGREE; k++)
+                    sum += f[k] * cos(PI * j * (k + 0.5) / EPHDEGREE);
+                seg->fit.coef[i][c][j] = sum * 2.0 / EPHDEGREE;
+            }
+            seg->fit.coef[i][c][0] *= 0.5;
+        }
+        seg->mid[i] = pi[EPHDEGREE / 2][i];
+    }
+    seg->jd0 = jd0;
+    seg->bValid = TRUE;
+
+    return;
+}
+
+// ephFit       Fit the segment starting at jd0 from the series sampled at
+//              the Chebyshev nodes
+
+void ephFit(struct ephSegment *seg, double jd0, int bQuick)
+{
+    struct planet pi[EPHDEGREE][EPHBODIES];
+    int k;
+
+    for (k = 0; k < EPHDEGREE; k++)
+        planetsAt(jd0 + ephNode(k), bQuick, pi[k]);
+    fitSamples(seg, jd0, pi);
+
+    return;
+}
+
+// chebPlanets  RA, Dec and distance at t (-1..1 over the segment) from
+//              the coefficients of a fit (Clenshaw sums)
+
+static void chebPlanets(const struct ephRecord *fit, double t, struct planet *pi)
+{
+    const double *cf;
+    double b0, b1, b2, v[3];
+    int i, c, j;
+
+    for (i = 0; i < EPHBODIES; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            cf = fit->coef[i][c];
+            b1 = b2 = 0;
+            for (j = EPHDEGREE - 1; j > 0; j--)
+            {
+                b0 = 2.0 * t * b1 - b2 + cf[j];
+                b2 = b1;
+                b1 = b0;
+            }
+            v[c] = t * b1 - b2 + cf[0];
+        }
+
+        pi[i].ra = fixangr(v[0]);
+        pi[i].dec = v[1];
+        pi[i].dist = v[2];
+    }
+
+    return;
+}
+
+// ephEval      Positions at jd from a fitted segment
+
+void ephEval(const struct ephSegment *seg, double jd, struct planet *pi)
+{
+    memcpy(pi, seg->mid, sizeof(seg->mid));
+    chebPlanets(&seg->fit, 2.0 * (jd - seg->jd0) / EPHSEGDAYS - 1.0, pi);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// ephWorker    Fit the segments around the last requested time as it
+//              moves forward
+
+static void *ephWorker(void *arg)
+{
+    struct ephCache *ec = arg;
+    struct ephSegment *sp, seg;
+    double jd0;
+    int k, bQuick;
+
+    pthread_mutex_lock(&ec->lock);
+    while (!ec->bStop)
+    {
+        // Current segment first, then the next one
+        for (k = 0; k < EPHSEGS; k++)
+        {
+            jd0 = segStart(ec->want) + k * EPHSEGDAYS;
+            sp = segSlot(ec, jd0);
+            if (!sp->bValid || (sp->jd0 != jd0))
+                break;
+        }
+        if ((ec->want == 0) || (k == EPHSEGS))
+        {
+            pthread_cond_wait(&ec->wake, &ec->lock);
+            continue;
+        }
+
+        bQuick = ec->bQuick;
+        pthread_mutex_unlock(&ec->lock);
+        ephFit(&seg, jd0, bQuick);
+        pthread_mutex_lock(&ec->lock);
+
+        *segSlot(ec, jd0) = seg;
+        ec->fits++;
+    }
+    pthread_mutex_unlock(&ec->lock);
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------
+// ephOpen      Start the cache worker (-1 if it cannot be started)
+
+int ephOpen(struct ephCache *ec, int bQuick)
+{
+    memset(ec, 0, sizeof(*ec));
+    ec->bQuick = bQuick;
+    pthread_mutex_init(&ec->lock, NULL);
+    pthread_cond_init(&ec->wake, NULL);
+
+    if (pthread_create(&ec->thread, NULL, ephWorker, ec) != 0)
+    {
+        printf("Cannot start ephemeris worker\n");
+        pthread_cond_destroy(&ec->wake);
+        pthread_mutex_destroy(&ec->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+void ephClose(struct ephCache *ec)
+{
+    pthread_mutex_lock(&ec->lock);
+    ec->bStop = TRUE;
+    pthread_cond_signal(&ec->wake);
+    pthread_mutex_unlock(&ec->lock);
+
+    pthread_join(ec->thread, NULL);
+    pthread_cond_destroy(&ec->wake);
+    pthread_mutex_destroy(&ec->lock);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// ephPlanets   Positions of all bodies at jd into pi[EPHBODIES], from the
+//              cache if its segment is fitted (0), else from the series (1)
+
+int ephPlanets(struct ephCache *ec, double jd, struct planet *pi)
+{
+    struct ephSegment *sp;
+    double jd0 = segStart(jd);
+
+    pthread_mutex_lock(&ec->lock);
+    if (jd != ec->want)
+    {
+        ec->want = jd;
+        pthread_cond_signal(&ec->wake);
+    }
+
+    sp = segSlot(ec, jd0);
+    if (sp->bValid && (sp->jd0 == jd0))
+    {
+        ephEval(sp, jd, pi);
+        ec->hits++;
+        pthread_mutex_unlock(&ec->lock);
+        return 0;
+    }
+    ec->misses++;
+    pthread_mutex_unlock(&ec->lock);
+
+    planetsAt(jd, ec->bQuick, pi);
+
+    return 1;
+}
+
+//-------------------------------------------------------------------------------
+// writeEphFile     Fit nSegs segments from jdStart and write them as an
+//                  ephemeris file. Segments are shared out among nJobs
+//                  processes, each writing its records in place.
+
+int writeEphFile(const char *fname, double jdStart, uint32_t nSegs, int bQuick, int nJobs)
+{
+    struct ephHeader hdr;
+    struct ephSegment seg;
+    struct vsopGrid grid[EPHDEGREE];
+    struct planet pi[EPHDEGREE][EPHBODIES];
+    char    tname[PATH_MAX];
+    pid_t   *pids;
+    uint32_t k;
+    int     fd, j, m, status, rc;
+
+    nJobs = max(1, min(nJobs, (int)nSegs));
+    pids = calloc(nJobs, sizeof(pid_t));
+    if (pids == NULL)
+    {
+        printf("Out of memory\n");
+        return -1;
+    }
+
+    snprintf(tname, sizeof(tname), "%s.tmp", fname);
+    fd = open(tname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("Cannot create ephemeris file: %s\n", tname);
+        free(pids);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = EPHMAGIC;
+    hdr.version = EPHVERSION;
+    hdr.nBodies = EPHBODIES;
+    hdr.degree = EPHDEGREE;
+    hdr.nSegs = nSegs;
+    hdr.flags = bQuick ? EPHQUICK : 0;
+    hdr.jdStart = jdStart;
+    hdr.segDays = EPHSEGDAYS;
+
+    rc = 0;
+    if ((pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) ||
+        (ftruncate(fd, sizeof(hdr) + (off_t)nSegs * sizeof(struct ephRecord)) < 0))
+        rc = -1;
+
+    // Every nJobs'th segment per process. Each node then steps by a fixed
+    // interval, so its positions come from a uniform grid.
+    for (j = 0; (rc == 0) && (j < nJobs); j++)
+    {
+        pids[j] = fork();
+        if (pids[j] == 0)
+        {
+            for (m = 0; m < EPHDEGREE; m++)
+            {
+                if (vsopGridOpen(&grid[m], jdStart + j * EPHSEGDAYS + ephNode(m), nJobs * EPHSEGDAYS, bQuick) < 0)
+                    _exit(EXIT_FAILURE);
+            }
+            for (k = j; k < nSegs; k += nJobs)
+            {
+                for (m = 0; m < EPHDEGREE; m++)
+                    planetsGrid(&grid[m], pi[m]);
+                fitSamples(&seg, jdStart + k * EPHSEGDAYS, pi);
+                if (pwrite(fd, &seg.fit, sizeof(seg.fit),
+                           sizeof(hdr) + (off_t)k * sizeof(struct ephRecord)) != sizeof(seg.fit))
+                    _exit(EXIT_FAILURE);
+            }
+            _exit(EXIT_SUCCESS);
+        }
+        if (pids[j] < 0)
+            rc = -1;
+    }
+    for (j = 0; j < nJobs; j++)
+    {
+        if (pids[j] <= 0)
+            break;
+        if ((waitpid(pids[j], &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+            rc = -1;
+    }
+    free(pids);
+
+    if (close(fd) != 0)
+        rc = -1;
+    if (rc == 0)
+        rc = rename(tname, fname);
+    if (rc != 0)
+    {
+        printf("Error writing ephemeris file: %s\n", tname);
+        unlink(tname);
+    }
+
+    return rc;
+}
+
+//-------------------------------------------------------------------------------
+// openEphFile  Memory-map an ephemeris file (-1 if missing or not valid)
+
+int openEphFile(const char *fname, struct ephFile *ef)
+{
+    const struct ephHeader *hdr;
+    struct stat st;
+    int fd;
+
+    memset(ef, 0, sizeof(*ef));
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(struct ephHeader)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    ef->size = st.st_size;
+    ef->base = mmap(NULL, ef->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ef->base == MAP_FAILED)
+    {
+        ef->base = NULL;
+        return -1;
+    }
+
+    hdr = ef->base;
+    if ((hdr->magic != EPHMAGIC) || (hdr->version != EPHVERSION) ||
+        (hdr->nBodies != EPHBODIES) || (hdr->degree != EPHDEGREE) || (hdr->segDays <= 0) ||
+        (ef->size != sizeof(*hdr) + (size_t)hdr->nSegs * sizeof(struct ephRecord)))
+    {
+        closeEphFile(ef);
+        return -1;
+    }
+    ef->hdr = hdr;
+    ef->recs = (const struct ephRecord *)(hdr + 1);
+
+    return 0;
+}
+
+void closeEphFile(struct ephFile *ef)
+{
+    if (ef->base != NULL)
+        munmap(ef->base, ef->size);
+    memset(ef, 0, sizeof(*ef));
+
+    return;
+}
+
+// ephFilePlanets   Positions at jd from an ephemeris file (-1 if outside it)
+
+int ephFilePlanets(const struct ephFile *ef, double jd, struct planet *pi)
+{
+    double k;
+
+    if (ef->hdr == NULL)
+        return -1;
+
+    k = floor((jd - ef->hdr->jdStart) / ef->hdr->segDays);
+    if ((k < 0) || (k >= ef->hdr->nSegs))
+        return -1;
+
+    memset(pi, 0, EPHBODIES * sizeof(struct planet));
+    chebPlanets(&ef->recs[(uint32_t)k],
+                2.0 * (jd - ef->hdr->jdStart - k * ef->hdr->segDays) / ef->hdr->segDays - 1.0, pi);
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+#ifdef EPH_TEST_PROGRAM
+
+#include <time.h>
+#include <unistd.h>
+
+static double secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Fit error against the series, then a minute by minute run of the cache
+
+int main(void)
+{
+    static const char *names[EPHBODIES] = { "Sun", "Mercury", "Venus", "Moon", "Mars", "Jupiter", "Saturn" };
+    struct ephSegment seg;
+    struct ephCache ec;
+    struct planet ref[EPHBODIES], fit[EPHBODIES];
+    double worst[EPHBODIES], jd, jd0, e, t0, tEval, tSeries;
+    int i, k, n;
+
+    memset(worst, 0, sizeof(worst));
+    for (jd0 = J2000 - 3650; jd0 < J2000 + 3650; jd0 += 97 * EPHSEGDAYS)
+    {
+        ephFit(&seg, jd0, FALSE);
+        for (k = 0; k <= 100; k++)
+        {
+            jd = jd0 + k * EPHSEGDAYS / 100;
+            planetsAt(jd, FALSE, ref);
+            ephEval(&seg, jd, fit);
+            for (i = 0; i < EPHBODIES; i++)
+            {
+                e = hypot(ref[i].dec - fit[i].dec,
+                          cos(ref[i].dec) * (fixangr(ref[i].ra - fit[i].ra + PI) - PI));
+                worst[i] = max(worst[i], rtd(e) * 3600);
+            }
+        }
+    }
+    for (i = 0; i < EPHBODIES; i++)
+        printf("%-8s worst fit error %.5f arcsec\n", names[i], worst[i]);
+
+    n = 10000;
+    t0 = secs();
+    for (k = 0; k < n; k++)
+        ephEval(&seg, seg.jd0 + (k % 100) * 0.01, fit);
+    tEval = secs() - t0;
+    t0 = secs();
+    for (k = 0; k < n / 10; k++)
+        planetsAt(seg.jd0 + (k % 100) * 0.01, FALSE, ref);
+    tSeries = (secs() - t0) * 10;
+    printf("Evaluation %.2f us, series %.2f us per epoch\n", tEval / n * 1e6, tSeries / n * 1e6);
+
+    // Three simulated days a minute at a time
+    if (ephOpen(&ec, FALSE) < 0)
+        return EXIT_FAILURE;
+    for (jd = J2000; jd < J2000 + 3; jd += 1.0 / 1440)
+    {
+        ephPlanets(&ec, jd, fit);
+        usleep(200);
+    }
+    ephClose(&ec);
+    printf("%u hits, %u misses, %u fits\n", ec.hits, ec.misses, ec.fits);
+
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,206 @@
+/* RiseSet.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SkyPi.h"
+#include "StarCat.h"
+#include "SkyProj.h"
+
+static int eventCompare(const void *a, const void *b)
+{
+    const struct riseEvent *ea = a, *eb = b;
+
+    return (ea->lst < eb->lst) ? -1 : (ea->lst > eb->lst) ? 1 : 0;
+}
+
+//-------------------------------------------------------------------------------
+// riseSetInit  Rise and set sidereal times of the sky cells for a site.
+//              app takes the J2000 cell axes to the equator of date.
+
+int riseSetInit(struct riseSet *rs, const struct starCell *cells, uint32_t nCells,
+                double app[3][3], double siteLat)
+{
+    const struct starCell *sc;
+    double  latsin = sin(siteLat), latcos = cos(siteLat);
+    double  a[3], ra, decsin, deccos, den, c, h0;
+    uint32_t k;
+
+    if (rs->nCells != nCells)
+    {
+        freeRiseSet(rs);
+        rs->nCells = nCells;
+        rs->nWords = (nCells + 63) / 64;
+        rs->up = calloc(rs->nWords, sizeof(uint64_t));
+        rs->kind = malloc(nCells * sizeof(signed char));
+        rs->rise = malloc(nCells * sizeof(double));
+        rs->set = malloc(nCells * sizeof(double));
+        rs->events = malloc(2 * nCells * sizeof(struct riseEvent));
+        if ((rs->up == NULL) || (rs->kind == NULL) || (rs->rise == NULL) ||
+            (rs->set == NULL) || (rs->events == NULL))
+        {
+            printf("Out of memory for horizon timeline\n");
+            freeRiseSet(rs);
+            return -1;
+        }
+    }
+
+    rs->nEvents = 0;
+    for (k = 0, sc = cells; k < nCells; k++, sc++)
+    {
+        if (sc->count == 0)
+        {
+            rs->kind[k] = -1;
+            continue;
+        }
+
+        // Cell axis, equator of date
+        a[0] = app[0][0] * sc->cx + app[0][1] * sc->cy + app[0][2] * sc->cz;
+        a[1] = app[1][0] * sc->cx + app[1][1] * sc->cy + app[1][2] * sc->cz;
+        a[2] = app[2][0] * sc->cx + app[2][1] * sc->cy + app[2][2] * sc->cz;
+        ra = atan2(a[1], a[0]);
+        decsin = a[2];
+        deccos = sqrt(a[0] * a[0] + a[1] * a[1]);
+
+        // Above the horizon (as cellVisible) while sin(alt) >= -sinr:
+        // latcos * deccos * cos(H) + latsin * decsin >= -sinr
+        den = latcos * deccos;
+        if (den < 1e-9)
+        {
+            rs->kind[k] = (latsin * decsin >= -sc->sinr) ? 1 : -1;
+            continue;
+        }
+        c = (-sc->sinr - latsin * decsin) / den;
+        if (c <= -1.0)
+        {
+            rs->kind[k] = 1;
+            continue;
+        }
+        if (c >= 1.0)
+        {
+            rs->kind[k] = -1;
+            continue;
+        }
+
+        h0 = acos(c) + RISEMARGIN;
+        if (h0 >= PI)
+        {
+            rs->kind[k] = 1;
+            continue;
+        }
+
+        rs->kind[k] = 0;
+        rs->rise[k] = fixangr(ra - h0);
+        rs->set[k] = fixangr(ra + h0);
+        rs->events[rs->nEvents].lst = rs->rise[k];
+        rs->events[rs->nEvents].cell = k;
+        rs->events[rs->nEvents++].bRise = TRUE;
+        rs->events[rs->nEvents].lst = rs->set[k];
+        rs->events[rs->nEvents].cell = k;
+        rs->events[rs->nEvents++].bRise = FALSE;
+    }
+
+    qsort(rs->events, rs->nEvents, sizeof(struct riseEvent), eventCompare);
+    rs->bValid = FALSE;
+
+    return 0;
+}
+
+// riseSetReset Evaluate every cell directly at sidereal time lst
+
+static void riseSetReset(struct riseSet *rs, double lst)
+{
+    uint32_t k;
+    int bUp;
+
+    memset(rs->up, 0, rs->nWords * sizeof(uint64_t));
+    for (k = 0; k < rs->nCells; k++)
+    {
+        if (rs->kind[k] == 0)
+            bUp = fixangr(lst - rs->rise[k]) < fixangr(rs->set[k] - rs->rise[k]);
+        else
+            bUp = (rs->kind[k] > 0);
+        if (bUp)
+            rs->up[k / 64] |= (uint64_t)1 << (k % 64);
+    }
+
+    // First event after lst
+    for (rs->next = 0; (rs->next < rs->nEvents) && (rs->events[rs->next].lst <= lst); rs->next++)
+        ;
+    if (rs->next == rs->nEvents)
+        rs->next = 0;
+
+    rs->lst = lst;
+    rs->bValid = TRUE;
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// riseSetSweep Advance the timeline to sidereal time lst (radians).
+//              Runs backwards or of more than half a turn start over.
+
+void riseSetSweep(struct riseSet *rs, double lst)
+{
+    const struct riseEvent *ev;
+    double  d;
+    uint32_t k;
+
+    lst = fixangr(lst);
+    d = fixangr(lst - rs->lst);
+    if (!rs->bValid || (d > PI))
+    {
+        riseSetReset(rs, lst);
+        return;
+    }
+
+    // Apply the events passed since the last frame
+    for (k = 0; k < rs->nEvents; k++)
+    {
+        ev = &rs->events[rs->next];
+        if (fixangr(ev->lst - rs->lst) > d)
+            break;
+
+        if (ev->bRise)
+            rs->up[ev->cell / 64] |= (uint64_t)1 << (ev->cell % 64);
+        else
+            rs->up[ev->cell / 64] &= ~((uint64_t)1 << (ev->cell % 64));
+        if (++rs->next == rs->nEvents)
+            rs->next = 0;
+    }
+    rs->lst = lst;
+
+    return;
+}
+
+void freeRiseSet(struct riseSet *rs)
+{
+    free(rs->up);
+    free(rs->kind);
+    free(rs->rise);
+    free(rs->set);
+    free(rs->events);
+    memset(rs, 0, sizeof(*rs));
+
+    return;
+}
@@ -0,0 +1,256 @@
+/* SkyLabel.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SkyPi.h"
+#include "SkyProj.h"
+#include "SkyLabel.h"
+
+static uint64_t hardCells[LABELROWS][LABELWORDS];
+static uint64_t softCells[LABELROWS][LABELWORDS];
+static struct skyLabel labels[MAXLABELS];
+static int nLabels;
+
+//-------------------------------------------------------------------------------
+// Occupancy grid
+
+// cellSpan     Clip a pixel rectangle to grid cells, FALSE if off screen
+
+static int cellSpan(int *x0, int *y0, int *x1, int *y1)
+{
+    if ((*x1 < 0) || (*y1 < 0) || (*x0 >= SCRWIDTH) || (*y0 >= SCRHEIGHT) || (*x1 < *x0) || (*y1 < *y0))
+        return FALSE;
+
+    *x0 = max(*x0, 0) / LABELCELL;
+    *y0 = max(*y0, 0) / LABELCELL;
+    *x1 = min(*x1, SCRWIDTH - 1) / LABELCELL;
+    *y1 = min(*y1, SCRHEIGHT - 1) / LABELCELL;
+
+    return TRUE;
+}
+
+// spanMask     Bits of cell columns c0..c1 falling in word w
+
+static uint64_t spanMask(int w, int c0, int c1)
+{
+    int lo = max(c0 - w * 64, 0);
+    int hi = min(c1 - w * 64, 63);
+
+    if (lo > hi)
+        return 0;
+
+    return ((hi == 63) ? ~(uint64_t)0 : (((uint64_t)1 << (hi + 1)) - 1)) & ~(((uint64_t)1 << lo) - 1);
+}
+
+// cellsUsed    Any cell of a pixel rectangle set in grid?
+
+static int cellsUsed(uint64_t grid[LABELROWS][LABELWORDS], int x0, int y0, int x1, int y1)
+{
+    int r, w;
+
+    for (r = y0; r <= y1; r++)
+    {
+        for (w = x0 / 64; w <= x1 / 64; w++)
+        {
+            if (grid[r][w] & spanMask(w, x0, x1))
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void cellsMark(uint64_t grid[LABELROWS][LABELWORDS], int x0, int y0, int x1, int y1)
+{
+    int r, w;
+
+    for (r = y0; r <= y1; r++)
+    {
+        for (w = x0 / 64; w <= x1 / 64; w++)
+            grid[r][w] |= spanMask(w, x0, x1);
+    }
+
+    return;
+}
+
+void clearLabels(void)
+{
+    memset(hardCells, 0, sizeof(hardCells));
+    memset(softCells, 0, sizeof(softCells));
+    nLabels = 0;
+
+    return;
+}
+
+// labelBlock   Keep labels off a pixel rectangle (hard) or prefer to (soft)
+
+void labelBlock(int x0, int y0, int x1, int y1, int bHard)
+{
+    if (cellSpan(&x0, &y0, &x1, &y1))
+        cellsMark(bHard ? hardCells : softCells, x0, y0, x1, y1);
+
+    return;
+}
+
+// labelLine    Mark the cells under a line as soft obstacles
+
+void labelLine(int x0, int y0, int x1, int y1)
+{
+    int n, k, dx = x1 - x0, dy = y1 - y0;
+
+    // One step per cell along the longer axis
+    n = max(abs(dx), abs(dy)) / LABELCELL + 1;
+    for (k = 0; k <= n; k++)
+        labelBlock(x0 + dx * k / n, y0 + dy * k / n, x0 + dx * k / n, y0 + dy * k / n, FALSE);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// addLabel     Queue a label for an object of radius r at x, y
+
+int addLabel(int x, int y, int r, const char *text, uint16_t color, float pri)
+{
+    struct skyLabel *lb;
+
+    if ((nLabels == MAXLABELS) || (text == NULL) || (*text == '\0'))
+        return -1;
+
+    lb = &labels[nLabels];
+    lb->x = x;
+    lb->y = y;
+    lb->r = r;
+    lb->text = text;
+    lb->color = color;
+    lb->pri = pri;
+    lb->bPlaced = FALSE;
+
+    return nLabels++;
+}
+
+int textWidth(const struct fontMetrics *fm, const char *text)
+{
+    int w = 0;
+
+    for (; *text != '\0'; text++)
+        w += fm->width[*text & 0x7f];
+
+    return w;
+}
+
+// tryLabel     Text rectangle of candidate position k, FALSE if off screen
+
+static int tryLabel(const struct skyLabel *lb, int k, int *x0, int *y0)
+{
+    int g = lb->r + 2;                  // Gap between object and text
+
+    switch (k)
+    {
+    case 0:  *x0 = lb->x + g;             *y0 = lb->y + g - lb->h / 2;  break;   // right, low
+    case 1:  *x0 = lb->x + g;             *y0 = lb->y - g - lb->h / 2;  break;   // right, high
+    case 2:  *x0 = lb->x - g - lb->w;     *y0 = lb->y + g - lb->h / 2;  break;   // left, low
+    case 3:  *x0 = lb->x - g - lb->w;     *y0 = lb->y - g - lb->h / 2;  break;   // left, high
+    case 4:  *x0 = lb->x + g;             *y0 = lb->y - lb->h / 2;      break;   // right
+    case 5:  *x0 = lb->x - g - lb->w;     *y0 = lb->y - lb->h / 2;      break;   // left
+    case 6:  *x0 = lb->x - lb->w / 2;     *y0 = lb->y - g - lb->h;      break;   // above
+    default: *x0 = lb->x - lb->w / 2;     *y0 = lb->y + g;              break;   // below
+    }
+
+    return (*x0 >= 0) && (*y0 >= 0) && (*x0 + lb->w <= SCRWIDTH) && (*y0 + lb->h <= SCRHEIGHT);
+}
+
+//-------------------------------------------------------------------------------
+// placeLabels  Lay out the queued labels, returns number placed
+
+int placeLabels(const struct fontMetrics *fm)
+{
+    static int first[LABELBUCKETS], next[MAXLABELS];
+    struct skyLabel *lb;
+    int b, k, n, c, x0, y0, cx0, cy0, cx1, cy1, best, bx, by;
+    int nPlaced = 0;
+
+    // Bucket by priority, keeping queue order within a bucket
+    for (b = 0; b < LABELBUCKETS; b++)
+        first[b] = -1;
+    for (n = nLabels - 1; n >= 0; n--)
+    {
+        b = (int)((labels[n].pri - LABELPRIMIN) * LABELBUCKETS / (LABELPRIMAX - LABELPRIMIN));
+        b = max(0, min(LABELBUCKETS - 1, b));
+        next[n] = first[b];
+        first[b] = n;
+    }
+
+    for (b = 0; b < LABELBUCKETS; b++)
+    {
+        for (n = first[b]; n >= 0; n = next[n])
+        {
+            lb = &labels[n];
+            lb->w = textWidth(fm, lb->text);
+            lb->h = fm->height;
+
+            best = -1;
+            bx = by = 0;
+            for (k = 0; k < LABELCANDS; k++)
+            {
+                if (!tryLabel(lb, k, &x0, &y0))
+                    continue;
+
+                cx0 = x0;
+                cy0 = y0;
+                cx1 = x0 + lb->w - 1;
+                cy1 = y0 + lb->h - 1;
+                cellSpan(&cx0, &cy0, &cx1, &cy1);
+                if (cellsUsed(hardCells, cx0, cy0, cx1, cy1))
+                    continue;
+
+                c = cellsUsed(softCells, cx0, cy0, cx1, cy1);
+                if ((best < 0) || !c)
+                {
+                    best = k;
+                    bx = x0;
+                    by = y0;
+                }
+                if (!c)
+                    break;
+            }
+            if (best < 0)
+                continue;
+
+            lb->lx = bx;
+            lb->ly = by;
+            lb->bPlaced = TRUE;
+            labelBlock(bx, by, bx + lb->w - 1, by + lb->h - 1, TRUE);
+            nPlaced++;
+        }
+    }
+
+    return nPlaced;
+}
+
+// getLabel     Queued label k (NULL past the end)
+
+struct skyLabel *getLabel(int k)
+{
+    return ((k >= 0) && (k < nLabels)) ? &labels[k] : NULL;
+}
@@ -0,0 +1,128 @@
+/* SkyLayer.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SkyPi.h"
+#include "StarCat.h"
+#include "SkyProj.h"
+#include "SkyLayer.h"
+
+//-------------------------------------------------------------------------------
+// parseLayer   Set up a layer from a "file[,mag]" option argument
+
+int parseLayer(const char *arg, int style, double magLimit, struct skyLayer *ly)
+{
+    const char *p;
+    char    *cptr;
+    size_t  n;
+
+    memset(ly, 0, sizeof(*ly));
+    ly->style = style;
+    ly->magLimit = magLimit;
+
+    // Optional magnitude limit after the last comma
+    n = strlen(arg);
+    p = strrchr(arg, ',');
+    if (p != NULL)
+    {
+        ly->magLimit = strtod(p + 1, &cptr);
+        if ((cptr == p + 1) || (*cptr != '\0'))
+        {
+            printf("Invalid layer magnitude limit: %s\n", arg);
+            return -1;
+        }
+        n = p - arg;
+    }
+
+    if ((n == 0) || (n >= sizeof(ly->fname)))
+    {
+        printf("Invalid layer catalog name: %s\n", arg);
+        return -1;
+    }
+    memcpy(ly->fname, arg, n);
+    ly->fname[n] = '\0';
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+// openLayer    Open the layer catalog. Tiled catalogs are streamed through
+//              a tile cache, others are loaded into a resident store.
+
+int openLayer(struct skyLayer *ly)
+{
+    if (openStarCat(ly->fname, &ly->cat) < 0)
+        return -1;
+
+    ly->bTiled = (openStarTiles(&ly->cat, &ly->tiles) == 0);
+    if (!ly->bTiled && (loadStarStore(&ly->cat, ly->magLimit, &ly->ss) < 0))
+    {
+        closeStarCat(&ly->cat);
+        return -1;
+    }
+
+    return 0;
+}
+
+void closeLayer(struct skyLayer *ly)
+{
+    if (ly->bTiled)
+        closeStarTiles(&ly->tiles);
+    else
+        freeStarStore(&ly->ss);
+    freeRiseSet(&ly->rs);
+    closeStarCat(&ly->cat);
+
+    return;
+}
+
+// layerEpoch   Apply proper motion for years since J2000
+
+void layerEpoch(struct skyLayer *ly, double years)
+{
+    if (ly->bTiled)
+        tileEpoch(&ly->tiles, years);
+    else
+        properMotion(&ly->cat, &ly->ss, years);
+
+    return;
+}
+
+// layerHorizon Rise and set times of the layer cells at the site, after
+//              precession (app) or proper motion changed
+
+int layerHorizon(struct skyLayer *ly, double app[3][3], double siteLat)
+{
+    if (ly->bTiled)
+        return riseSetInit(&ly->rs, ly->tiles.cells, ly->tiles.th->nCells, app, siteLat);
+
+    return riseSetInit(&ly->rs, ly->ss.cells, ly->ss.nCells, app, siteLat);
+}
+
+// layerMaxRun  Most objects projected in one pass (projection buffer size)
+
+uint32_t layerMaxRun(const struct skyLayer *ly)
+{
+    return ly->bTiled ? ly->tiles.th->maxTile : ly->ss.nStars;
+}
@@ -0,0 +1,283 @@
+/* SkyPick.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "SkyPi.h"
+#include "SkyPick.h"
+
+static struct skyPick *picks;
+static int32_t nPicks, maxPicks;
+static int bBuilt;                      // Picks arranged as a 2-d tree
+
+#define pickKey(p, axis)    ((axis) ? (p)->y : (p)->x)
+
+//-------------------------------------------------------------------------------
+// clearPicks   Forget the objects of the last frame
+
+void clearPicks(void)
+{
+    nPicks = 0;
+    bBuilt = FALSE;
+
+    return;
+}
+
+// addPick      Record a drawn object (-1 if out of memory)
+
+int addPick(int x, int y, int kind, int layer, uint32_t id, float mag)
+{
+    struct skyPick *pk;
+    int32_t n;
+
+    if (nPicks == maxPicks)
+    {
+        n = (maxPicks > 0) ? maxPicks * 2 : 1024;
+        pk = realloc(picks, n * sizeof(struct skyPick));
+        if (pk == NULL)
+            return -1;
+        picks = pk;
+        maxPicks = n;
+    }
+
+    pk = &picks[nPicks++];
+    pk->x = x;
+    pk->y = y;
+    pk->kind = kind;
+    pk->layer = layer;
+    pk->id = id;
+    pk->mag = mag;
+    bBuilt = FALSE;
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+// 2-d tree
+//
+// The subtree of picks lo..hi-1 has its node at mid = (lo + hi) / 2, the
+// smaller keys along its axis in lo..mid-1 and the larger in mid+1..hi-1.
+
+// selectPick   Move the pick with the k'th smallest key along axis to k,
+//              smaller keys before it and larger after (quickselect)
+
+static void selectPick(int32_t lo, int32_t hi, int32_t k, int axis)
+{
+    struct skyPick t;
+    int32_t i, j;
+    int pivot;
+
+    hi--;
+    while (lo < hi)
+    {
+        pivot = pickKey(&picks[(lo + hi) / 2], axis);
+        i = lo;
+        j = hi;
+        while (i <= j)
+        {
+            while (pickKey(&picks[i], axis) < pivot)
+                i++;
+            while (pickKey(&picks[j], axis) > pivot)
+                j--;
+            if (i <= j)
+            {
+                t = picks[i];
+                picks[i++] = picks[j];
+                picks[j--] = t;
+            }
+        }
+
+        // lo..j <= pivot, i..hi >= pivot, anything between equals it
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+
+    return;
+}
+
+static void buildTree(int32_t lo, int32_t hi, int axis)
+{
+    int32_t mid;
+
+    while (hi - lo > 1)
+    {
+        mid = (lo + hi) / 2;
+        selectPick(lo, hi, mid, axis);
+        buildTree(lo, mid, axis ^ 1);
+        lo = mid + 1;
+        axis ^= 1;
+    }
+
+    return;
+}
+
+// searchNearest    Shrink *best to the squared distance of the closest pick
+
+static void searchNearest(int32_t lo, int32_t hi, int axis, int x, int y, int *best)
+{
+    const struct skyPick *pk;
+    int32_t mid;
+    int d, diff;
+
+    while (hi > lo)
+    {
+        mid = (lo + hi) / 2;
+        pk = &picks[mid];
+        d = (x - pk->x) * (x - pk->x) + (y - pk->y) * (y - pk->y);
+        if (d < *best)
+            *best = d;
+
+        // Near side first, far side only if the split is within reach
+        diff = pickKey(pk, axis) - (axis ? y : x);
+        if (diff > 0)
+        {
+            searchNearest(lo, mid, axis ^ 1, x, y, best);
+            lo = mid + 1;
+        } else {
+            searchNearest(mid + 1, hi, axis ^ 1, x, y, best);
+            hi = mid;
+        }
+        if (diff * diff > *best)
+            break;
+        axis ^= 1;
+    }
+
+    return;
+}
+
+// searchBright     Brightest pick within sqrt(r2) pixels
+
+static void searchBright(int32_t lo, int32_t hi, int axis, int x, int y, int r2,
+                         const struct skyPick **best)
+{
+    const struct skyPick *pk;
+    int32_t mid;
+    int d, diff;
+
+    while (hi > lo)
+    {
+        mid = (lo + hi) / 2;
+        pk = &picks[mid];
+        d = (x - pk->x) * (x - pk->x) + (y - pk->y) * (y - pk->y);
+        if ((d <= r2) && ((*best == NULL) || (pk->mag < (*best)->mag)))
+            *best = pk;
+
+        diff = pickKey(pk, axis) - (axis ? y : x);
+        if ((diff >= 0) || (diff * diff <= r2))
+            searchBright(lo, mid, axis ^ 1, x, y, r2, best);
+        if ((diff > 0) && (diff * diff > r2))
+            break;
+        lo = mid + 1;
+        axis ^= 1;
+    }
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// nearestPick  Object of this frame a tap at x, y refers to, NULL if none
+//              is within radius pixels
+
+const struct skyPick *nearestPick(int x, int y, int radius)
+{
+    const struct skyPick *pk = NULL;
+    int best = INT_MAX;
+    int r;
+
+    if (nPicks == 0)
+        return NULL;
+
+    if (!bBuilt)
+    {
+        buildTree(0, nPicks, 0);
+        bBuilt = TRUE;
+    }
+
+    searchNearest(0, nPicks, 0, x, y, &best);
+    if (best > radius * radius)
+        return NULL;
+
+    // Brightest of the objects about as close as the nearest
+    r = (int)ceil(sqrt(best)) + PICKSLACK;
+    searchBright(0, nPicks, 0, x, y, r * r, &pk);
+
+    return pk;
+}
+
+//-------------------------------------------------------------------------------
+#ifdef PICK_TEST_PROGRAM
+
+#include <time.h>
+
+// Check tree answers against a linear scan
+
+int main(int argc, char **argv)
+{
+    const struct skyPick *pk;
+    struct timespec t0, t1;
+    int k, n, x, y, d, best, r, bad = 0;
+    float mag;
+    double ns = 0;
+
+    n = (argc > 1) ? atoi(argv[1]) : 20000;
+    srand(1);
+    clearPicks();
+    for (k = 0; k < n; k++)
+        addPick(rand() % 480, rand() % 272, 0, 0, k, (rand() % 1000) / 100.0);
+
+    for (k = 0; k < 10000; k++)
+    {
+        x = rand() % 480;
+        y = rand() % 272;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        pk = nearestPick(x, y, PICKRADIUS);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (k > 0)
+            ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+        for (d = 0, best = INT_MAX; d < nPicks; d++)
+            best = min(best, (x - picks[d].x) * (x - picks[d].x) + (y - picks[d].y) * (y - picks[d].y));
+        if (best > PICKRADIUS * PICKRADIUS)
+        {
+            bad += (pk != NULL);
+            continue;
+        }
+        r = (int)ceil(sqrt(best)) + PICKSLACK;
+        for (d = 0, mag = 1e9; d < nPicks; d++)
+        {
+            if ((x - picks[d].x) * (x - picks[d].x) + (y - picks[d].y) * (y - picks[d].y) <= r * r)
+                mag = min(mag, picks[d].mag);
+        }
+        bad += (pk == NULL) || (pk->mag != mag);
+    }
+
+    printf("%d objects, %d mismatches, %.2f us per tap\n", n, bad, ns / 9999 / 1000);
+
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
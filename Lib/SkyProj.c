@@ -0,0 +1,818 @@
+/* SkyProj.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SkyPi.h"
+#include "SkyProj.h"
+#include "StarCat.h"
+#include "VecMath.h"
+
+/*  CentralAngle / sin(CentralAngle) as a function of x = cos(CentralAngle)
+    over [PROJXMIN, 1] is smooth (the singularity is at x = -1), so a
+    Chebyshev fit of modest degree is good to well under 0.01 pixel at
+    the screen corners.  Stars below the horizon (h[2] < 0) always land
+    below the bottom row and are culled before the polynomial.  The fit is
+    made at startup and converted to a power series in
+    t = PROJA * x + PROJB for Horner evaluation.  */
+
+#define PROJDEG     10                  // Polynomial terms (< 0.005 pixel)
+#define PROJA       (2.0 / (1.0 - PROJXMIN))
+#define PROJB       (-(1.0 + PROJXMIN) / (1.0 - PROJXMIN))
+
+static vreal projPoly[PROJDEG];
+
+// Kernel: process stars from *k while a full vector remains
+typedef uint32_t (*projKernel)(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                               uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                               uint32_t nOut);
+static projKernel projBulk;
+
+// NEON has double lanes on AArch64 only
+#if defined(SIMD_NEON) && (defined(SKYPI_FLOAT32) || defined(__aarch64__))
+#define PROJ_NEON
+#endif
+
+//-------------------------------------------------------------------------------
+// projFit  Fit the projection factor polynomial
+
+static double projFactor(double x)
+{
+    return (x >= 1.0) ? 1.0 : acos(x) / sqrt(1.0 - x * x);
+}
+
+static void projFit(void)
+{
+    double cheb[PROJDEG], tPrev[PROJDEG], tCur[PROJDEG], tNext[PROJDEG], poly[PROJDEG];
+    double t, sum;
+    int j, k;
+
+    // Chebyshev coefficients from values at the Chebyshev nodes
+    for (j = 0; j < PROJDEG; j++)
+    {
+        sum = 0;
+        for (k = 0; k < PROJDEG; k++)
+        {
+            t = cos(PI * (k + 0.5) / PROJDEG);
+            sum += projFactor((t - PROJB) / PROJA) * cos(PI * j * (k + 0.5) / PROJDEG);
+        }
+        cheb[j] = sum * 2.0 / PROJDEG;
+    }
+    cheb[0] /= 2.0;
+
+    // Sum T_j(t) as power series: T_j+1 = 2t T_j - T_j-1
+    memset(poly, 0, sizeof(poly));
+    memset(tPrev, 0, sizeof(tPrev));
+    memset(tCur, 0, sizeof(tCur));
+    tPrev[0] = 1.0;                     // T0
+    tCur[1] = 1.0;                      // T1
+    poly[0] = cheb[0];
+    for (j = 1; j < PROJDEG; j++)
+    {
+        for (k = 0; k < PROJDEG; k++)
+            poly[k] += cheb[j] * tCur[k];
+
+        for (k = 0; k < PROJDEG; k++)
+            tNext[k] = ((k > 0) ? 2.0 * tCur[k - 1] : 0.0) - tPrev[k];
+        memcpy(tPrev, tCur, sizeof(tCur));
+        memcpy(tCur, tNext, sizeof(tNext));
+    }
+
+    for (k = 0; k < PROJDEG; k++)
+        projPoly[k] = poly[k];
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// projPoint    Scalar projection of one star (FALSE if culled by horizon
+//              or view cone). Returns unrounded screen offsets.
+
+static inline int projPoint(const vreal mm[3][3], vreal x, vreal y, vreal z, vreal *fx, vreal *fy)
+{
+    vreal h0, h1, h2, t, f;
+    int j;
+
+    h0 = mm[0][0] * x + mm[0][1] * y + mm[0][2] * z;
+    h2 = mm[2][0] * x + mm[2][1] * y + mm[2][2] * z;
+    if ((h0 < (vreal)PROJXMIN) || (h2 < 0))
+        return FALSE;
+    h1 = mm[1][0] * x + mm[1][1] * y + mm[1][2] * z;
+
+    t = h0 * (vreal)PROJA + (vreal)PROJB;
+    f = projPoly[PROJDEG - 1];
+    for (j = PROJDEG - 2; j >= 0; j--)
+        f = f * t + projPoly[j];
+    f *= (vreal)PROJSCALE;
+
+    *fx = f * h1;
+    *fy = f * h2;
+
+    return TRUE;
+}
+
+//-------------------------------------------------------------------------------
+// Scalar kernel
+
+static uint32_t projScalar(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                           uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                           uint32_t nOut)
+{
+    vreal   mm[3][3], fx, fy;
+    int     iX, iY, r, c;
+    uint32_t i;
+
+    for (r = 0; r < 3; r++)
+        for (c = 0; c < 3; c++)
+            mm[r][c] = m[r][c];
+
+    for (i = *k; i < n; i++)
+    {
+        if (!projPoint(mm, x[i], y[i], z[i], &fx, &fy))
+            continue;
+
+        iX = SCRCX + (int)vfloor(fx);
+        iY = SCRCY - (int)vfloor(fy);
+        if ((iX < 0) || (iX >= SCRWIDTH) || (iY < 0) || (iY >= SCRHEIGHT))
+            continue;
+
+        px[nOut] = iX;
+        py[nOut] = iY;
+        idx[nOut++] = i;
+    }
+    *k = i;
+
+    return nOut;
+}
+
+#ifdef SKYPI_FLOAT32
+//-------------------------------------------------------------------------------
+// SSE2 kernel (4 stars per vector)
+
+#if defined(SIMD_X86) && defined(__SSE2__)
+static inline __m128 sse2Floor(__m128 v)
+{
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmplt_ps(v, t), _mm_set1_ps(1.0f)));
+}
+
+static uint32_t projSSE2(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                         uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                         uint32_t nOut)
+{
+    __m128  vx, vy, vz, h0, h1, h2, t, f, fx, fy, ok;
+    int     iX[4], iY[4];
+    int     bits, j;
+    uint32_t i;
+
+    for (i = *k; i + 4 <= n; i += 4)
+    {
+        vx = _mm_loadu_ps(x + i);
+        vy = _mm_loadu_ps(y + i);
+        vz = _mm_loadu_ps(z + i);
+
+        h0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][0]), vx),
+                                   _mm_mul_ps(_mm_set1_ps(m[0][1]), vy)),
+                        _mm_mul_ps(_mm_set1_ps(m[0][2]), vz));
+        h2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][0]), vx),
+                                   _mm_mul_ps(_mm_set1_ps(m[2][1]), vy)),
+                        _mm_mul_ps(_mm_set1_ps(m[2][2]), vz));
+        ok = _mm_and_ps(_mm_cmpge_ps(h0, _mm_set1_ps(PROJXMIN)),
+                        _mm_cmpge_ps(h2, _mm_setzero_ps()));
+        if (_mm_movemask_ps(ok) == 0)
+            continue;
+
+        h1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[1][0]), vx),
+                                   _mm_mul_ps(_mm_set1_ps(m[1][1]), vy)),
+                        _mm_mul_ps(_mm_set1_ps(m[1][2]), vz));
+
+        t = _mm_add_ps(_mm_mul_ps(h0, _mm_set1_ps(PROJA)), _mm_set1_ps(PROJB));
+        f = _mm_set1_ps(projPoly[PROJDEG - 1]);
+        for (j = PROJDEG - 2; j >= 0; j--)
+            f = _mm_add_ps(_mm_mul_ps(f, t), _mm_set1_ps(projPoly[j]));
+        f = _mm_mul_ps(f, _mm_set1_ps(PROJSCALE));
+
+        fx = _mm_add_ps(_mm_set1_ps(SCRCX), sse2Floor(_mm_mul_ps(f, h1)));
+        fy = _mm_sub_ps(_mm_set1_ps(SCRCY), sse2Floor(_mm_mul_ps(f, h2)));
+
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(fx, _mm_setzero_ps()));
+        ok = _mm_and_ps(ok, _mm_cmplt_ps(fx, _mm_set1_ps(SCRWIDTH)));
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(fy, _mm_setzero_ps()));
+        ok = _mm_and_ps(ok, _mm_cmplt_ps(fy, _mm_set1_ps(SCRHEIGHT)));
+        bits = _mm_movemask_ps(ok);
+        if (bits == 0)
+            continue;
+
+        _mm_storeu_si128((__m128i *)iX, _mm_cvttps_epi32(fx));
+        _mm_storeu_si128((__m128i *)iY, _mm_cvttps_epi32(fy));
+        for (j = 0; j < 4; j++)
+        {
+            if (bits & (1 << j))
+            {
+                px[nOut] = iX[j];
+                py[nOut] = iY[j];
+                idx[nOut++] = i + j;
+            }
+        }
+    }
+    *k = i;
+
+    return nOut;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// AVX2 kernel (8 stars per vector)
+
+#ifdef SIMD_X86
+TARGET_AVX2
+static uint32_t projAVX2(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                         uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                         uint32_t nOut)
+{
+    __m256  vx, vy, vz, h0, h1, h2, t, f, fx, fy, ok;
+    int     iX[8], iY[8];
+    int     bits, j;
+    uint32_t i;
+
+    for (i = *k; i + 8 <= n; i += 8)
+    {
+        vx = _mm256_loadu_ps(x + i);
+        vy = _mm256_loadu_ps(y + i);
+        vz = _mm256_loadu_ps(z + i);
+
+        h0 = _mm256_fmadd_ps(_mm256_set1_ps(m[0][2]), vz,
+             _mm256_fmadd_ps(_mm256_set1_ps(m[0][1]), vy,
+             _mm256_mul_ps(_mm256_set1_ps(m[0][0]), vx)));
+        h2 = _mm256_fmadd_ps(_mm256_set1_ps(m[2][2]), vz,
+             _mm256_fmadd_ps(_mm256_set1_ps(m[2][1]), vy,
+             _mm256_mul_ps(_mm256_set1_ps(m[2][0]), vx)));
+        ok = _mm256_and_ps(_mm256_cmp_ps(h0, _mm256_set1_ps(PROJXMIN), _CMP_GE_OQ),
+                           _mm256_cmp_ps(h2, _mm256_setzero_ps(), _CMP_GE_OQ));
+        if (_mm256_movemask_ps(ok) == 0)
+            continue;
+
+        h1 = _mm256_fmadd_ps(_mm256_set1_ps(m[1][2]), vz,
+             _mm256_fmadd_ps(_mm256_set1_ps(m[1][1]), vy,
+             _mm256_mul_ps(_mm256_set1_ps(m[1][0]), vx)));
+
+        t = _mm256_fmadd_ps(h0, _mm256_set1_ps(PROJA), _mm256_set1_ps(PROJB));
+        f = _mm256_set1_ps(projPoly[PROJDEG - 1]);
+        for (j = PROJDEG - 2; j >= 0; j--)
+            f = _mm256_fmadd_ps(f, t, _mm256_set1_ps(projPoly[j]));
+        f = _mm256_mul_ps(f, _mm256_set1_ps(PROJSCALE));
+
+        fx = _mm256_add_ps(_mm256_set1_ps(SCRCX), _mm256_floor_ps(_mm256_mul_ps(f, h1)));
+        fy = _mm256_sub_ps(_mm256_set1_ps(SCRCY), _mm256_floor_ps(_mm256_mul_ps(f, h2)));
+
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(fx, _mm256_setzero_ps(), _CMP_GE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(fx, _mm256_set1_ps(SCRWIDTH), _CMP_LT_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(fy, _mm256_setzero_ps(), _CMP_GE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(fy, _mm256_set1_ps(SCRHEIGHT), _CMP_LT_OQ));
+        bits = _mm256_movemask_ps(ok);
+        if (bits == 0)
+            continue;
+
+        _mm256_storeu_si256((__m256i *)iX, _mm256_cvttps_epi32(fx));
+        _mm256_storeu_si256((__m256i *)iY, _mm256_cvttps_epi32(fy));
+        for (j = 0; j < 8; j++)
+        {
+            if (bits & (1 << j))
+            {
+                px[nOut] = iX[j];
+                py[nOut] = iY[j];
+                idx[nOut++] = i + j;
+            }
+        }
+    }
+    *k = i;
+
+    return nOut;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// NEON kernel (4 stars per vector, ARMv7 and AArch64)
+
+#ifdef PROJ_NEON
+static inline float32x4_t neonFloor(float32x4_t v)
+{
+    float32x4_t t = vcvtq_f32_s32(vcvtq_s32_f32(v));
+    uint32x4_t  one = vandq_u32(vcltq_f32(v, t), vreinterpretq_u32_f32(vdupq_n_f32(1.0f)));
+
+    return vsubq_f32(t, vreinterpretq_f32_u32(one));
+}
+
+static uint32_t projNEON(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                         uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                         uint32_t nOut)
+{
+    float32x4_t vx, vy, vz, h0, h1, h2, t, f, fx, fy;
+    uint32x4_t  ok;
+    uint32x2_t  any;
+    int32_t     iX[4], iY[4];
+    uint32_t    bits[4];
+    int     j;
+    uint32_t i;
+
+    for (i = *k; i + 4 <= n; i += 4)
+    {
+        vx = vld1q_f32(x + i);
+        vy = vld1q_f32(y + i);
+        vz = vld1q_f32(z + i);
+
+        h0 = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(vx, m[0][0]), vy, m[0][1]), vz, m[0][2]);
+        h2 = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(vx, m[2][0]), vy, m[2][1]), vz, m[2][2]);
+        ok = vandq_u32(vcgeq_f32(h0, vdupq_n_f32(PROJXMIN)), vcgeq_f32(h2, vdupq_n_f32(0)));
+        any = vorr_u32(vget_low_u32(ok), vget_high_u32(ok));
+        if ((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0)
+            continue;
+        h1 = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(vx, m[1][0]), vy, m[1][1]), vz, m[1][2]);
+
+        t = vmlaq_n_f32(vdupq_n_f32(PROJB), h0, PROJA);
+        f = vdupq_n_f32(projPoly[PROJDEG - 1]);
+        for (j = PROJDEG - 2; j >= 0; j--)
+            f = vmlaq_f32(vdupq_n_f32(projPoly[j]), f, t);
+        f = vmulq_n_f32(f, PROJSCALE);
+
+        fx = vaddq_f32(vdupq_n_f32(SCRCX), neonFloor(vmulq_f32(f, h1)));
+        fy = vsubq_f32(vdupq_n_f32(SCRCY), neonFloor(vmulq_f32(f, h2)));
+
+        ok = vandq_u32(ok, vcgeq_f32(fx, vdupq_n_f32(0)));
+        ok = vandq_u32(ok, vcltq_f32(fx, vdupq_n_f32(SCRWIDTH)));
+        ok = vandq_u32(ok, vcgeq_f32(fy, vdupq_n_f32(0)));
+        ok = vandq_u32(ok, vcltq_f32(fy, vdupq_n_f32(SCRHEIGHT)));
+
+        vst1q_u32(bits, ok);
+        vst1q_s32(iX, vcvtq_s32_f32(fx));
+        vst1q_s32(iY, vcvtq_s32_f32(fy));
+        for (j = 0; j < 4; j++)
+        {
+            if (bits[j])
+            {
+                px[nOut] = iX[j];
+                py[nOut] = iY[j];
+                idx[nOut++] = i + j;
+            }
+        }
+    }
+    *k = i;
+
+    return nOut;
+}
+#endif
+
+#else // SKYPI_FLOAT32
+
+//-------------------------------------------------------------------------------
+// SSE2 kernel (2 stars per vector)
+
+#if defined(SIMD_X86) && defined(__SSE2__)
+static inline __m128d sse2Floor(__m128d v)
+{
+    __m128d t = _mm_cvtepi32_pd(_mm_cvttpd_epi32(v));
+
+    return _mm_sub_pd(t, _mm_and_pd(_mm_cmplt_pd(v, t), _mm_set1_pd(1.0)));
+}
+
+static uint32_t projSSE2(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                         uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                         uint32_t nOut)
+{
+    __m128d vx, vy, vz, h0, h1, h2, t, f, fx, fy, ok;
+    int     iX[4], iY[4];
+    int     bits, j;
+    uint32_t i;
+
+    for (i = *k; i + 2 <= n; i += 2)
+    {
+        vx = _mm_loadu_pd(x + i);
+        vy = _mm_loadu_pd(y + i);
+        vz = _mm_loadu_pd(z + i);
+
+        h0 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(m[0][0]), vx),
+                                   _mm_mul_pd(_mm_set1_pd(m[0][1]), vy)),
+                        _mm_mul_pd(_mm_set1_pd(m[0][2]), vz));
+        h2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(m[2][0]), vx),
+                                   _mm_mul_pd(_mm_set1_pd(m[2][1]), vy)),
+                        _mm_mul_pd(_mm_set1_pd(m[2][2]), vz));
+        ok = _mm_and_pd(_mm_cmpge_pd(h0, _mm_set1_pd(PROJXMIN)),
+                        _mm_cmpge_pd(h2, _mm_setzero_pd()));
+        if (_mm_movemask_pd(ok) == 0)
+            continue;
+
+        h1 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(m[1][0]), vx),
+                                   _mm_mul_pd(_mm_set1_pd(m[1][1]), vy)),
+                        _mm_mul_pd(_mm_set1_pd(m[1][2]), vz));
+
+        t = _mm_add_pd(_mm_mul_pd(h0, _mm_set1_pd(PROJA)), _mm_set1_pd(PROJB));
+        f = _mm_set1_pd(projPoly[PROJDEG - 1]);
+        for (j = PROJDEG - 2; j >= 0; j--)
+            f = _mm_add_pd(_mm_mul_pd(f, t), _mm_set1_pd(projPoly[j]));
+        f = _mm_mul_pd(f, _mm_set1_pd(PROJSCALE));
+
+        fx = _mm_add_pd(_mm_set1_pd(SCRCX), sse2Floor(_mm_mul_pd(f, h1)));
+        fy = _mm_sub_pd(_mm_set1_pd(SCRCY), sse2Floor(_mm_mul_pd(f, h2)));
+
+        ok = _mm_and_pd(ok, _mm_cmpge_pd(fx, _mm_setzero_pd()));
+        ok = _mm_and_pd(ok, _mm_cmplt_pd(fx, _mm_set1_pd(SCRWIDTH)));
+        ok = _mm_and_pd(ok, _mm_cmpge_pd(fy, _mm_setzero_pd()));
+        ok = _mm_and_pd(ok, _mm_cmplt_pd(fy, _mm_set1_pd(SCRHEIGHT)));
+        bits = _mm_movemask_pd(ok);
+        if (bits == 0)
+            continue;
+
+        _mm_storeu_si128((__m128i *)iX, _mm_cvttpd_epi32(fx));
+        _mm_storeu_si128((__m128i *)iY, _mm_cvttpd_epi32(fy));
+        for (j = 0; j < 2; j++)
+        {
+            if (bits & (1 << j))
+            {
+                px[nOut] = iX[j];
+                py[nOut] = iY[j];
+                idx[nOut++] = i + j;
+            }
+        }
+    }
+    *k = i;
+
+    return nOut;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// AVX2 kernel (4 stars per vector)
+
+#ifdef SIMD_X86
+TARGET_AVX2
+static uint32_t projAVX2(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                         uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                         uint32_t nOut)
+{
+    __m256d vx, vy, vz, h0, h1, h2, t, f, fx, fy, ok;
+    int     iX[4], iY[4];
+    int     bits, j;
+    uint32_t i;
+
+    for (i = *k; i + 4 <= n; i += 4)
+    {
+        vx = _mm256_loadu_pd(x + i);
+        vy = _mm256_loadu_pd(y + i);
+        vz = _mm256_loadu_pd(z + i);
+
+        h0 = _mm256_fmadd_pd(_mm256_set1_pd(m[0][2]), vz,
+             _mm256_fmadd_pd(_mm256_set1_pd(m[0][1]), vy,
+             _mm256_mul_pd(_mm256_set1_pd(m[0][0]), vx)));
+        h2 = _mm256_fmadd_pd(_mm256_set1_pd(m[2][2]), vz,
+             _mm256_fmadd_pd(_mm256_set1_pd(m[2][1]), vy,
+             _mm256_mul_pd(_mm256_set1_pd(m[2][0]), vx)));
+        ok = _mm256_and_pd(_mm256_cmp_pd(h0, _mm256_set1_pd(PROJXMIN), _CMP_GE_OQ),
+                           _mm256_cmp_pd(h2, _mm256_setzero_pd(), _CMP_GE_OQ));
+        if (_mm256_movemask_pd(ok) == 0)
+            continue;
+
+        h1 = _mm256_fmadd_pd(_mm256_set1_pd(m[1][2]), vz,
+             _mm256_fmadd_pd(_mm256_set1_pd(m[1][1]), vy,
+             _mm256_mul_pd(_mm256_set1_pd(m[1][0]), vx)));
+
+        t = _mm256_fmadd_pd(h0, _mm256_set1_pd(PROJA), _mm256_set1_pd(PROJB));
+        f = _mm256_set1_pd(projPoly[PROJDEG - 1]);
+        for (j = PROJDEG - 2; j >= 0; j--)
+            f = _mm256_fmadd_pd(f, t, _mm256_set1_pd(projPoly[j]));
+        f = _mm256_mul_pd(f, _mm256_set1_pd(PROJSCALE));
+
+        fx = _mm256_add_pd(_mm256_set1_pd(SCRCX), _mm256_floor_pd(_mm256_mul_pd(f, h1)));
+        fy = _mm256_sub_pd(_mm256_set1_pd(SCRCY), _mm256_floor_pd(_mm256_mul_pd(f, h2)));
+
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(fx, _mm256_setzero_pd(), _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(fx, _mm256_set1_pd(SCRWIDTH), _CMP_LT_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(fy, _mm256_setzero_pd(), _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(fy, _mm256_set1_pd(SCRHEIGHT), _CMP_LT_OQ));
+        bits = _mm256_movemask_pd(ok);
+        if (bits == 0)
+            continue;
+
+        _mm_storeu_si128((__m128i *)iX, _mm256_cvttpd_epi32(fx));
+        _mm_storeu_si128((__m128i *)iY, _mm256_cvttpd_epi32(fy));
+        for (j = 0; j < 4; j++)
+        {
+            if (bits & (1 << j))
+            {
+                px[nOut] = iX[j];
+                py[nOut] = iY[j];
+                idx[nOut++] = i + j;
+            }
+        }
+    }
+    *k = i;
+
+    return nOut;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// NEON kernel (2 stars per vector, AArch64 only)
+
+#ifdef PROJ_NEON
+static uint32_t projNEON(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                         uint32_t *k, uint32_t n, short *px, short *py, uint32_t *idx,
+                         uint32_t nOut)
+{
+    float64x2_t vx, vy, vz, h0, h1, h2, t, f, fx, fy;
+    uint64x2_t  ok;
+    int     j;
+    uint32_t i;
+
+    for (i = *k; i + 2 <= n; i += 2)
+    {
+        vx = vld1q_f64(x + i);
+        vy = vld1q_f64(y + i);
+        vz = vld1q_f64(z + i);
+
+        h0 = vfmaq_n_f64(vfmaq_n_f64(vmulq_n_f64(vx, m[0][0]), vy, m[0][1]), vz, m[0][2]);
+        h2 = vfmaq_n_f64(vfmaq_n_f64(vmulq_n_f64(vx, m[2][0]), vy, m[2][1]), vz, m[2][2]);
+        ok = vandq_u64(vcgeq_f64(h0, vdupq_n_f64(PROJXMIN)), vcgeq_f64(h2, vdupq_n_f64(0)));
+        if ((vgetq_lane_u64(ok, 0) | vgetq_lane_u64(ok, 1)) == 0)
+            continue;
+        h1 = vfmaq_n_f64(vfmaq_n_f64(vmulq_n_f64(vx, m[1][0]), vy, m[1][1]), vz, m[1][2]);
+
+        t = vfmaq_n_f64(vdupq_n_f64(PROJB), h0, PROJA);
+        f = vdupq_n_f64(projPoly[PROJDEG - 1]);
+        for (j = PROJDEG - 2; j >= 0; j--)
+            f = vfmaq_f64(vdupq_n_f64(projPoly[j]), f, t);
+        f = vmulq_n_f64(f, PROJSCALE);
+
+        fx = vaddq_f64(vdupq_n_f64(SCRCX), vrndmq_f64(vmulq_f64(f, h1)));
+        fy = vsubq_f64(vdupq_n_f64(SCRCY), vrndmq_f64(vmulq_f64(f, h2)));
+
+        ok = vandq_u64(ok, vcgeq_f64(fx, vdupq_n_f64(0)));
+        ok = vandq_u64(ok, vcltq_f64(fx, vdupq_n_f64(SCRWIDTH)));
+        ok = vandq_u64(ok, vcgeq_f64(fy, vdupq_n_f64(0)));
+        ok = vandq_u64(ok, vcltq_f64(fy, vdupq_n_f64(SCRHEIGHT)));
+
+        if (vgetq_lane_u64(ok, 0))
+        {
+            px[nOut] = (short)vgetq_lane_f64(fx, 0);
+            py[nOut] = (short)vgetq_lane_f64(fy, 0);
+            idx[nOut++] = i;
+        }
+        if (vgetq_lane_u64(ok, 1))
+        {
+            px[nOut] = (short)vgetq_lane_f64(fx, 1);
+            py[nOut] = (short)vgetq_lane_f64(fy, 1);
+            idx[nOut++] = i + 1;
+        }
+    }
+    *k = i;
+
+    return nOut;
+}
+#endif
+
+#endif // SKYPI_FLOAT32
+
+//-------------------------------------------------------------------------------
+// projInit     Fit projection polynomial and pick the best kernel
+
+void projInit(void)
+{
+    projFit();
+
+    projBulk = projScalar;
+    switch (simdlevel())
+    {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+        projBulk = projAVX2;
+        break;
+#endif
+#if defined(SIMD_X86) && defined(__SSE2__)
+    case SIMD_SSE2:
+        projBulk = projSSE2;
+        break;
+#endif
+#ifdef PROJ_NEON
+    case SIMD_NEON:
+        projBulk = projNEON;
+        break;
+#endif
+    default:
+        break;
+    }
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// projectRange     Rotate (matrix m), project and cull stars first..last-1.
+//                  Screen coordinates of the visible stars are appended to
+//                  px, py and their indices to idx, starting at nOut.
+//                  Returns new visible count.
+
+uint32_t projectRange(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                      uint32_t first, uint32_t last, short *px, short *py, uint32_t *idx,
+                      uint32_t nOut)
+{
+    uint32_t k = first;
+
+    if (projBulk == NULL)
+        projInit();
+
+    nOut = projBulk(m, x, y, z, &k, last, px, py, idx, nOut);
+    // Odd stars left at the end
+    nOut = projScalar(m, x, y, z, &k, last, px, py, idx, nOut);
+
+    return nOut;
+}
+
+// projectStars     Project a whole array (see projectRange)
+
+uint32_t projectStars(double m[3][3], const vreal *x, const vreal *y, const vreal *z,
+                      uint32_t n, short *px, short *py, uint32_t *idx)
+{
+    return projectRange(m, x, y, z, 0, n, px, py, idx, 0);
+}
+
+//-------------------------------------------------------------------------------
+// cellVisible      Can any star of a sky cell reach the screen?
+//                  The cell cone must reach above the horizon and inside
+//                  the cone h[0] >= PROJXMIN around the south point.
+
+int cellVisible(double m[3][3], const struct starCell *sc)
+{
+    // sin/cos of view cone half angle acos(PROJXMIN)
+    const double cosView = PROJXMIN;
+    const double sinView = sqrt(1.0 - PROJXMIN * PROJXMIN);
+    double h0, h2;
+
+    if (sc->count == 0)
+        return FALSE;
+
+    // Axis altitude below -radius: sin(alt) < sin(-radius)
+    h2 = m[2][0] * sc->cx + m[2][1] * sc->cy + m[2][2] * sc->cz;
+    if (h2 < -sc->sinr)
+        return FALSE;
+
+    // Axis farther than view + radius from south point (cones that
+    // wrap past the north point always pass)
+    h0 = m[0][0] * sc->cx + m[0][1] * sc->cy + m[0][2] * sc->cz;
+    if ((sc->sinr * cosView + sc->cosr * sinView > 0) &&
+        (h0 < cosView * sc->cosr - sinView * sc->sinr))
+        return FALSE;
+
+    return TRUE;
+}
+
+#ifdef PROJ_TEST_PROGRAM
+
+	/* Check the projection kernels against the exact double precision
+	   projection for random stars and frames:
+
+	     cc -O2 -DPROJ_TEST_PROGRAM -IInclude Lib/SkyProj.c Lib/VecMath.c \
+	        Lib/Astro.c -lm
+
+	   Unrounded offsets must be within PROJERRBOUND pixels and every
+	   kernel must place each star on the exact pixel unless the exact
+	   position lies within PROJERRBOUND of a pixel edge.  */
+
+#define NTEST   100000
+
+static double projExact(const double h[3], double *X, double *Y)
+{
+    double S = sqrt(h[1] * h[1] + h[2] * h[2]), c;
+
+    c = atan2(S, h[0]);
+    *X = (S != 0) ? c * PROJSCALE * h[1] / S : 0;
+    *Y = (S != 0) ? c * PROJSCALE * h[2] / S : 0;
+
+    return c;
+}
+
+// Screen position inside display shrunk by d pixels
+static int onScreen(double X, double Y, double d)
+{
+    return (X >= d) && (X < SCRWIDTH - d) && (Y >= d) && (Y < SCRHEIGHT - d);
+}
+
+// Pixel p agrees with exact offset e (sign +1 for X, -1 for Y)
+static int pixelOK(int p, int base, int sign, double e)
+{
+    return (p == base + sign * (int)floor(e - sign * PROJERRBOUND)) ||
+           (p == base + sign * (int)floor(e + sign * PROJERRBOUND));
+}
+
+int main(void)
+{
+    static vreal x[NTEST], y[NTEST], z[NTEST];
+    static short px[NTEST], py[NTEST];
+    static uint32_t idx[NTEST];
+    vreal   mm[3][3], fx, fy;
+    double  m[3][3], h[3], X, Y, ra, dec, err, maxErr = 0;
+    uint32_t i, n, nIn, nOut;
+    int     frame, level, best, r, c, nBad = 0;
+
+    srand(1);
+    for (i = 0; i < NTEST; i++)
+    {
+        ra = 2 * PI * rand() / (double)RAND_MAX;
+        dec = asin(2.0 * rand() / (double)RAND_MAX - 1.0);
+        x[i] = cos(dec) * cos(ra);
+        y[i] = cos(dec) * sin(ra);
+        z[i] = sin(dec);
+    }
+
+    best = simdlevel();
+    for (frame = 0; frame < 20; frame++)
+    {
+        horizmatrix(J2000 + frame * 17.3, dtr(-80.0 + frame * 8.0), dtr(frame * 18.0), m);
+        for (r = 0; r < 3; r++)
+            for (c = 0; c < 3; c++)
+                mm[r][c] = m[r][c];
+
+        // Unrounded error of the scalar path, count of stars on screen
+        // by more (nIn) or less (nOut) than PROJERRBOUND from its edges
+        projFit();
+        nIn = nOut = 0;
+        for (i = 0; i < NTEST; i++)
+        {
+            h[0] = m[0][0] * x[i] + m[0][1] * y[i] + m[0][2] * z[i];
+            h[1] = m[1][0] * x[i] + m[1][1] * y[i] + m[1][2] * z[i];
+            h[2] = m[2][0] * x[i] + m[2][1] * y[i] + m[2][2] * z[i];
+            if (h[2] >= 0)
+            {
+                projExact(h, &X, &Y);
+                X += SCRCX;
+                Y = SCRCY + 1 - Y;
+                if (onScreen(X, Y, -PROJERRBOUND))
+                    nOut++;
+                if (onScreen(X, Y, PROJERRBOUND) && (h[2] * PROJSCALE >= PROJERRBOUND))
+                    nIn++;
+            }
+
+            if (!projPoint(mm, x[i], y[i], z[i], &fx, &fy))
+                continue;
+            projExact(h, &X, &Y);
+            err = max(fabs(fx - X), fabs(fy - Y));
+            if ((SCRCX + X >= 0) && (SCRCX + X < SCRWIDTH) && (SCRCY - Y >= 0))
+                maxErr = max(maxErr, err);
+        }
+
+        // Pixels from every kernel
+        for (level = best; level >= SIMD_SCALAR; level--)
+        {
+#ifndef SIMD_NEON
+            if (level == SIMD_NEON)
+                continue;
+#endif
+            simdforce(level);
+            projInit();
+            n = projectStars(m, x, y, z, NTEST, px, py, idx);
+            if ((n < nIn) || (n > nOut))
+            {
+                printf("%s: %u stars on screen, expected %u..%u\n", simdname(level), n, nIn, nOut);
+                nBad++;
+            }
+            for (i = 0; i < n; i++)
+            {
+                h[0] = m[0][0] * x[idx[i]] + m[0][1] * y[idx[i]] + m[0][2] * z[idx[i]];
+                h[1] = m[1][0] * x[idx[i]] + m[1][1] * y[idx[i]] + m[1][2] * z[idx[i]];
+                h[2] = m[2][0] * x[idx[i]] + m[2][1] * y[idx[i]] + m[2][2] * z[idx[i]];
+                projExact(h, &X, &Y);
+                if (!pixelOK(px[i], SCRCX, 1, X) || !pixelOK(py[i], SCRCY, -1, Y))
+                {
+                    if (nBad++ < 10)
+                        printf("%s: star %u at %d,%d, exact %.4f,%.4f\n", simdname(level),
+                               idx[i], px[i], py[i], SCRCX + X, SCRCY - Y);
+                }
+            }
+        }
+    }
+
+    printf("%s precision, best kernel %s\n", (sizeof(vreal) == sizeof(float)) ? "Single" : "Double",
+           simdname(best));
+    printf("Maximum error %.5f pixel (bound %.3f), %d misplaced stars\n", maxErr, PROJERRBOUND, nBad);
+
+    return ((maxErr <= PROJERRBOUND) && (nBad == 0)) ? 0 : 1;
+}
+#endif
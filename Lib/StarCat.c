@@ -0,0 +1,808 @@
+/* StarCat.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "SkyPi.h"
+#include "StarCat.h"
+
+// defines for 4dgl colours
+#include "Picaso_const4D.h"
+
+//-------------------------------------------------------------------------------
+// csv_parse    Split a CSV line in place. Quotes around a field are dropped
+//              and commas between them do not split it.
+
+int csv_parse(char *sLine, char *sElems[], int nElem)
+{
+    char   *p, *q;
+    int    n, bQuote;
+
+    p = sLine;
+    n = 0;
+    while (TRUE)
+    {
+        // Nothing of use
+        if (*p == '\0')
+            return n;
+
+        // Save the string
+        sElems[n++] = q = p;
+        // Find the next field
+        bQuote = FALSE;
+        while ((*p != '\0') && (*p != '\n') && (*p != '\r') && (bQuote || (*p != ',')))
+        {
+            if (*p == '"')
+                bQuote = !bQuote;
+            else
+                *q++ = *p;
+            p++;
+        }
+
+        // Nothing else of use or too many fields
+        if ((*p != ',') || (n >= nElem))
+        {
+            *q = '\0';
+            return n;
+        }
+
+        // Split the field
+        *q = '\0';
+        p++;
+    }
+
+	return  n;
+}
+
+//-------------------------------------------------------------------------------
+// growAppend   Append data to a growable buffer, returns offset
+
+size_t growAppend(struct growBuf *gb, const void *data, size_t len)
+{
+    size_t off = gb->used;
+
+    if ((gb->used + len) > gb->size)
+    {
+        gb->size = max(gb->size * 2, gb->used + len + 4096);
+        gb->data = realloc(gb->data, gb->size);
+        if (gb->data == NULL)
+        {
+            printf("Out of memory compiling starmap DB\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(gb->data + off, data, len);
+    gb->used += len;
+
+    return off;
+}
+
+// Quantize values for the packed catalog
+static uint32_t packRA(double ra)
+{
+    return (uint32_t)(unsigned long long)llround(fixangr(ra) / CATANGLE);
+}
+
+static int32_t packDec(double dec)
+{
+    return (int32_t)lround(dec / CATANGLE);
+}
+
+static int16_t packPM(double pm)
+{
+    return (int16_t)lround(max(-32767.0, min(32767.0, pm)));
+}
+
+// packStar     Fill a catalog star (angles in radians, proper motion mas/yr)
+
+void packStar(struct catStar *cs, double ra, double dec, double mag, char spect, double pmRA, double pmDec)
+{
+    memset(cs, 0, sizeof(*cs));
+    cs->ra = packRA(ra);
+    cs->dec = packDec(dec);
+    cs->mag = (int16_t)lround(mag * 100.0);
+    cs->spect = spect;
+    cs->pmRA = packPM(pmRA);
+    cs->pmDec = packPM(pmDec);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// assembleCat  Build a catalog image from star, line vertex and name tables.
+//              st is the source file (NULL if none).
+
+static void assembleCat(const struct growBuf *stars, const struct growBuf *segs,
+                        const struct growBuf *names, const struct stat *st,
+                        void **image, size_t *size)
+{
+    struct catHeader hdr;
+    char    *p;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CATMAGIC;
+    hdr.version = CATVERSION;
+    hdr.nStars = stars->used / sizeof(struct catStar);
+    hdr.nSegs = segs->used / sizeof(struct catSeg);
+    hdr.nameSize = names->used;
+    if (st != NULL)
+    {
+        hdr.srcMtime = st->st_mtime;
+        hdr.srcSize = st->st_size;
+    }
+
+    *size = sizeof(hdr) + stars->used + segs->used + names->used;
+    p = *image = malloc(*size);
+    if (p == NULL)
+    {
+        printf("Out of memory compiling starmap DB\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, stars->data, stars->used);
+    p += stars->used;
+    memcpy(p, segs->data, segs->used);
+    p += segs->used;
+    memcpy(p, names->data, names->used);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// compileCSV   Build a catalog image from the CSV starmap DB
+//
+//  CSV format: name, RA (radians), Dec (radians), magnitude, spectral class
+//              [, proper motion RA * cos(Dec), proper motion Dec (mas/yr)]
+//  Entries with magnitude CATLINEMAG are constellation line vertices whose
+//  "spectral class" is S(tart), N(ext) or E(nd).
+
+static int compileCSV(const char *fname, const struct stat *st, void **image, size_t *size)
+{
+    FILE    *fd;
+    char    *sLine = NULL;
+    size_t  nLine = 0;
+    char    *starInfo[8];
+    int     n, lineNo = 0;
+    double  mag;
+    struct growBuf stars = { NULL, 0, 0 };
+    struct growBuf segs = { NULL, 0, 0 };
+    struct growBuf names = { NULL, 0, 0 };
+    struct catStar cs;
+    struct catSeg seg;
+
+    fd = fopen(fname, "r");
+    if (fd == NULL)
+    {
+        printf("Cannot open starmap DB file: %s\nError (%d) - %s\n", fname, errno, strerror(errno));
+        return -1;
+    }
+
+    // Offset 0 is the empty name
+    growAppend(&names, "", 1);
+
+    while (getline(&sLine, &nLine, fd) != -1)
+    {
+        lineNo++;
+        n = csv_parse(sLine, &starInfo[0], 8);
+        if ((n != 5) && (n != 7))
+        {
+            printf("%s(%d): Expected 5 or 7 fields, found %d\n", fname, lineNo, n);
+            free(sLine);
+            fclose(fd);
+            return -1;
+        }
+
+        mag = atof(starInfo[3]);
+        if (mag <= CATLINEMAG)
+        {
+            // Constellation line vertex
+            memset(&seg, 0, sizeof(seg));
+            seg.ra = packRA(atof(starInfo[1]));
+            seg.dec = packDec(atof(starInfo[2]));
+            seg.type = *(starInfo[4]);
+            growAppend(&segs, &seg, sizeof(seg));
+        } else {
+            packStar(&cs, atof(starInfo[1]), atof(starInfo[2]), mag, *(starInfo[4]),
+                     (n == 7) ? atof(starInfo[5]) : 0.0, (n == 7) ? atof(starInfo[6]) : 0.0);
+            cs.name = growAppend(&names, starInfo[0], strlen(starInfo[0]) + 1);
+            growAppend(&stars, &cs, sizeof(cs));
+        }
+    }
+    free(sLine);
+    fclose(fd);
+
+    assembleCat(&stars, &segs, &names, st, image, size);
+
+    free(stars.data);
+    free(segs.data);
+    free(names.data);
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+// setupCat     Validate catalog image and set table pointers
+
+static int setupCat(struct starCat *cat)
+{
+    const struct catHeader *hdr = cat->base;
+    size_t need;
+
+    if ((cat->size < sizeof(*hdr)) || (hdr->magic != CATMAGIC) || (hdr->version != CATVERSION))
+        return -1;
+
+    need = sizeof(*hdr) + (size_t)hdr->nStars * sizeof(struct catStar) +
+            (size_t)hdr->nSegs * sizeof(struct catSeg) + hdr->nameSize;
+
+    cat->tiles = NULL;
+    if (hdr->flags & CATTILED)
+    {
+        // Tile index follows names, 8 byte aligned
+        need = (need + 7) & ~(size_t)7;
+        if (cat->size < need + sizeof(struct tileHeader))
+            return -1;
+        cat->tiles = (const struct tileHeader *)((const char *)cat->base + need);
+        if ((cat->tiles->nBands == 0) || (cat->tiles->nBands > TILEMAXBANDS))
+            return -1;
+        need += sizeof(struct tileHeader) +
+                (size_t)cat->tiles->nCells * sizeof(struct starCell) +
+                (size_t)cat->tiles->nCells * cat->tiles->nBands * sizeof(struct tileDir);
+    }
+    if (need != cat->size)
+        return -1;
+
+    cat->hdr = hdr;
+    cat->stars = (const struct catStar *)(hdr + 1);
+    cat->segs = (const struct catSeg *)(cat->stars + hdr->nStars);
+    cat->names = (const char *)(cat->segs + hdr->nSegs);
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+// mapCat       Memory-map a binary catalog
+
+static int mapCat(const char *fname, struct starCat *cat)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if ((fstat(fd, &st) < 0) || (st.st_size == 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    cat->size = st.st_size;
+    cat->base = mmap(NULL, cat->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cat->base == MAP_FAILED)
+    {
+        cat->base = NULL;
+        return -1;
+    }
+
+    cat->bMapped = TRUE;
+    if (setupCat(cat) < 0)
+    {
+        closeStarCat(cat);
+        return -1;
+    }
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+// writeCache   Write catalog image next to the CSV (tmp file + rename)
+
+static int writeCache(const char *cname, const void *image, size_t size)
+{
+    char    tname[PATH_MAX];
+    FILE    *fd;
+    int     rc;
+
+    snprintf(tname, sizeof(tname), "%s.tmp", cname);
+    fd = fopen(tname, "w");
+    if (fd == NULL)
+        return -1;
+
+    rc = (fwrite(image, size, 1, fd) == 1) ? 0 : -1;
+    if (fclose(fd) != 0)
+        rc = -1;
+    if (rc == 0)
+        rc = rename(tname, cname);
+    if (rc != 0)
+        unlink(tname);
+
+    return rc;
+}
+
+//-------------------------------------------------------------------------------
+// openStarCat  Open the starmap DB. A CSV is compiled to a binary cache
+//              (name.bin) if the cache is missing or stale.
+
+int openStarCat(const char *fname, struct starCat *cat)
+{
+    struct stat st;
+    char    cname[PATH_MAX];
+    char    *p;
+    void    *image;
+    size_t  size;
+
+    memset(cat, 0, sizeof(*cat));
+
+    if (stat(fname, &st) < 0)
+    {
+        printf("Cannot locate starmap DB: %s\nError (%d) - %s\n", fname, errno, strerror(errno));
+        return -1;
+    }
+
+    // Already a binary catalog?
+    if (mapCat(fname, cat) == 0)
+        return 0;
+
+    // Cache file name: replace .csv suffix with .bin
+    snprintf(cname, sizeof(cname) - 4, "%s", fname);
+    p = strrchr(cname, '.');
+    if ((p != NULL) && (strcasecmp(p, ".csv") == 0))
+        *p = '\0';
+    strcat(cname, ".bin");
+
+    // Use cache if built from this version of the CSV
+    if (mapCat(cname, cat) == 0)
+    {
+        if ((cat->hdr->srcMtime == st.st_mtime) && (cat->hdr->srcSize == st.st_size))
+            return 0;
+        closeStarCat(cat);
+    }
+
+    if (compileCSV(fname, &st, &image, &size) < 0)
+        return -1;
+
+    if ((writeCache(cname, image, size) == 0) && (mapCat(cname, cat) == 0))
+    {
+        free(image);
+        return 0;
+    }
+
+    // Can't cache it - run from memory
+    printf("Unable to write starmap cache: %s\n", cname);
+    cat->base = image;
+    cat->size = size;
+    cat->bMapped = FALSE;
+
+    return setupCat(cat);
+}
+
+//-------------------------------------------------------------------------------
+// makeStarCat  Set up an in-memory catalog from star, line vertex and name
+//              tables (names start with the empty name at offset 0)
+
+int makeStarCat(const struct growBuf *stars, const struct growBuf *segs,
+                const struct growBuf *names, struct starCat *cat)
+{
+    memset(cat, 0, sizeof(*cat));
+    assembleCat(stars, segs, names, NULL, &cat->base, &cat->size);
+    cat->bMapped = FALSE;
+
+    return setupCat(cat);
+}
+
+// writeStarCat Write a catalog image to a binary catalog file
+
+int writeStarCat(const struct starCat *cat, const char *fname)
+{
+    if (writeCache(fname, cat->base, cat->size) < 0)
+    {
+        printf("Error writing catalog: %s\n", fname);
+        return -1;
+    }
+
+    return 0;
+}
+
+void closeStarCat(struct starCat *cat)
+{
+    if (cat->base != NULL)
+    {
+        if (cat->bMapped)
+            munmap(cat->base, cat->size);
+        else
+            free(cat->base);
+    }
+    memset(cat, 0, sizeof(*cat));
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// starColor    Map spectral class to display colour
+
+static uint16_t starColor(char spect)
+{
+    switch (spect)
+    {
+    case 'A':   return LIGHTBLUE;   //blue-white
+    case 'B':   return BLUE;        //blue
+    case 'F':   return WHITE;       //white
+    case 'G':   return YELLOW;      //yellow
+    case 'K':   return ORANGE;      //orange
+    case 'M':   return RED;         //red
+    case 'O':   return BLUE;        //bright blue
+    case 'W':   return WHITE;       //white
+    default:    return WHITE;       //white
+    }
+}
+
+// starSize     Map magnitude to glyph radius (-1 = not drawn)
+
+static int starSize(double mag)
+{
+    int iMAG = (int)round(4.0 - mag);
+
+    // Skip over line drawing entries
+    if (iMAG >= 6)
+        return -1;
+
+    switch (iMAG)
+    {
+    case 5:
+        return 2;
+
+    case 4:
+    case 3:
+        return 1;
+
+    default:
+        //visible print a dot
+        return 0;
+    }
+}
+
+// storeArray   Carve a cache-line aligned array out of the store block
+
+static void *storeArray(char **p, size_t n, size_t elem)
+{
+    void *a = *p;
+
+    *p += (n * elem + STORE_ALIGN - 1) & ~(size_t)(STORE_ALIGN - 1);
+    return a;
+}
+
+//-------------------------------------------------------------------------------
+// skyCell      HEALPix nested cell number of a unit vector (nside a power of 2)
+
+uint32_t skyCell(uint32_t nside, double x, double y, double z)
+{
+    double  za, tt, tp, tmp, t1, t2;
+    int     face, ix, iy, jp, jm, ntt, ifp, ifm, bit;
+    uint32_t ipf;
+
+    za = fabs(z);
+    tt = atan2(y, x);
+    if (tt < 0)
+        tt += 2 * PI;
+    tt /= PI / 2;                       // [0,4)
+
+    if (za <= 2.0 / 3.0)
+    {
+        // Equatorial zone
+        t1 = nside * (0.5 + tt);
+        t2 = nside * z * 0.75;
+        jp = (int)(t1 - t2);
+        jm = (int)(t1 + t2);
+        ifp = jp / nside;
+        ifm = jm / nside;
+        if (ifp == ifm)
+            face = (ifp & 3) + 4;
+        else if (ifp < ifm)
+            face = ifp & 3;
+        else
+            face = (ifm & 3) + 8;
+        ix = jm & (nside - 1);
+        iy = nside - (jp & (nside - 1)) - 1;
+    } else {
+        // Polar caps
+        ntt = min((int)tt, 3);
+        tp = tt - ntt;
+        tmp = nside * sqrt(3 * (1 - za));
+        jp = min((int)(tp * tmp), (int)nside - 1);
+        jm = min((int)((1 - tp) * tmp), (int)nside - 1);
+        if (z >= 0)
+        {
+            face = ntt;
+            ix = nside - jm - 1;
+            iy = nside - jp - 1;
+        } else {
+            face = ntt + 8;
+            ix = jp;
+            iy = jm;
+        }
+    }
+
+    // Interleave ix/iy bits
+    for (ipf = 0, bit = 0; (1U << bit) < nside; bit++)
+        ipf |= (((ix >> bit) & 1) << (2 * bit)) | (((iy >> bit) & 1) << (2 * bit + 1));
+
+    return face * nside * nside + ipf;
+}
+
+static int keyCompare(const void *a, const void *b)
+{
+    const struct storeKey *ka = a, *kb = b;
+
+    if (ka->cell != kb->cell)
+        return (ka->cell < kb->cell) ? -1 : 1;
+    if (ka->mag != kb->mag)
+        return (ka->mag < kb->mag) ? -1 : 1;
+    return (ka->k < kb->k) ? -1 : (ka->k > kb->k);
+}
+
+//-------------------------------------------------------------------------------
+// storeCellBounds  Bounding cone of the stars in a cell
+
+void storeCellBounds(struct starStore *ss, struct starCell *sc)
+{
+    double  x = 0, y = 0, z = 0, r, d, cosr = 1.0;
+    uint32_t i;
+
+    for (i = sc->first; i < sc->first + sc->count; i++)
+    {
+        x += ss->x[i];
+        y += ss->y[i];
+        z += ss->z[i];
+    }
+    r = sqrt(x * x + y * y + z * z);
+    sc->cx = x / r;
+    sc->cy = y / r;
+    sc->cz = z / r;
+
+    // Widest member, padded for proper motion and rounding in the cull test
+    for (i = sc->first; i < sc->first + sc->count; i++)
+    {
+        d = sc->cx * ss->x[i] + sc->cy * ss->y[i] + sc->cz * ss->z[i];
+        cosr = min(cosr, d);
+    }
+    r = acos(max(cosr, -1.0)) + CELLPAD;
+    sc->sinr = sin(r);
+    sc->cosr = cos(r);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// allocStarStore   Allocate store tables for n stars and nCells sky cells
+
+int allocStarStore(struct starStore *ss, uint32_t n, uint32_t nCells)
+{
+    size_t  nAlloc, size;
+    char    *p;
+
+    memset(ss, 0, sizeof(*ss));
+
+    // Round up so vector loops may run over the end
+    nAlloc = (n + 7) & ~(size_t)7;
+    size = 3 * (nAlloc * sizeof(vreal) + STORE_ALIGN) +
+            nAlloc * sizeof(float) + STORE_ALIGN +
+            nAlloc * sizeof(uint16_t) + STORE_ALIGN +
+            nAlloc * sizeof(signed char) + STORE_ALIGN +
+            nAlloc * sizeof(uint32_t) + STORE_ALIGN +
+            nCells * sizeof(struct starCell) + STORE_ALIGN;
+    if (posix_memalign(&ss->block, STORE_ALIGN, size) != 0)
+    {
+        ss->block = NULL;
+        return -1;
+    }
+    memset(ss->block, 0, size);
+
+    p = ss->block;
+    ss->x = storeArray(&p, nAlloc, sizeof(vreal));
+    ss->y = storeArray(&p, nAlloc, sizeof(vreal));
+    ss->z = storeArray(&p, nAlloc, sizeof(vreal));
+    ss->mag = storeArray(&p, nAlloc, sizeof(float));
+    ss->color = storeArray(&p, nAlloc, sizeof(uint16_t));
+    ss->size = storeArray(&p, nAlloc, sizeof(signed char));
+    ss->id = storeArray(&p, nAlloc, sizeof(uint32_t));
+    ss->cells = (nCells > 0) ? storeArray(&p, nCells, sizeof(struct starCell)) : NULL;
+    ss->nCells = nCells;
+    ss->nStars = n;
+
+    return 0;
+}
+
+// starVector   J2000 mean equatorial unit vector of a catalog star moved
+//              by its proper motion for years since J2000. Linear motion
+//              along the tangent plane is exact enough for centuries.
+
+static void starVector(const struct catStar *cs, double years, double v[3])
+{
+    double  ra, dec, rasin, racos, decsin, deccos, pmRA, pmDec, r;
+
+    ra = catRA(cs);
+    dec = catDec(cs);
+    rasin = sin(ra);
+    racos = cos(ra);
+    decsin = sin(dec);
+    deccos = cos(dec);
+
+    v[0] = deccos * racos;
+    v[1] = deccos * rasin;
+    v[2] = decsin;
+    if (((cs->pmRA == 0) && (cs->pmDec == 0)) || (years == 0))
+        return;
+
+    pmRA = catPM(cs->pmRA) * years;
+    pmDec = catPM(cs->pmDec) * years;
+    v[0] += -pmRA * rasin - pmDec * decsin * racos;
+    v[1] += pmRA * racos - pmDec * decsin * rasin;
+    v[2] += pmDec * deccos;
+    r = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    v[0] /= r;
+    v[1] /= r;
+    v[2] /= r;
+
+    return;
+}
+
+// setStoreStar     Fill store entry k from catalog star id (position
+//                  moved by proper motion for years since J2000)
+
+void setStoreStar(struct starStore *ss, uint32_t k, const struct catStar *cs, uint32_t id, double years)
+{
+    double  v[3], mag;
+
+    starVector(cs, years, v);
+    ss->x[k] = v[0];
+    ss->y[k] = v[1];
+    ss->z[k] = v[2];
+    mag = catMag(cs);
+    ss->mag[k] = mag;
+    ss->color[k] = starColor(cs->spect);
+    ss->size[k] = starSize(mag);
+    ss->id[k] = id;
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// cellOrder    Drawable stars brighter than magLimit, ordered by sky cell
+//              and brightest first within a cell. Returns malloc'd keys.
+
+struct storeKey *cellOrder(const struct starCat *cat, uint32_t nside, double magLimit, uint32_t *n)
+{
+    const struct catStar *cs;
+    struct storeKey *keys;
+    uint32_t k;
+    double  ra, dec, mag;
+
+    // Count survivors
+    for (k = *n = 0, cs = cat->stars; k < cat->hdr->nStars; k++, cs++)
+    {
+        mag = catMag(cs);
+        if ((mag <= magLimit) && (starSize(mag) >= 0))
+            (*n)++;
+    }
+
+    keys = malloc((*n + 1) * sizeof(struct storeKey));
+    if (keys == NULL)
+        return NULL;
+
+    for (k = *n = 0, cs = cat->stars; k < cat->hdr->nStars; k++, cs++)
+    {
+        mag = catMag(cs);
+        if ((mag > magLimit) || (starSize(mag) < 0))
+            continue;
+
+        ra = catRA(cs);
+        dec = catDec(cs);
+        keys[*n].cell = skyCell(nside, cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec));
+        keys[*n].mag = mag;
+        keys[*n].k = k;
+        (*n)++;
+    }
+    qsort(keys, *n, sizeof(struct storeKey), keyCompare);
+
+    return keys;
+}
+
+//-------------------------------------------------------------------------------
+// loadStarStore    Load drawable stars brighter than magLimit
+
+int loadStarStore(const struct starCat *cat, double magLimit, struct starStore *ss)
+{
+    struct storeKey *keys;
+    struct starCell *sc;
+    uint32_t k, n;
+
+    keys = cellOrder(cat, STORE_NSIDE, magLimit, &n);
+    if ((keys == NULL) || (allocStarStore(ss, n, 12 * STORE_NSIDE * STORE_NSIDE) < 0))
+    {
+        printf("Out of memory loading %u stars\n", n);
+        free(keys);
+        return -1;
+    }
+
+    for (k = 0; k < n; k++)
+    {
+        setStoreStar(ss, k, &cat->stars[keys[k].k], keys[k].k, 0);
+
+        sc = &ss->cells[keys[k].cell];
+        if (sc->count++ == 0)
+            sc->first = k;
+    }
+    free(keys);
+
+    for (k = 0; k < ss->nCells; k++)
+    {
+        if (ss->cells[k].count > 0)
+            storeCellBounds(ss, &ss->cells[k]);
+    }
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+// properMotion     Move stars of a store to their positions years after
+//                  J2000. Only stars with a proper motion are touched.
+
+void properMotion(const struct starCat *cat, struct starStore *ss, double years)
+{
+    const struct catStar *cs;
+    double  v[3];
+    uint32_t k;
+
+    for (k = 0; k < ss->nStars; k++)
+    {
+        cs = &cat->stars[ss->id[k]];
+        if ((cs->pmRA != 0) || (cs->pmDec != 0))
+        {
+            starVector(cs, years, v);
+            ss->x[k] = v[0];
+            ss->y[k] = v[1];
+            ss->z[k] = v[2];
+        }
+    }
+
+    return;
+}
+
+void freeStarStore(struct starStore *ss)
+{
+    free(ss->block);
+    memset(ss, 0, sizeof(*ss));
+
+    return;
+}
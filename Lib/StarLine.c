@@ -0,0 +1,323 @@
+/* StarLine.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "SkyPi.h"
+#include "StarCat.h"
+
+// Catalog being indexed (qsort has no context argument)
+static const struct starCat *sortCat;
+
+static int nameCompare(const void *a, const void *b)
+{
+    return strcmp(&sortCat->names[sortCat->stars[*(const uint32_t *)a].name],
+                  &sortCat->names[sortCat->stars[*(const uint32_t *)b].name]);
+}
+
+static int posCompare(const void *a, const void *b)
+{
+    const struct catStar *sa = &sortCat->stars[*(const uint32_t *)a];
+    const struct catStar *sb = &sortCat->stars[*(const uint32_t *)b];
+
+    if (sa->ra != sb->ra)
+        return (sa->ra < sb->ra) ? -1 : 1;
+    return (sa->dec < sb->dec) ? -1 : (sa->dec > sb->dec) ? 1 : 0;
+}
+
+// starIndex    Catalog star indices sorted with compare
+
+static uint32_t *starIndex(const struct starCat *cat, int (*compare)(const void *, const void *))
+{
+    uint32_t *idx, k;
+
+    idx = malloc((cat->hdr->nStars + 1) * sizeof(uint32_t));
+    if (idx == NULL)
+        return NULL;
+    for (k = 0; k < cat->hdr->nStars; k++)
+        idx[k] = k;
+
+    sortCat = cat;
+    qsort(idx, cat->hdr->nStars, sizeof(uint32_t), compare);
+
+    return idx;
+}
+
+// findName     Catalog star with a name (LINENOSTAR if none)
+
+static uint32_t findName(const struct starCat *cat, const uint32_t *idx, const char *name)
+{
+    uint32_t lo = 0, hi = cat->hdr->nStars, mid;
+    int c;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        c = strcmp(name, &cat->names[cat->stars[idx[mid]].name]);
+        if (c == 0)
+            return idx[mid];
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return LINENOSTAR;
+}
+
+// findPos      Catalog star at a line vertex position (LINENOSTAR if none)
+
+static uint32_t findPos(const struct starCat *cat, const uint32_t *idx, const struct catSeg *seg)
+{
+    uint32_t lo = 0, hi = cat->hdr->nStars, mid;
+    const struct catStar *cs;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        cs = &cat->stars[idx[mid]];
+        if ((cs->ra == seg->ra) && (cs->dec == seg->dec))
+            return idx[mid];
+        if ((seg->ra < cs->ra) || ((seg->ra == cs->ra) && (seg->dec < cs->dec)))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return LINENOSTAR;
+}
+
+// Polyline under construction
+struct lineBuild {
+    struct growBuf verts;           // catStar
+    struct growBuf ids;             // uint32_t
+    struct growBuf lines;           // starCell
+    struct starCell sc;
+};
+
+static void lineEnd(struct lineBuild *lb);
+
+// lineVertex   Add a vertex. Long lines continue in a new polyline.
+
+static void lineVertex(struct lineBuild *lb, const struct catStar *cs, uint32_t id)
+{
+    struct catStar last;
+    uint32_t lastId;
+
+    if (lb->sc.count == LINEMAXVERT)
+    {
+        last = ((struct catStar *)lb->verts.data)[lb->sc.first + lb->sc.count - 1];
+        lastId = ((uint32_t *)lb->ids.data)[lb->sc.first + lb->sc.count - 1];
+        lineEnd(lb);
+        lineVertex(lb, &last, lastId);
+    }
+
+    growAppend(&lb->verts, cs, sizeof(*cs));
+    growAppend(&lb->ids, &id, sizeof(id));
+    lb->sc.count++;
+
+    return;
+}
+
+// lineEnd      Close the current polyline (single points are dropped)
+
+static void lineEnd(struct lineBuild *lb)
+{
+    if (lb->sc.count >= 2)
+    {
+        growAppend(&lb->lines, &lb->sc, sizeof(lb->sc));
+    } else {
+        lb->verts.used -= lb->sc.count * sizeof(struct catStar);
+        lb->ids.used -= lb->sc.count * sizeof(uint32_t);
+    }
+    lb->sc.first = lb->ids.used / sizeof(uint32_t);
+    lb->sc.count = 0;
+
+    return;
+}
+
+// readLines    Polylines of star names from a line file
+
+static int readLines(const struct starCat *cat, const char *fname, struct lineBuild *lb)
+{
+    FILE    *fd;
+    char    *sLine = NULL;
+    size_t  nLine = 0;
+    char    *names[4 * LINEMAXVERT];
+    uint32_t *idx, id;
+    int     n, k, lineNo = 0;
+
+    fd = fopen(fname, "r");
+    if (fd == NULL)
+    {
+        printf("Cannot open line file: %s\nError (%d) - %s\n", fname, errno, strerror(errno));
+        return -1;
+    }
+    idx = starIndex(cat, nameCompare);
+    if (idx == NULL)
+    {
+        printf("Out of memory reading line file\n");
+        fclose(fd);
+        return -1;
+    }
+
+    while (getline(&sLine, &nLine, fd) != -1)
+    {
+        lineNo++;
+        if (sLine[0] == '#')
+            continue;
+
+        // Label, then star names
+        n = csv_parse(sLine, names, 4 * LINEMAXVERT);
+        for (k = 1; k < n; k++)
+        {
+            while (*names[k] == ' ')
+                names[k]++;
+            if (*names[k] == '\0')
+                continue;
+
+            id = findName(cat, idx, names[k]);
+            if (id == LINENOSTAR)
+            {
+                // Break the line at unknown stars
+                printf("%s(%d): Star not in catalog: %s\n", fname, lineNo, names[k]);
+                lineEnd(lb);
+                continue;
+            }
+            lineVertex(lb, &cat->stars[id], id);
+        }
+        lineEnd(lb);
+    }
+    free(sLine);
+    free(idx);
+    fclose(fd);
+
+    return 0;
+}
+
+// catalogLines Polylines from the line drawing entries of the catalog
+
+static int catalogLines(const struct starCat *cat, struct lineBuild *lb)
+{
+    const struct catSeg *seg;
+    struct catStar cs;
+    uint32_t *idx, k, id;
+
+    idx = starIndex(cat, posCompare);
+    if (idx == NULL)
+    {
+        printf("Out of memory indexing constellation lines\n");
+        return -1;
+    }
+
+    for (k = 0, seg = cat->segs; k < cat->hdr->nSegs; k++, seg++)
+    {
+        if (seg->type == 'S')
+            lineEnd(lb);
+
+        id = findPos(cat, idx, seg);
+        if (id == LINENOSTAR)
+        {
+            // Fixed vertex
+            memset(&cs, 0, sizeof(cs));
+            cs.ra = seg->ra;
+            cs.dec = seg->dec;
+            lineVertex(lb, &cs, id);
+        } else {
+            lineVertex(lb, &cat->stars[id], id);
+        }
+    }
+    lineEnd(lb);
+    free(idx);
+
+    return 0;
+}
+
+//-------------------------------------------------------------------------------
+// loadLineSet  Build the line set from a line file, or from the catalog's
+//              own line drawing entries if fname is NULL
+
+int loadLineSet(const struct starCat *cat, const char *fname, struct lineSet *ls)
+{
+    struct lineBuild lb;
+    uint32_t k, nVerts;
+    int     rc;
+
+    memset(ls, 0, sizeof(*ls));
+    memset(&lb, 0, sizeof(lb));
+
+    rc = (fname != NULL) ? readLines(cat, fname, &lb) : catalogLines(cat, &lb);
+    nVerts = lb.ids.used / sizeof(uint32_t);
+    if ((rc == 0) && (allocStarStore(&ls->ss, nVerts, 0) < 0))
+    {
+        printf("Out of memory for %u line vertices\n", nVerts);
+        rc = -1;
+    }
+    if (rc < 0)
+    {
+        free(lb.verts.data);
+        free(lb.ids.data);
+        free(lb.lines.data);
+        return -1;
+    }
+
+    ls->verts = (struct catStar *)lb.verts.data;
+    ls->lines = (struct starCell *)lb.lines.data;
+    ls->nLines = lb.lines.used / sizeof(struct starCell);
+    for (k = 0; k < nVerts; k++)
+        ls->ss.id[k] = ((uint32_t *)lb.ids.data)[k];
+    free(lb.ids.data);
+
+    for (k = 0; k < ls->nLines; k++)
+        ls->maxLine = max(ls->maxLine, ls->lines[k].count);
+    lineEpoch(ls, 0);
+
+    return 0;
+}
+
+// lineEpoch    Move the vertices by proper motion for years since J2000
+
+void lineEpoch(struct lineSet *ls, double years)
+{
+    uint32_t k;
+
+    for (k = 0; k < ls->ss.nStars; k++)
+        setStoreStar(&ls->ss, k, &ls->verts[k], ls->ss.id[k], years);
+    for (k = 0; k < ls->nLines; k++)
+        storeCellBounds(&ls->ss, &ls->lines[k]);
+
+    return;
+}
+
+void freeLineSet(struct lineSet *ls)
+{
+    freeStarStore(&ls->ss);
+    free(ls->verts);
+    free(ls->lines);
+    memset(ls, 0, sizeof(*ls));
+
+    return;
+}
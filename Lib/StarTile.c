@@ -0,0 +1,363 @@
+/* StarTile.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "SkyPi.h"
+#include "StarCat.h"
+#include "SkyProj.h"
+
+// Default magnitude bands (faint limit of each)
+static const float tileBands[] = { 4.0, 6.5, 9.0, 11.5, 99.0 };
+#define NTILEBANDS  (sizeof(tileBands) / sizeof(tileBands[0]))
+
+//-------------------------------------------------------------------------------
+// writeStarTiles   Write catalog in tiled order with tile index
+
+int writeStarTiles(const struct starCat *cat, const char *fname)
+{
+    struct catHeader hdr;
+    struct tileHeader th;
+    struct starStore ss;
+    struct storeKey *keys;
+    struct starCell *cells = NULL;
+    struct tileDir *dir = NULL;
+    struct catStar *stars = NULL;
+    char    tname[PATH_MAX];
+    char    pad[8];
+    FILE    *fd;
+    uint32_t k, n, c, t, nCells, b;
+    size_t  used;
+    int     rc;
+
+    nCells = 12 * STORE_NSIDE * STORE_NSIDE;
+    keys = cellOrder(cat, STORE_NSIDE, tileBands[NTILEBANDS - 1], &n);
+    if ((keys == NULL) || (allocStarStore(&ss, n, 0) < 0))
+    {
+        printf("Out of memory tiling %u stars\n", cat->hdr->nStars);
+        free(keys);
+        return -1;
+    }
+    stars = malloc((n + 1) * sizeof(struct catStar));
+    cells = calloc(nCells, sizeof(struct starCell));
+    dir = calloc(nCells * NTILEBANDS, sizeof(struct tileDir));
+    if ((stars == NULL) || (cells == NULL) || (dir == NULL))
+    {
+        printf("Out of memory tiling %u stars\n", n);
+        rc = -1;
+        goto done;
+    }
+
+    memset(&th, 0, sizeof(th));
+    th.nside = STORE_NSIDE;
+    th.nCells = nCells;
+    th.nBands = NTILEBANDS;
+    memcpy(th.bandMag, tileBands, sizeof(tileBands));
+
+    // Stars in cell then magnitude order, so tiles are contiguous
+    for (k = 0; k < n; k++)
+    {
+        stars[k] = cat->stars[keys[k].k];
+        setStoreStar(&ss, k, &stars[k], k, 0);
+
+        c = keys[k].cell;
+        if (cells[c].count++ == 0)
+            cells[c].first = k;
+
+        for (b = 0; (b < NTILEBANDS - 1) && (keys[k].mag > tileBands[b]); b++)
+            ;
+        t = c * NTILEBANDS + b;
+        if (dir[t].count++ == 0)
+            dir[t].first = k;
+        th.maxTile = max(th.maxTile, dir[t].count);
+    }
+
+    for (c = 0; c < nCells; c++)
+    {
+        if (cells[c].count > 0)
+            storeCellBounds(&ss, &cells[c]);
+    }
+
+    hdr = *cat->hdr;
+    hdr.nStars = n;
+    hdr.flags |= CATTILED;
+
+    snprintf(tname, sizeof(tname), "%s.tmp", fname);
+    fd = fopen(tname, "w");
+    if (fd == NULL)
+    {
+        printf("Cannot create tiled catalog: %s\n", tname);
+        rc = -1;
+        goto done;
+    }
+
+    memset(pad, 0, sizeof(pad));
+    used = sizeof(hdr) + n * sizeof(struct catStar) + hdr.nSegs * sizeof(struct catSeg) + hdr.nameSize;
+    rc = 0;
+    if ((fwrite(&hdr, sizeof(hdr), 1, fd) != 1) ||
+        (fwrite(stars, sizeof(struct catStar), n, fd) != n) ||
+        (fwrite(cat->segs, sizeof(struct catSeg), hdr.nSegs, fd) != hdr.nSegs) ||
+        (fwrite(cat->names, 1, hdr.nameSize, fd) != hdr.nameSize) ||
+        (fwrite(pad, 1, -used & 7, fd) != (-used & 7)) ||
+        (fwrite(&th, sizeof(th), 1, fd) != 1) ||
+        (fwrite(cells, sizeof(struct starCell), nCells, fd) != nCells) ||
+        (fwrite(dir, sizeof(struct tileDir), nCells * NTILEBANDS, fd) != nCells * NTILEBANDS))
+        rc = -1;
+    if (fclose(fd) != 0)
+        rc = -1;
+    if (rc == 0)
+        rc = rename(tname, fname);
+    if (rc != 0)
+    {
+        printf("Error writing tiled catalog: %s\n", tname);
+        unlink(tname);
+    }
+
+done:
+    freeStarStore(&ss);
+    free(keys);
+    free(stars);
+    free(cells);
+    free(dir);
+
+    return rc;
+}
+
+//-------------------------------------------------------------------------------
+// openStarTiles    Set up tile cache for a tiled catalog (-1 if not tiled)
+
+int openStarTiles(const struct starCat *cat, struct starTiles *st)
+{
+    memset(st, 0, sizeof(*st));
+    if (cat->tiles == NULL)
+        return -1;
+
+    st->cat = cat;
+    st->th = cat->tiles;
+    st->cells = (const struct starCell *)(st->th + 1);
+    st->dir = (const struct tileDir *)(st->cells + st->th->nCells);
+    st->head = st->tail = -1;
+
+    st->slots = calloc(st->th->nCells * st->th->nBands, sizeof(struct tileSlot));
+    if (st->slots == NULL)
+    {
+        printf("Out of memory for tile cache\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void closeStarTiles(struct starTiles *st)
+{
+    uint32_t k;
+
+    if (st->slots != NULL)
+    {
+        for (k = 0; k < st->th->nCells * st->th->nBands; k++)
+            freeStarStore(&st->slots[k].ss);
+    }
+    free(st->slots);
+    memset(st, 0, sizeof(*st));
+
+    return;
+}
+
+// tileAdvise   Pass paging advice for the mapped stars of a tile
+
+static void tileAdvise(const struct starTiles *st, uint32_t tile, int advice)
+{
+    const struct tileDir *td = &st->dir[tile];
+    uintptr_t start, end, page;
+
+    if (!st->cat->bMapped)
+        return;
+
+    page = sysconf(_SC_PAGESIZE);
+    start = (uintptr_t)&st->cat->stars[td->first] & ~(page - 1);
+    end = ((uintptr_t)&st->cat->stars[td->first + td->count] + page - 1) & ~(page - 1);
+    madvise((void *)start, end - start, advice);
+
+    return;
+}
+
+// LRU list maintenance
+
+static void tileUnlink(struct starTiles *st, int32_t tile)
+{
+    struct tileSlot *ts = &st->slots[tile];
+
+    if (ts->prev >= 0)
+        st->slots[ts->prev].next = ts->next;
+    else
+        st->head = ts->next;
+    if (ts->next >= 0)
+        st->slots[ts->next].prev = ts->prev;
+    else
+        st->tail = ts->prev;
+
+    return;
+}
+
+static void tilePush(struct starTiles *st, int32_t tile)
+{
+    struct tileSlot *ts = &st->slots[tile];
+
+    ts->prev = -1;
+    ts->next = st->head;
+    if (st->head >= 0)
+        st->slots[st->head].prev = tile;
+    else
+        st->tail = tile;
+    st->head = tile;
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// tileNeeded   Tile has stars and its band reaches magLimit
+
+int tileNeeded(const struct starTiles *st, uint32_t tile, double magLimit)
+{
+    uint32_t band = tile % st->th->nBands;
+
+    if (st->dir[tile].count == 0)
+        return FALSE;
+
+    return (band == 0) || (st->th->bandMag[band - 1] < magLimit);
+}
+
+//-------------------------------------------------------------------------------
+// getTile      Decoded tile from cache, loading it (and evicting least
+//              recently used tiles to stay within TILEBUDGET) if needed
+
+const struct starStore *getTile(struct starTiles *st, uint32_t tile)
+{
+    const struct tileDir *td = &st->dir[tile];
+    struct tileSlot *ts = &st->slots[tile];
+    int32_t lru;
+    uint32_t k;
+
+    if (ts->ss.block != NULL)
+    {
+        st->hits++;
+        tileUnlink(st, tile);
+        tilePush(st, tile);
+        return &ts->ss;
+    }
+    st->misses++;
+
+    // Make room
+    while ((st->tail >= 0) && (st->nCached + td->count > TILEBUDGET))
+    {
+        lru = st->tail;
+        tileUnlink(st, lru);
+        st->nCached -= st->slots[lru].ss.nStars;
+        freeStarStore(&st->slots[lru].ss);
+    }
+
+    if (allocStarStore(&ts->ss, td->count, 0) < 0)
+    {
+        printf("Out of memory loading tile %u\n", tile);
+        return NULL;
+    }
+    for (k = 0; k < td->count; k++)
+        setStoreStar(&ts->ss, k, &st->cat->stars[td->first + k], td->first + k, st->years);
+
+    // Decoded copy replaces the mapped pages
+    tileAdvise(st, tile, MADV_DONTNEED);
+
+    tilePush(st, tile);
+    st->nCached += td->count;
+
+    return &ts->ss;
+}
+
+// tileEpoch    Set years since J2000 for proper motion of decoded tiles.
+//              Tiles decoded for another epoch are dropped.
+
+void tileEpoch(struct starTiles *st, double years)
+{
+    int32_t tile;
+
+    if (years == st->years)
+        return;
+
+    while ((tile = st->head) >= 0)
+    {
+        tileUnlink(st, tile);
+        freeStarStore(&st->slots[tile].ss);
+    }
+    st->nCached = 0;
+    st->years = years;
+
+    return;
+}
+
+// tileStars    Stars of a decoded tile brighter than magLimit (tiles are
+//              sorted brightest first)
+
+uint32_t tileStars(const struct starStore *ss, double magLimit)
+{
+    uint32_t lo = 0, hi = ss->nStars, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (ss->mag[mid] <= magLimit)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+//-------------------------------------------------------------------------------
+// prefetchTiles    Ask for the tiles visible with frame matrix m (the sky a
+//                  few minutes ahead) and not yet decoded to be read in
+
+void prefetchTiles(struct starTiles *st, double m[3][3], double magLimit)
+{
+    const struct starCell *sc;
+    uint32_t k, t;
+
+    for (k = 0, sc = st->cells; k < st->th->nCells; k++, sc++)
+    {
+        if (!cellVisible(m, sc))
+            continue;
+
+        for (t = k * st->th->nBands; t < (k + 1) * st->th->nBands; t++)
+        {
+            if (tileNeeded(st, t, magLimit) && (st->slots[t].ss.block == NULL))
+                tileAdvise(st, t, MADV_WILLNEED);
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,864 @@
+/* VecMath.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "SkyPi.h"
+#include "VecMath.h"
+
+// Every level must round as the scalar code does: no contraction of a * b + c
+// into a fused multiply-add, whatever flags the file is built with
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+static int simdLevel = -1;
+
+//-------------------------------------------------------------------------------
+// simdlevel    Best vector instruction set supported by this CPU
+
+int simdlevel(void)
+{
+    if (simdLevel >= 0)
+        return simdLevel;
+
+    simdLevel = SIMD_SCALAR;
+#ifdef SIMD_X86
+#ifdef __SSE2__
+    simdLevel = SIMD_SSE2;
+#endif
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        simdLevel = SIMD_AVX2;
+#endif
+#ifdef SIMD_NEON
+    simdLevel = SIMD_NEON;
+#endif
+
+    return simdLevel;
+}
+
+// simdforce    Limit vector code to a given level (testing)
+
+void simdforce(int level)
+{
+    simdLevel = -1;
+    simdLevel = min(level, simdlevel());
+
+    return;
+}
+
+const char *simdname(int level)
+{
+    static const char *names[] = { "scalar", "SSE2", "NEON", "AVX2" };
+
+    return ((level >= SIMD_SCALAR) && (level <= SIMD_AVX2)) ? names[level] : "unknown";
+}
+
+//-------------------------------------------------------------------------------
+// Batch elementary functions (see VecMath.h)
+//
+// Each back end follows the scalar code operation for operation, so the
+// results agree to the bit. Arguments outside the reduction range go to
+// libm one at a time.
+
+#if defined(SIMD_NEON) && defined(__aarch64__)
+#define VEC_NEON                        // Double precision lanes
+#endif
+
+#define PIO2_HI     1.57079632679489655800e+00  // pi / 2 in two parts
+#define PIO2_LO     6.12323399573676603587e-17
+#define PIO4_HI     7.85398163397448278999e-01  // pi / 4
+#define PIO4_LO     3.06161699786838301793e-17
+#define PI_HI       3.14159265358979311600e+00  // pi
+#define PI_LO       1.22464679914735317720e-16
+#define TANPIO8     4.14213562373095034e-01     // tan(pi / 8)
+
+#define AT0      3.33333333333329318027e-01     // atan(x) = x - x * z * P(z), z = x^2
+#define AT1     -1.99999999998764832476e-01
+#define AT2      1.42857142725034663711e-01
+#define AT3     -1.11111104054623557880e-01
+#define AT4      9.09088713343650656196e-02
+#define AT5     -7.69187620504482999495e-02
+#define AT6      6.66107313738753120669e-02
+#define AT7     -5.83357013379057348645e-02
+#define AT8      4.97687799461593236017e-02
+#define AT9     -3.65315727442169155270e-02
+#define AT10     1.62858201153657823623e-02
+
+#define PS0      1.66666666666666657415e-01     // asin(x) = x + x * P(z) / Q(z), z = x^2
+#define PS1     -3.25565818622400915405e-01
+#define PS2      2.01212532134862925881e-01
+#define PS3     -4.00555345006794114027e-02
+#define PS4      7.91534994289814532176e-04
+#define PS5      3.47933107596021167570e-05
+#define QS1     -2.40339491173441421878e+00
+#define QS2      2.02094576023350569471e+00
+#define QS3     -6.88283971605453293030e-01
+#define QS4      7.70381505559019352791e-02
+
+// sincos1      Sine and cosine of x
+
+static inline void sincos1(double x, double *sn, double *cs)
+{
+    double q, s, z, ps, pc;
+    int64_t iq;
+
+    if (!(fabs(x) <= VECREDUCE))
+    {
+        *sn = sin(x);
+        *cs = cos(x);
+        return;
+    }
+
+    q = (x * TWOOPI + VECMAGIC) - VECMAGIC;
+    iq = (int64_t)q;
+    s = ((x - q * PIO2_1) - q * PIO2_2) - q * PIO2_3;
+    z = (fabs(s) < VECTINY) ? 0 : s * s;
+    ps = s + s * z * (SIN1 + z * (SIN2 + z * (SIN3 + z * (SIN4 + z * (SIN5 + z * SIN6)))));
+    pc = 1.0 - 0.5 * z + z * z * (COS1 + z * (COS2 + z * (COS3 + z * (COS4 + z * (COS5 + z * COS6)))));
+
+    switch (iq & 3)
+    {
+    case 0:
+        *sn = ps;
+        *cs = pc;
+        break;
+    case 1:
+        *sn = pc;
+        *cs = -ps;
+        break;
+    case 2:
+        *sn = -ps;
+        *cs = -pc;
+        break;
+    default:
+        *sn = -pc;
+        *cs = ps;
+        break;
+    }
+
+    return;
+}
+
+// atan21       Arc tangent of y / x in the quadrant of (x, y)
+
+static inline double atan21(double y, double x)
+{
+    double ax = fabs(x), ay = fabs(y), mn, mx, u, z, w, s1, s2, r, hi, lo;
+
+    mn = min(ax, ay);
+    mx = max(ax, ay);
+    u = mn / ((mx == 0) ? 1.0 : mx);
+    hi = lo = 0;
+    if (u > TANPIO8)
+    {
+        u = (u - 1.0) / (u + 1.0);
+        hi = PIO4_HI;
+        lo = PIO4_LO;
+    }
+    z = (fabs(u) < VECTINY) ? 0 : u * u;
+    w = z * z;
+    s1 = z * (AT0 + w * (AT2 + w * (AT4 + w * (AT6 + w * (AT8 + w * AT10)))));
+    s2 = w * (AT1 + w * (AT3 + w * (AT5 + w * (AT7 + w * AT9))));
+    r = hi - ((u * (s1 + s2) - lo) - u);
+    if (ay > ax)
+        r = PIO2_HI - (r - PIO2_LO);
+    if (signbit(x))
+        r = PI_HI - (r - PI_LO);
+
+    return copysign(r, y);
+}
+
+// asin1        Arc sine of x
+
+static inline double asin1(double x)
+{
+    double ax = fabs(x), t, p, q, w, s, r;
+
+    if (ax >= 0.5)
+        t = (1.0 - ax) * 0.5;
+    else
+        t = (ax < VECTINY) ? 0 : ax * ax;
+    p = t * (PS0 + t * (PS1 + t * (PS2 + t * (PS3 + t * (PS4 + t * PS5)))));
+    q = 1.0 + t * (QS1 + t * (QS2 + t * (QS3 + t * QS4)));
+    w = p / q;
+    if (ax >= 0.5)
+    {
+        s = sqrt(t);
+        r = PIO2_HI - (2.0 * (s + s * w) - PIO2_LO);
+    } else
+        r = ax + ax * w;
+
+    return copysign(r, x);
+}
+
+//-------------------------------------------------------------------------------
+// SSE2 (2 lanes)
+
+#if defined(SIMD_X86) && defined(__SSE2__)
+#define sse2Sel(m, a, b)    _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b))
+
+static void sincosSSE2(const double *x, double *sn, double *cs, int n)
+{
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d vx, q, qm, s, z, ps, pc, swap, t;
+    __m128i bits, one = _mm_set1_epi64x(1), two = _mm_set1_epi64x(2);
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        vx = _mm_loadu_pd(x + k);
+        if (_mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign, vx), _mm_set1_pd(VECREDUCE))))
+        {
+            sincos1(x[k], sn + k, cs + k);
+            sincos1(x[k + 1], sn + k + 1, cs + k + 1);
+            continue;
+        }
+
+        qm = _mm_add_pd(_mm_mul_pd(vx, _mm_set1_pd(TWOOPI)), _mm_set1_pd(VECMAGIC));
+        q = _mm_sub_pd(qm, _mm_set1_pd(VECMAGIC));
+        bits = _mm_castpd_si128(qm);
+        s = _mm_sub_pd(vx, _mm_mul_pd(q, _mm_set1_pd(PIO2_1)));
+        s = _mm_sub_pd(s, _mm_mul_pd(q, _mm_set1_pd(PIO2_2)));
+        s = _mm_sub_pd(s, _mm_mul_pd(q, _mm_set1_pd(PIO2_3)));
+        z = _mm_andnot_pd(_mm_cmplt_pd(_mm_andnot_pd(sign, s), _mm_set1_pd(VECTINY)), s);
+        z = _mm_mul_pd(z, z);
+
+        ps = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(SIN6), z), _mm_set1_pd(SIN5));
+        ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(SIN4));
+        ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(SIN3));
+        ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(SIN2));
+        ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(SIN1));
+        ps = _mm_add_pd(s, _mm_mul_pd(_mm_mul_pd(s, z), ps));
+
+        pc = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(COS6), z), _mm_set1_pd(COS5));
+        pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(COS4));
+        pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(COS3));
+        pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(COS2));
+        pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(COS1));
+        pc = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), z)),
+                        _mm_mul_pd(_mm_mul_pd(z, z), pc));
+
+        // Odd quadrants swap sine and cosine; the sine is negative in
+        // quadrants 2 and 3, the cosine in 1 and 2
+        swap = _mm_castsi128_pd(_mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(bits, one)));
+        t = sse2Sel(swap, pc, ps);
+        pc = sse2Sel(swap, ps, pc);
+        ps = _mm_xor_pd(t, _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(bits, two), 62)));
+        pc = _mm_xor_pd(pc, _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(_mm_add_epi64(bits, one), two), 62)));
+        _mm_storeu_pd(sn + k, ps);
+        _mm_storeu_pd(cs + k, pc);
+    }
+    for ( ; k < n; k++)
+        sincos1(x[k], sn + k, cs + k);
+
+    return;
+}
+
+static void atan2SSE2(const double *y, const double *x, double *r, int n)
+{
+    const __m128d sign = _mm_set1_pd(-0.0), one = _mm_set1_pd(1.0);
+    __m128d vx, vy, ax, ay, mn, mx, u, big, z, w, s1, s2, hi, lo, v, m;
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        vy = _mm_loadu_pd(y + k);
+        vx = _mm_loadu_pd(x + k);
+        ax = _mm_andnot_pd(sign, vx);
+        ay = _mm_andnot_pd(sign, vy);
+        mn = _mm_min_pd(ax, ay);
+        mx = _mm_max_pd(ax, ay);
+        u = _mm_div_pd(mn, sse2Sel(_mm_cmpeq_pd(mx, _mm_setzero_pd()), one, mx));
+        big = _mm_cmpgt_pd(u, _mm_set1_pd(TANPIO8));
+        u = sse2Sel(big, _mm_div_pd(_mm_sub_pd(u, one), _mm_add_pd(u, one)), u);
+        hi = _mm_and_pd(big, _mm_set1_pd(PIO4_HI));
+        lo = _mm_and_pd(big, _mm_set1_pd(PIO4_LO));
+        z = _mm_andnot_pd(_mm_cmplt_pd(_mm_andnot_pd(sign, u), _mm_set1_pd(VECTINY)), u);
+        z = _mm_mul_pd(z, z);
+        w = _mm_mul_pd(z, z);
+
+        s1 = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(AT10), w), _mm_set1_pd(AT8));
+        s1 = _mm_add_pd(_mm_mul_pd(s1, w), _mm_set1_pd(AT6));
+        s1 = _mm_add_pd(_mm_mul_pd(s1, w), _mm_set1_pd(AT4));
+        s1 = _mm_add_pd(_mm_mul_pd(s1, w), _mm_set1_pd(AT2));
+        s1 = _mm_mul_pd(z, _mm_add_pd(_mm_mul_pd(s1, w), _mm_set1_pd(AT0)));
+        s2 = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(AT9), w), _mm_set1_pd(AT7));
+        s2 = _mm_add_pd(_mm_mul_pd(s2, w), _mm_set1_pd(AT5));
+        s2 = _mm_add_pd(_mm_mul_pd(s2, w), _mm_set1_pd(AT3));
+        s2 = _mm_mul_pd(w, _mm_add_pd(_mm_mul_pd(s2, w), _mm_set1_pd(AT1)));
+        v = _mm_sub_pd(hi, _mm_sub_pd(_mm_sub_pd(_mm_mul_pd(u, _mm_add_pd(s1, s2)), lo), u));
+
+        v = sse2Sel(_mm_cmpgt_pd(ay, ax), _mm_sub_pd(_mm_set1_pd(PIO2_HI), _mm_sub_pd(v, _mm_set1_pd(PIO2_LO))), v);
+        m = _mm_castsi128_pd(_mm_shuffle_epi32(_mm_srai_epi32(_mm_castpd_si128(vx), 31), _MM_SHUFFLE(3, 3, 1, 1)));
+        v = sse2Sel(m, _mm_sub_pd(_mm_set1_pd(PI_HI), _mm_sub_pd(v, _mm_set1_pd(PI_LO))), v);
+        _mm_storeu_pd(r + k, _mm_or_pd(v, _mm_and_pd(sign, vy)));
+    }
+    for ( ; k < n; k++)
+        r[k] = atan21(y[k], x[k]);
+
+    return;
+}
+
+static void asinSSE2(const double *x, double *r, int n)
+{
+    const __m128d sign = _mm_set1_pd(-0.0), one = _mm_set1_pd(1.0);
+    __m128d vx, ax, big, t, p, q, w, s, v;
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        vx = _mm_loadu_pd(x + k);
+        ax = _mm_andnot_pd(sign, vx);
+        big = _mm_cmpge_pd(ax, _mm_set1_pd(0.5));
+        t = _mm_andnot_pd(_mm_cmplt_pd(ax, _mm_set1_pd(VECTINY)), ax);
+        t = sse2Sel(big, _mm_mul_pd(_mm_sub_pd(one, ax), _mm_set1_pd(0.5)), _mm_mul_pd(t, t));
+
+        p = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(PS5), t), _mm_set1_pd(PS4));
+        p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(PS3));
+        p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(PS2));
+        p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(PS1));
+        p = _mm_mul_pd(t, _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(PS0)));
+        q = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(QS4), t), _mm_set1_pd(QS3));
+        q = _mm_add_pd(_mm_mul_pd(q, t), _mm_set1_pd(QS2));
+        q = _mm_add_pd(_mm_mul_pd(q, t), _mm_set1_pd(QS1));
+        q = _mm_add_pd(one, _mm_mul_pd(t, q));
+        w = _mm_div_pd(p, q);
+
+        s = _mm_sqrt_pd(t);
+        s = _mm_add_pd(s, _mm_mul_pd(s, w));
+        v = _mm_sub_pd(_mm_set1_pd(PIO2_HI), _mm_sub_pd(_mm_mul_pd(_mm_set1_pd(2.0), s), _mm_set1_pd(PIO2_LO)));
+        v = sse2Sel(big, v, _mm_add_pd(ax, _mm_mul_pd(ax, w)));
+        _mm_storeu_pd(r + k, _mm_or_pd(v, _mm_and_pd(sign, vx)));
+    }
+    for ( ; k < n; k++)
+        r[k] = asin1(x[k]);
+
+    return;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// AVX2 (4 lanes, no fused multiply-add)
+
+#ifdef SIMD_X86
+TARGET_AVX2
+static void sincosAVX2(const double *x, double *sn, double *cs, int n)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d vx, q, qm, s, z, ps, pc, swap, t;
+    __m256i bits, one = _mm256_set1_epi64x(1), two = _mm256_set1_epi64x(2);
+    int j, k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        vx = _mm256_loadu_pd(x + k);
+        if (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, vx), _mm256_set1_pd(VECREDUCE), _CMP_GT_OQ)))
+        {
+            for (j = k; j < k + 4; j++)
+                sincos1(x[j], sn + j, cs + j);
+            continue;
+        }
+
+        qm = _mm256_add_pd(_mm256_mul_pd(vx, _mm256_set1_pd(TWOOPI)), _mm256_set1_pd(VECMAGIC));
+        q = _mm256_sub_pd(qm, _mm256_set1_pd(VECMAGIC));
+        bits = _mm256_castpd_si256(qm);
+        s = _mm256_sub_pd(vx, _mm256_mul_pd(q, _mm256_set1_pd(PIO2_1)));
+        s = _mm256_sub_pd(s, _mm256_mul_pd(q, _mm256_set1_pd(PIO2_2)));
+        s = _mm256_sub_pd(s, _mm256_mul_pd(q, _mm256_set1_pd(PIO2_3)));
+        z = _mm256_andnot_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, s), _mm256_set1_pd(VECTINY), _CMP_LT_OQ), s);
+        z = _mm256_mul_pd(z, z);
+
+        ps = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(SIN6), z), _mm256_set1_pd(SIN5));
+        ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(SIN4));
+        ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(SIN3));
+        ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(SIN2));
+        ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(SIN1));
+        ps = _mm256_add_pd(s, _mm256_mul_pd(_mm256_mul_pd(s, z), ps));
+
+        pc = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(COS6), z), _mm256_set1_pd(COS5));
+        pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(COS4));
+        pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(COS3));
+        pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(COS2));
+        pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(COS1));
+        pc = _mm256_add_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), _mm256_mul_pd(_mm256_set1_pd(0.5), z)),
+                           _mm256_mul_pd(_mm256_mul_pd(z, z), pc));
+
+        swap = _mm256_castsi256_pd(_mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(bits, one)));
+        t = _mm256_blendv_pd(ps, pc, swap);
+        pc = _mm256_blendv_pd(pc, ps, swap);
+        ps = _mm256_xor_pd(t, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(bits, two), 62)));
+        pc = _mm256_xor_pd(pc, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(bits, one), two), 62)));
+        _mm256_storeu_pd(sn + k, ps);
+        _mm256_storeu_pd(cs + k, pc);
+    }
+    for ( ; k < n; k++)
+        sincos1(x[k], sn + k, cs + k);
+
+    return;
+}
+
+TARGET_AVX2
+static void atan2AVX2(const double *y, const double *x, double *r, int n)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0);
+    __m256d vx, vy, ax, ay, mn, mx, u, big, z, w, s1, s2, hi, lo, v;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        vy = _mm256_loadu_pd(y + k);
+        vx = _mm256_loadu_pd(x + k);
+        ax = _mm256_andnot_pd(sign, vx);
+        ay = _mm256_andnot_pd(sign, vy);
+        mn = _mm256_min_pd(ax, ay);
+        mx = _mm256_max_pd(ax, ay);
+        u = _mm256_div_pd(mn, _mm256_blendv_pd(mx, one, _mm256_cmp_pd(mx, _mm256_setzero_pd(), _CMP_EQ_OQ)));
+        big = _mm256_cmp_pd(u, _mm256_set1_pd(TANPIO8), _CMP_GT_OQ);
+        u = _mm256_blendv_pd(u, _mm256_div_pd(_mm256_sub_pd(u, one), _mm256_add_pd(u, one)), big);
+        hi = _mm256_and_pd(big, _mm256_set1_pd(PIO4_HI));
+        lo = _mm256_and_pd(big, _mm256_set1_pd(PIO4_LO));
+        z = _mm256_andnot_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, u), _mm256_set1_pd(VECTINY), _CMP_LT_OQ), u);
+        z = _mm256_mul_pd(z, z);
+        w = _mm256_mul_pd(z, z);
+
+        s1 = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(AT10), w), _mm256_set1_pd(AT8));
+        s1 = _mm256_add_pd(_mm256_mul_pd(s1, w), _mm256_set1_pd(AT6));
+        s1 = _mm256_add_pd(_mm256_mul_pd(s1, w), _mm256_set1_pd(AT4));
+        s1 = _mm256_add_pd(_mm256_mul_pd(s1, w), _mm256_set1_pd(AT2));
+        s1 = _mm256_mul_pd(z, _mm256_add_pd(_mm256_mul_pd(s1, w), _mm256_set1_pd(AT0)));
+        s2 = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(AT9), w), _mm256_set1_pd(AT7));
+        s2 = _mm256_add_pd(_mm256_mul_pd(s2, w), _mm256_set1_pd(AT5));
+        s2 = _mm256_add_pd(_mm256_mul_pd(s2, w), _mm256_set1_pd(AT3));
+        s2 = _mm256_mul_pd(w, _mm256_add_pd(_mm256_mul_pd(s2, w), _mm256_set1_pd(AT1)));
+        v = _mm256_sub_pd(hi, _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(u, _mm256_add_pd(s1, s2)), lo), u));
+
+        v = _mm256_blendv_pd(v, _mm256_sub_pd(_mm256_set1_pd(PIO2_HI), _mm256_sub_pd(v, _mm256_set1_pd(PIO2_LO))),
+                             _mm256_cmp_pd(ay, ax, _CMP_GT_OQ));
+        v = _mm256_blendv_pd(v, _mm256_sub_pd(_mm256_set1_pd(PI_HI), _mm256_sub_pd(v, _mm256_set1_pd(PI_LO))), vx);
+        _mm256_storeu_pd(r + k, _mm256_or_pd(v, _mm256_and_pd(sign, vy)));
+    }
+    for ( ; k < n; k++)
+        r[k] = atan21(y[k], x[k]);
+
+    return;
+}
+
+TARGET_AVX2
+static void asinAVX2(const double *x, double *r, int n)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0);
+    __m256d vx, ax, big, t, p, q, w, s, v;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        vx = _mm256_loadu_pd(x + k);
+        ax = _mm256_andnot_pd(sign, vx);
+        big = _mm256_cmp_pd(ax, _mm256_set1_pd(0.5), _CMP_GE_OQ);
+        t = _mm256_andnot_pd(_mm256_cmp_pd(ax, _mm256_set1_pd(VECTINY), _CMP_LT_OQ), ax);
+        t = _mm256_blendv_pd(_mm256_mul_pd(t, t), _mm256_mul_pd(_mm256_sub_pd(one, ax), _mm256_set1_pd(0.5)), big);
+
+        p = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(PS5), t), _mm256_set1_pd(PS4));
+        p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(PS3));
+        p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(PS2));
+        p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(PS1));
+        p = _mm256_mul_pd(t, _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(PS0)));
+        q = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(QS4), t), _mm256_set1_pd(QS3));
+        q = _mm256_add_pd(_mm256_mul_pd(q, t), _mm256_set1_pd(QS2));
+        q = _mm256_add_pd(_mm256_mul_pd(q, t), _mm256_set1_pd(QS1));
+        q = _mm256_add_pd(one, _mm256_mul_pd(t, q));
+        w = _mm256_div_pd(p, q);
+
+        s = _mm256_sqrt_pd(t);
+        s = _mm256_add_pd(s, _mm256_mul_pd(s, w));
+        v = _mm256_sub_pd(_mm256_set1_pd(PIO2_HI), _mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), s), _mm256_set1_pd(PIO2_LO)));
+        v = _mm256_blendv_pd(_mm256_add_pd(ax, _mm256_mul_pd(ax, w)), v, big);
+        _mm256_storeu_pd(r + k, _mm256_or_pd(v, _mm256_and_pd(sign, vx)));
+    }
+    for ( ; k < n; k++)
+        r[k] = asin1(x[k]);
+
+    return;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// NEON (2 lanes, AArch64 only, no fused multiply-add)
+
+#ifdef VEC_NEON
+#define neonPoly(p, z, c)   vaddq_f64(vmulq_f64(p, z), vdupq_n_f64(c))
+
+static void sincosNEON(const double *x, double *sn, double *cs, int n)
+{
+    float64x2_t vx, q, qm, s, z, ps, pc, t;
+    uint64x2_t bits, swap, one = vdupq_n_u64(1), two = vdupq_n_u64(2);
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        vx = vld1q_f64(x + k);
+        if (vmaxvq_u32(vreinterpretq_u32_u64(vcgtq_f64(vabsq_f64(vx), vdupq_n_f64(VECREDUCE)))))
+        {
+            sincos1(x[k], sn + k, cs + k);
+            sincos1(x[k + 1], sn + k + 1, cs + k + 1);
+            continue;
+        }
+
+        qm = vaddq_f64(vmulq_f64(vx, vdupq_n_f64(TWOOPI)), vdupq_n_f64(VECMAGIC));
+        q = vsubq_f64(qm, vdupq_n_f64(VECMAGIC));
+        bits = vreinterpretq_u64_f64(qm);
+        s = vsubq_f64(vx, vmulq_f64(q, vdupq_n_f64(PIO2_1)));
+        s = vsubq_f64(s, vmulq_f64(q, vdupq_n_f64(PIO2_2)));
+        s = vsubq_f64(s, vmulq_f64(q, vdupq_n_f64(PIO2_3)));
+        z = vbslq_f64(vcltq_f64(vabsq_f64(s), vdupq_n_f64(VECTINY)), vdupq_n_f64(0), s);
+        z = vmulq_f64(z, z);
+
+        ps = neonPoly(vdupq_n_f64(SIN6), z, SIN5);
+        ps = neonPoly(ps, z, SIN4);
+        ps = neonPoly(ps, z, SIN3);
+        ps = neonPoly(ps, z, SIN2);
+        ps = neonPoly(ps, z, SIN1);
+        ps = vaddq_f64(s, vmulq_f64(vmulq_f64(s, z), ps));
+
+        pc = neonPoly(vdupq_n_f64(COS6), z, COS5);
+        pc = neonPoly(pc, z, COS4);
+        pc = neonPoly(pc, z, COS3);
+        pc = neonPoly(pc, z, COS2);
+        pc = neonPoly(pc, z, COS1);
+        pc = vaddq_f64(vsubq_f64(vdupq_n_f64(1.0), vmulq_f64(vdupq_n_f64(0.5), z)), vmulq_f64(vmulq_f64(z, z), pc));
+
+        swap = vtstq_u64(bits, one);
+        t = vbslq_f64(swap, pc, ps);
+        pc = vbslq_f64(swap, ps, pc);
+        ps = vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(t), vshlq_n_u64(vandq_u64(bits, two), 62)));
+        pc = vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(pc),
+                                             vshlq_n_u64(vandq_u64(vaddq_u64(bits, one), two), 62)));
+        vst1q_f64(sn + k, ps);
+        vst1q_f64(cs + k, pc);
+    }
+    for ( ; k < n; k++)
+        sincos1(x[k], sn + k, cs + k);
+
+    return;
+}
+
+static void atan2NEON(const double *y, const double *x, double *r, int n)
+{
+    const float64x2_t one = vdupq_n_f64(1.0);
+    float64x2_t vx, vy, ax, ay, mn, mx, u, z, w, s1, s2, hi, lo, v;
+    uint64x2_t big;
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        vy = vld1q_f64(y + k);
+        vx = vld1q_f64(x + k);
+        ax = vabsq_f64(vx);
+        ay = vabsq_f64(vy);
+        mn = vbslq_f64(vcltq_f64(ax, ay), ax, ay);
+        mx = vbslq_f64(vcgtq_f64(ax, ay), ax, ay);
+        u = vdivq_f64(mn, vbslq_f64(vceqq_f64(mx, vdupq_n_f64(0)), one, mx));
+        big = vcgtq_f64(u, vdupq_n_f64(TANPIO8));
+        u = vbslq_f64(big, vdivq_f64(vsubq_f64(u, one), vaddq_f64(u, one)), u);
+        hi = vbslq_f64(big, vdupq_n_f64(PIO4_HI), vdupq_n_f64(0));
+        lo = vbslq_f64(big, vdupq_n_f64(PIO4_LO), vdupq_n_f64(0));
+        z = vbslq_f64(vcltq_f64(vabsq_f64(u), vdupq_n_f64(VECTINY)), vdupq_n_f64(0), u);
+        z = vmulq_f64(z, z);
+        w = vmulq_f64(z, z);
+
+        s1 = neonPoly(vdupq_n_f64(AT10), w, AT8);
+        s1 = neonPoly(s1, w, AT6);
+        s1 = neonPoly(s1, w, AT4);
+        s1 = neonPoly(s1, w, AT2);
+        s1 = vmulq_f64(z, neonPoly(s1, w, AT0));
+        s2 = neonPoly(vdupq_n_f64(AT9), w, AT7);
+        s2 = neonPoly(s2, w, AT5);
+        s2 = neonPoly(s2, w, AT3);
+        s2 = vmulq_f64(w, neonPoly(s2, w, AT1));
+        v = vsubq_f64(hi, vsubq_f64(vsubq_f64(vmulq_f64(u, vaddq_f64(s1, s2)), lo), u));
+
+        v = vbslq_f64(vcgtq_f64(ay, ax), vsubq_f64(vdupq_n_f64(PIO2_HI), vsubq_f64(v, vdupq_n_f64(PIO2_LO))), v);
+        v = vbslq_f64(vcltzq_s64(vreinterpretq_s64_f64(vx)), vsubq_f64(vdupq_n_f64(PI_HI), vsubq_f64(v, vdupq_n_f64(PI_LO))), v);
+        vst1q_f64(r + k, vbslq_f64(vdupq_n_u64(0x8000000000000000ULL), vy, v));
+    }
+    for ( ; k < n; k++)
+        r[k] = atan21(y[k], x[k]);
+
+    return;
+}
+
+static void asinNEON(const double *x, double *r, int n)
+{
+    const float64x2_t one = vdupq_n_f64(1.0);
+    float64x2_t vx, ax, t, p, q, w, s, v;
+    uint64x2_t big;
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        vx = vld1q_f64(x + k);
+        ax = vabsq_f64(vx);
+        big = vcgeq_f64(ax, vdupq_n_f64(0.5));
+        t = vbslq_f64(vcltq_f64(ax, vdupq_n_f64(VECTINY)), vdupq_n_f64(0), ax);
+        t = vbslq_f64(big, vmulq_f64(vsubq_f64(one, ax), vdupq_n_f64(0.5)), vmulq_f64(t, t));
+
+        p = neonPoly(vdupq_n_f64(PS5), t, PS4);
+        p = neonPoly(p, t, PS3);
+        p = neonPoly(p, t, PS2);
+        p = neonPoly(p, t, PS1);
+        p = vmulq_f64(t, neonPoly(p, t, PS0));
+        q = neonPoly(vdupq_n_f64(QS4), t, QS3);
+        q = neonPoly(q, t, QS2);
+        q = neonPoly(q, t, QS1);
+        q = vaddq_f64(one, vmulq_f64(t, q));
+        w = vdivq_f64(p, q);
+
+        s = vsqrtq_f64(t);
+        s = vaddq_f64(s, vmulq_f64(s, w));
+        v = vsubq_f64(vdupq_n_f64(PIO2_HI), vsubq_f64(vmulq_f64(vdupq_n_f64(2.0), s), vdupq_n_f64(PIO2_LO)));
+        v = vbslq_f64(big, v, vaddq_f64(ax, vmulq_f64(ax, w)));
+        vst1q_f64(r + k, vbslq_f64(vdupq_n_u64(0x8000000000000000ULL), vx, v));
+    }
+    for ( ; k < n; k++)
+        r[k] = asin1(x[k]);
+
+    return;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// vecsincos    Sine and cosine of x[0..n-1]
+
+void vecsincos(const double *x, double *sn, double *cs, int n)
+{
+    int k;
+
+    switch (simdlevel())
+    {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+        sincosAVX2(x, sn, cs, n);
+        break;
+#endif
+#if defined(SIMD_X86) && defined(__SSE2__)
+    case SIMD_SSE2:
+        sincosSSE2(x, sn, cs, n);
+        break;
+#endif
+#ifdef VEC_NEON
+    case SIMD_NEON:
+        sincosNEON(x, sn, cs, n);
+        break;
+#endif
+    default:
+        for (k = 0; k < n; k++)
+            sincos1(x[k], sn + k, cs + k);
+        break;
+    }
+
+    return;
+}
+
+// vecatan2     Arc tangent of y[k] / x[k] in the quadrant of (x, y)
+
+void vecatan2(const double *y, const double *x, double *r, int n)
+{
+    int k;
+
+    switch (simdlevel())
+    {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+        atan2AVX2(y, x, r, n);
+        break;
+#endif
+#if defined(SIMD_X86) && defined(__SSE2__)
+    case SIMD_SSE2:
+        atan2SSE2(y, x, r, n);
+        break;
+#endif
+#ifdef VEC_NEON
+    case SIMD_NEON:
+        atan2NEON(y, x, r, n);
+        break;
+#endif
+    default:
+        for (k = 0; k < n; k++)
+            r[k] = atan21(y[k], x[k]);
+        break;
+    }
+
+    return;
+}
+
+// vecasin      Arc sine of x[0..n-1]
+
+void vecasin(const double *x, double *r, int n)
+{
+    int k;
+
+    switch (simdlevel())
+    {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+        asinAVX2(x, r, n);
+        break;
+#endif
+#if defined(SIMD_X86) && defined(__SSE2__)
+    case SIMD_SSE2:
+        asinSSE2(x, r, n);
+        break;
+#endif
+#ifdef VEC_NEON
+    case SIMD_NEON:
+        asinNEON(x, r, n);
+        break;
+#endif
+    default:
+        for (k = 0; k < n; k++)
+            r[k] = asin1(x[k]);
+        break;
+    }
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+#ifdef VECMATH_TEST_PROGRAM
+
+// cc -O2 -DVECMATH_TEST_PROGRAM -IInclude Lib/VecMath.c -lm
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define NTEST   (1 << 16)
+
+static double vx[NTEST], vy[NTEST], rs[NTEST], rc[NTEST], ref[3][NTEST];
+static volatile double sink;
+
+// ulps         Error of r in units in the last place of the exact value
+
+static double ulps(double r, long double exact)
+{
+    int e;
+
+    if ((double)exact == 0)
+        return (r == 0) ? 0 : 1e9;
+    frexp((double)exact, &e);
+    return fabsl(r - exact) / ldexp(1.0, e - 53);
+}
+
+static double secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Worst errors over angles up to +-1000 radians, all directions and
+// [-1, 1], every level against long double libm and the scalar code
+
+int main(void)
+{
+    double es, ec, ea, eb, t0, tVec, tLib;
+    int level, best, k, rep, bad = 0;
+
+    srand(1);
+    for (k = 0; k < NTEST; k++)
+    {
+        vx[k] = (rand() / (double)RAND_MAX - 0.5) * ((k & 1) ? 8.0 : 2000.0);
+        vy[k] = (rand() / (double)RAND_MAX - 0.5) * ((k & 2) ? 1e-6 : 2.0);
+    }
+
+    best = simdlevel();
+    for (level = SIMD_SCALAR; level <= best; level++)
+    {
+        simdforce(level);
+        if (simdlevel() != level)
+            continue;
+#ifndef SIMD_X86
+        if ((level == SIMD_SSE2) || (level == SIMD_AVX2))
+            continue;
+#endif
+#ifndef VEC_NEON
+        if (level == SIMD_NEON)
+            continue;
+#endif
+
+        es = ec = ea = eb = 0;
+        vecsincos(vx, rs, rc, NTEST);
+        for (k = 0; k < NTEST; k++)
+        {
+            es = max(es, ulps(rs[k], sinl(vx[k])));
+            ec = max(ec, ulps(rc[k], cosl(vx[k])));
+        }
+        if (level == SIMD_SCALAR)
+        {
+            memcpy(ref[0], rs, sizeof(rs));
+            memcpy(ref[1], rc, sizeof(rc));
+        } else
+            bad += (memcmp(ref[0], rs, sizeof(rs)) != 0) || (memcmp(ref[1], rc, sizeof(rc)) != 0);
+
+        vecatan2(vy, vx, rs, NTEST);
+        for (k = 0; k < NTEST; k++)
+            ea = max(ea, ulps(rs[k], atan2l(vy[k], vx[k])));
+        if (level == SIMD_SCALAR)
+            memcpy(ref[2], rs, sizeof(rs));
+        else
+            bad += (memcmp(ref[2], rs, sizeof(rs)) != 0);
+
+        for (k = 0; k < NTEST; k++)
+            rc[k] = remainder(vx[k], 2.0) / ((k & 4) ? 1.0 : 1e4);
+        vecasin(rc, rs, NTEST);
+        for (k = 0; k < NTEST; k++)
+            eb = max(eb, ulps(rs[k], asinl(rc[k])));
+
+        // Batches of 64, as the astronomy code makes them
+        t0 = secs();
+        for (rep = 0; rep < 100; rep++)
+            for (k = 0; k + 64 <= NTEST; k += 64)
+                vecsincos(vx + k, rs + k, rc + k, 64);
+        tVec = secs() - t0;
+        t0 = secs();
+        for (rep = 0; rep < 100; rep++)
+            for (k = 0; k < NTEST; k++)
+                sink += sin(vx[k]) + cos(vx[k]);
+        tLib = secs() - t0;
+
+        printf("%-6s  ulp: sin %.2f cos %.2f atan2 %.2f asin %.2f   sincos %.1f ns (libm %.1f ns)\n",
+               simdname(level), es, ec, ea, eb, tVec / (100.0 * NTEST) * 1e9, tLib / (100.0 * NTEST) * 1e9);
+        bad += (es > 2) || (ec > 2) || (ea > 2) || (eb > 2.5);
+    }
+    if (bad)
+        printf("%d failures (errors over bound or levels differing)\n", bad);
+
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
@@ -8,75 +8,860 @@
 
 */
 
+#include <stdio.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
 #include "SkyPi.h"
+#include "VecMath.h"
 
 #include "PlanetTerms.inc"
 
+/*  The series kernels must round B + C * tau as the scalar code does
+    (see below), so no a * b + c is contracted into a fused multiply-add,
+    whatever flags the file is built with.  */
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
 #define Kappa	(20.49552 / 3600.0)
 #define astor(x) ((x) * (PI / (180.0 * 3600.0)))   /* Arc second->Radian */
 
-static int quickPlanetCalc;					// Shortcut planet calculation ?
+/*  The old API works on one context with planet_info as its table; each
+    caller of the context API has its own.  */
+
+static struct ephContext legacyCtx = { FALSE, 0, 0, 0, planet_info };
+
+static void apparentPlanets(const struct ephContext *ec, double jd, const struct vsopGrid *g);
+
+/*  Series evaluation
+
+    PlanetTerms.inc interleaves the amplitude A, phase B and frequency C of
+    each term. On first use every series is copied into separate A, B and
+    C arrays, so a vector kernel loads several terms at once, and summed
+    with a branch-free cosine on AVX2, SSE2 or NEON (AArch64) lanes into
+    independent accumulators. The argument B + C * tau is rounded as the
+    scalar code rounds it (no fused multiply-add): with C up to 2e5 a
+    different rounding alone moves a term by 1e-11 of its amplitude.
+
+    The cosine reduces its argument by pi/2 in three Cody-Waite steps
+    (exact for |x| < 2^20 pi/2, far beyond tau of +-1 millennium) and uses
+    the fdlibm kernel polynomials without their tail corrections, so it is
+    within 2 ulp of libm. Together with the changed summation order each
+    series then differs from a term-by-term libm sum by less than
+    VSOPTOLERANCE times the sum of its amplitudes (checked by the
+    VSOP_TEST_PROGRAM build of this file), some 1e-13 radians, against
+    the 1e-8 radian accuracy of VSOP87 itself.
+*/
+
+#define VSOPTOLERANCE   1e-14
+
+/*  Compact amplitudes (SKYPI_VSOP_COMPACT)
+
+    Built with the CMake option SKYPI_VSOP_COMPACT, the series read their
+    amplitudes as float, 20 bytes a term instead of 24, which keeps more
+    of the full series in the small caches of a Cortex-A53. Phases and
+    frequencies stay double: the argument B + C * tau needs all of its
+    bits. Each series keeps its leading terms in double up to nHead, so
+    that the float rounding of the rest, at most 2^-24 of their amplitude
+    sum, is within VSOPCOMPACTTOL (1e-10 radian or AU, a hundredth of the
+    accuracy of VSOP87). The grids, which sum every term once per epoch
+    and then only rotate, keep using the double amplitudes.
+*/
+
+#define VSOPCOMPACTTOL  1e-10
+
+struct vsopSeries {
+    int     n;
+    double  *a, *b, *c;                 // Amplitude, phase, frequency
+    double  *tail;                      // Sum of |a| from term k on (n + 1)
+#ifdef SKYPI_VSOP_COMPACT
+    int     nHead;                      // Leading terms summed from a
+    float   *af;                        // Amplitudes as float
+#endif
+};
+
+typedef double (*vsopKernel)(const double *a, const double *b, const double *c, int n, double tau);
+
+static struct vsopSeries vsopSeries[7][18];
+static vsopKernel seriesSum;
+
+#ifdef SKYPI_VSOP_COMPACT
+typedef double (*vsopKernelF)(const float *a, const double *b, const double *c, int n, double tau);
+
+static vsopKernelF seriesSumF;
+#endif
+
+typedef void (*gridKernel)(const double *a, const double *c, double *cs, double *sn,
+                           const double *cd, const double *sd, int n, double t[3]);
+
+static gridKernel gridSeries;
+static pthread_once_t vsopOnce = PTHREAD_ONCE_INIT;
+
+//-------------------------------------------------------------------------------
+// Scalar kernel (4 accumulators)
+
+static inline double vsopCos(double x)
+{
+    double q, s, z, r;
+    int64_t iq;
+
+    q = (x * TWOOPI + VECMAGIC) - VECMAGIC;
+    iq = (int64_t)q;
+    s = ((x - q * PIO2_1) - q * PIO2_2) - q * PIO2_3;
+    z = s * s;
+    if (iq & 1)
+        r = s + s * z * (SIN1 + z * (SIN2 + z * (SIN3 + z * (SIN4 + z * (SIN5 + z * SIN6)))));
+    else
+        r = 1.0 - 0.5 * z + z * z * (COS1 + z * (COS2 + z * (COS3 + z * (COS4 + z * (COS5 + z * COS6)))));
+
+    return ((iq + 1) & 2) ? -r : r;
+}
+
+static double seriesScalar(const double *a, const double *b, const double *c, int n, double tau)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        s0 += a[k] * vsopCos(b[k] + c[k] * tau);
+        s1 += a[k + 1] * vsopCos(b[k + 1] + c[k + 1] * tau);
+        s2 += a[k + 2] * vsopCos(b[k + 2] + c[k + 2] * tau);
+        s3 += a[k + 3] * vsopCos(b[k + 3] + c[k + 3] * tau);
+    }
+    for ( ; k < n; k++)
+        s0 += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+//-------------------------------------------------------------------------------
+// SSE2 kernel (2 terms per vector, 2 accumulators)
+
+#if defined(SIMD_X86) && defined(__SSE2__)
+static inline __m128d sse2Cos(__m128d x)
+{
+    __m128d q, qm, s, z, sn, cs, swap;
+    __m128i bits, one = _mm_set1_epi64x(1);
+
+    qm = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(TWOOPI)), _mm_set1_pd(VECMAGIC));
+    q = _mm_sub_pd(qm, _mm_set1_pd(VECMAGIC));
+    bits = _mm_castpd_si128(qm);
+    s = _mm_sub_pd(x, _mm_mul_pd(q, _mm_set1_pd(PIO2_1)));
+    s = _mm_sub_pd(s, _mm_mul_pd(q, _mm_set1_pd(PIO2_2)));
+    s = _mm_sub_pd(s, _mm_mul_pd(q, _mm_set1_pd(PIO2_3)));
+    z = _mm_mul_pd(s, s);
+
+    sn = _mm_set1_pd(SIN6);
+    sn = _mm_add_pd(_mm_mul_pd(sn, z), _mm_set1_pd(SIN5));
+    sn = _mm_add_pd(_mm_mul_pd(sn, z), _mm_set1_pd(SIN4));
+    sn = _mm_add_pd(_mm_mul_pd(sn, z), _mm_set1_pd(SIN3));
+    sn = _mm_add_pd(_mm_mul_pd(sn, z), _mm_set1_pd(SIN2));
+    sn = _mm_add_pd(_mm_mul_pd(sn, z), _mm_set1_pd(SIN1));
+    sn = _mm_add_pd(s, _mm_mul_pd(_mm_mul_pd(s, z), sn));
+
+    cs = _mm_set1_pd(COS6);
+    cs = _mm_add_pd(_mm_mul_pd(cs, z), _mm_set1_pd(COS5));
+    cs = _mm_add_pd(_mm_mul_pd(cs, z), _mm_set1_pd(COS4));
+    cs = _mm_add_pd(_mm_mul_pd(cs, z), _mm_set1_pd(COS3));
+    cs = _mm_add_pd(_mm_mul_pd(cs, z), _mm_set1_pd(COS2));
+    cs = _mm_add_pd(_mm_mul_pd(cs, z), _mm_set1_pd(COS1));
+    cs = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), z)),
+                    _mm_mul_pd(_mm_mul_pd(z, z), cs));
+
+    // Odd quadrants take the sine, quadrants 1 and 2 are negative
+    swap = _mm_castsi128_pd(_mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(bits, one)));
+    cs = _mm_or_pd(_mm_and_pd(swap, sn), _mm_andnot_pd(swap, cs));
+    bits = _mm_slli_epi64(_mm_and_si128(_mm_add_epi64(bits, one), _mm_set1_epi64x(2)), 62);
+
+    return _mm_xor_pd(cs, _mm_castsi128_pd(bits));
+}
+
+static double seriesSSE2(const double *a, const double *b, const double *c, int n, double tau)
+{
+    __m128d t = _mm_set1_pd(tau), s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    double sum[2], r;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + k),
+                        sse2Cos(_mm_add_pd(_mm_loadu_pd(b + k), _mm_mul_pd(_mm_loadu_pd(c + k), t)))));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + k + 2),
+                        sse2Cos(_mm_add_pd(_mm_loadu_pd(b + k + 2), _mm_mul_pd(_mm_loadu_pd(c + k + 2), t)))));
+    }
+    _mm_storeu_pd(sum, _mm_add_pd(s0, s1));
+    r = sum[0] + sum[1];
+    for ( ; k < n; k++)
+        r += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return r;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// AVX2 kernel (4 terms per vector, 2 accumulators)
+
+#ifdef SIMD_X86
+TARGET_AVX2
+static inline __m256d avx2Cos(__m256d x)
+{
+    __m256d q, qm, s, z, sn, cs, swap;
+    __m256i bits, one = _mm256_set1_epi64x(1);
+
+    qm = _mm256_fmadd_pd(x, _mm256_set1_pd(TWOOPI), _mm256_set1_pd(VECMAGIC));
+    q = _mm256_sub_pd(qm, _mm256_set1_pd(VECMAGIC));
+    bits = _mm256_castpd_si256(qm);
+    s = _mm256_fnmadd_pd(q, _mm256_set1_pd(PIO2_1), x);
+    s = _mm256_fnmadd_pd(q, _mm256_set1_pd(PIO2_2), s);
+    s = _mm256_fnmadd_pd(q, _mm256_set1_pd(PIO2_3), s);
+    z = _mm256_mul_pd(s, s);
+
+    sn = _mm256_fmadd_pd(_mm256_set1_pd(SIN6), z, _mm256_set1_pd(SIN5));
+    sn = _mm256_fmadd_pd(sn, z, _mm256_set1_pd(SIN4));
+    sn = _mm256_fmadd_pd(sn, z, _mm256_set1_pd(SIN3));
+    sn = _mm256_fmadd_pd(sn, z, _mm256_set1_pd(SIN2));
+    sn = _mm256_fmadd_pd(sn, z, _mm256_set1_pd(SIN1));
+    sn = _mm256_fmadd_pd(_mm256_mul_pd(s, z), sn, s);
+
+    cs = _mm256_fmadd_pd(_mm256_set1_pd(COS6), z, _mm256_set1_pd(COS5));
+    cs = _mm256_fmadd_pd(cs, z, _mm256_set1_pd(COS4));
+    cs = _mm256_fmadd_pd(cs, z, _mm256_set1_pd(COS3));
+    cs = _mm256_fmadd_pd(cs, z, _mm256_set1_pd(COS2));
+    cs = _mm256_fmadd_pd(cs, z, _mm256_set1_pd(COS1));
+    cs = _mm256_fmadd_pd(_mm256_mul_pd(z, z), cs, _mm256_fnmadd_pd(_mm256_set1_pd(0.5), z, _mm256_set1_pd(1.0)));
+
+    // Odd quadrants take the sine, quadrants 1 and 2 are negative
+    swap = _mm256_castsi256_pd(_mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(bits, one)));
+    cs = _mm256_blendv_pd(cs, sn, swap);
+    bits = _mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(bits, one), _mm256_set1_epi64x(2)), 62);
+
+    return _mm256_xor_pd(cs, _mm256_castsi256_pd(bits));
+}
+
+TARGET_AVX2
+static double seriesAVX2(const double *a, const double *b, const double *c, int n, double tau)
+{
+    __m256d t = _mm256_set1_pd(tau), s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    double sum[4], r;
+    int k;
+
+    for (k = 0; k + 8 <= n; k += 8)
+    {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k),
+                             avx2Cos(_mm256_add_pd(_mm256_loadu_pd(b + k), _mm256_mul_pd(_mm256_loadu_pd(c + k), t))), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k + 4),
+                             avx2Cos(_mm256_add_pd(_mm256_loadu_pd(b + k + 4), _mm256_mul_pd(_mm256_loadu_pd(c + k + 4), t))), s1);
+    }
+    if (k + 4 <= n)
+    {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k),
+                             avx2Cos(_mm256_add_pd(_mm256_loadu_pd(b + k), _mm256_mul_pd(_mm256_loadu_pd(c + k), t))), s0);
+        k += 4;
+    }
+    _mm256_storeu_pd(sum, _mm256_add_pd(s0, s1));
+    r = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    for ( ; k < n; k++)
+        r += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return r;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// NEON kernel (2 terms per vector, 2 accumulators, AArch64 only)
+
+#if defined(SIMD_NEON) && defined(__aarch64__)
+#define VSOP_NEON
+
+static inline float64x2_t neonCos(float64x2_t x)
+{
+    float64x2_t q, s, z, sn, cs;
+    int64x2_t iq;
+    uint64x2_t sign;
+
+    q = vrndnq_f64(vmulq_n_f64(x, TWOOPI));
+    iq = vcvtq_s64_f64(q);
+    s = vfmsq_f64(x, q, vdupq_n_f64(PIO2_1));
+    s = vfmsq_f64(s, q, vdupq_n_f64(PIO2_2));
+    s = vfmsq_f64(s, q, vdupq_n_f64(PIO2_3));
+    z = vmulq_f64(s, s);
+
+    sn = vfmaq_f64(vdupq_n_f64(SIN5), z, vdupq_n_f64(SIN6));
+    sn = vfmaq_f64(vdupq_n_f64(SIN4), z, sn);
+    sn = vfmaq_f64(vdupq_n_f64(SIN3), z, sn);
+    sn = vfmaq_f64(vdupq_n_f64(SIN2), z, sn);
+    sn = vfmaq_f64(vdupq_n_f64(SIN1), z, sn);
+    sn = vfmaq_f64(s, vmulq_f64(s, z), sn);
+
+    cs = vfmaq_f64(vdupq_n_f64(COS5), z, vdupq_n_f64(COS6));
+    cs = vfmaq_f64(vdupq_n_f64(COS4), z, cs);
+    cs = vfmaq_f64(vdupq_n_f64(COS3), z, cs);
+    cs = vfmaq_f64(vdupq_n_f64(COS2), z, cs);
+    cs = vfmaq_f64(vdupq_n_f64(COS1), z, cs);
+    cs = vfmaq_f64(vfmsq_f64(vdupq_n_f64(1.0), vdupq_n_f64(0.5), z), vmulq_f64(z, z), cs);
+
+    // Odd quadrants take the sine, quadrants 1 and 2 are negative
+    cs = vbslq_f64(vtstq_s64(iq, vdupq_n_s64(1)), sn, cs);
+    sign = vshlq_n_u64(vandq_u64(vreinterpretq_u64_s64(vaddq_s64(iq, vdupq_n_s64(1))), vdupq_n_u64(2)), 62);
+
+    return vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(cs), sign));
+}
+
+static double seriesNEON(const double *a, const double *b, const double *c, int n, double tau)
+{
+    float64x2_t s0 = vdupq_n_f64(0), s1 = vdupq_n_f64(0);
+    double r;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        s0 = vfmaq_f64(s0, vld1q_f64(a + k), neonCos(vaddq_f64(vld1q_f64(b + k), vmulq_n_f64(vld1q_f64(c + k), tau))));
+        s1 = vfmaq_f64(s1, vld1q_f64(a + k + 2), neonCos(vaddq_f64(vld1q_f64(b + k + 2), vmulq_n_f64(vld1q_f64(c + k + 2), tau))));
+    }
+    r = vaddvq_f64(vaddq_f64(s0, s1));
+    for ( ; k < n; k++)
+        r += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return r;
+}
+#endif
+
+#ifdef SKYPI_VSOP_COMPACT
+//-------------------------------------------------------------------------------
+// Compact kernels: the series kernels above with float amplitudes
+
+static double seriesScalarF(const float *a, const double *b, const double *c, int n, double tau)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        s0 += a[k] * vsopCos(b[k] + c[k] * tau);
+        s1 += a[k + 1] * vsopCos(b[k + 1] + c[k + 1] * tau);
+        s2 += a[k + 2] * vsopCos(b[k + 2] + c[k + 2] * tau);
+        s3 += a[k + 3] * vsopCos(b[k + 3] + c[k + 3] * tau);
+    }
+    for ( ; k < n; k++)
+        s0 += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+#if defined(SIMD_X86) && defined(__SSE2__)
+#define sse2LoadF(p)    _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(p))))
+
+static double seriesSSE2F(const float *a, const double *b, const double *c, int n, double tau)
+{
+    __m128d t = _mm_set1_pd(tau), s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    double sum[2], r;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(sse2LoadF(a + k),
+                        sse2Cos(_mm_add_pd(_mm_loadu_pd(b + k), _mm_mul_pd(_mm_loadu_pd(c + k), t)))));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(sse2LoadF(a + k + 2),
+                        sse2Cos(_mm_add_pd(_mm_loadu_pd(b + k + 2), _mm_mul_pd(_mm_loadu_pd(c + k + 2), t)))));
+    }
+    _mm_storeu_pd(sum, _mm_add_pd(s0, s1));
+    r = sum[0] + sum[1];
+    for ( ; k < n; k++)
+        r += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return r;
+}
+#endif
+
+#ifdef SIMD_X86
+TARGET_AVX2
+static double seriesAVX2F(const float *a, const double *b, const double *c, int n, double tau)
+{
+    __m256d t = _mm256_set1_pd(tau), s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    double sum[4], r;
+    int k;
+
+    for (k = 0; k + 8 <= n; k += 8)
+    {
+        s0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + k)),
+                             avx2Cos(_mm256_add_pd(_mm256_loadu_pd(b + k), _mm256_mul_pd(_mm256_loadu_pd(c + k), t))), s0);
+        s1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + k + 4)),
+                             avx2Cos(_mm256_add_pd(_mm256_loadu_pd(b + k + 4), _mm256_mul_pd(_mm256_loadu_pd(c + k + 4), t))), s1);
+    }
+    if (k + 4 <= n)
+    {
+        s0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + k)),
+                             avx2Cos(_mm256_add_pd(_mm256_loadu_pd(b + k), _mm256_mul_pd(_mm256_loadu_pd(c + k), t))), s0);
+        k += 4;
+    }
+    _mm256_storeu_pd(sum, _mm256_add_pd(s0, s1));
+    r = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    for ( ; k < n; k++)
+        r += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return r;
+}
+#endif
+
+#ifdef VSOP_NEON
+static double seriesNEONF(const float *a, const double *b, const double *c, int n, double tau)
+{
+    float64x2_t s0 = vdupq_n_f64(0), s1 = vdupq_n_f64(0);
+    double r;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        s0 = vfmaq_f64(s0, vcvt_f64_f32(vld1_f32(a + k)),
+                       neonCos(vaddq_f64(vld1q_f64(b + k), vmulq_n_f64(vld1q_f64(c + k), tau))));
+        s1 = vfmaq_f64(s1, vcvt_f64_f32(vld1_f32(a + k + 2)),
+                       neonCos(vaddq_f64(vld1q_f64(b + k + 2), vmulq_n_f64(vld1q_f64(c + k + 2), tau))));
+    }
+    r = vaddvq_f64(vaddq_f64(s0, s1));
+    for ( ; k < n; k++)
+        r += a[k] * vsopCos(b[k] + c[k] * tau);
+
+    return r;
+}
+#endif
+#endif
+
+//-------------------------------------------------------------------------------
+// Grid kernels (see Uniform time grids below): sum a series and its first
+// two derivatives from the cosine and sine of each term, then rotate them
+// a step on. The rotation is rounded alike at every level.
+
+static void gridScalar(const double *a, const double *c, double *cs, double *sn,
+                       const double *cd, const double *sd, int n, double t[3])
+{
+    double x0 = 0, x1 = 0, x2 = 0, ac, co, si;
+    int k;
+
+    for (k = 0; k < n; k++)
+    {
+        co = cs[k];
+        si = sn[k];
+        ac = a[k] * c[k];
+        x0 += a[k] * co;
+        x1 += ac * si;
+        x2 += ac * c[k] * co;
+        cs[k] = co * cd[k] - si * sd[k];
+        sn[k] = si * cd[k] + co * sd[k];
+    }
+
+    t[0] = x0;
+    t[1] = -x1;
+    t[2] = -x2;
+
+    return;
+}
+
+#if defined(SIMD_X86) && defined(__SSE2__)
+static void gridSSE2(const double *a, const double *c, double *cs, double *sn,
+                     const double *cd, const double *sd, int n, double t[3])
+{
+    __m128d x0 = _mm_setzero_pd(), x1 = _mm_setzero_pd(), x2 = _mm_setzero_pd();
+    __m128d va, vc, ac, co, si, vcd, vsd;
+    double s[3][2], r[3];
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        va = _mm_loadu_pd(a + k);
+        vc = _mm_loadu_pd(c + k);
+        co = _mm_loadu_pd(cs + k);
+        si = _mm_loadu_pd(sn + k);
+        vcd = _mm_loadu_pd(cd + k);
+        vsd = _mm_loadu_pd(sd + k);
+        ac = _mm_mul_pd(va, vc);
+        x0 = _mm_add_pd(x0, _mm_mul_pd(va, co));
+        x1 = _mm_add_pd(x1, _mm_mul_pd(ac, si));
+        x2 = _mm_add_pd(x2, _mm_mul_pd(_mm_mul_pd(ac, vc), co));
+        _mm_storeu_pd(cs + k, _mm_sub_pd(_mm_mul_pd(co, vcd), _mm_mul_pd(si, vsd)));
+        _mm_storeu_pd(sn + k, _mm_add_pd(_mm_mul_pd(si, vcd), _mm_mul_pd(co, vsd)));
+    }
+    _mm_storeu_pd(s[0], x0);
+    _mm_storeu_pd(s[1], x1);
+    _mm_storeu_pd(s[2], x2);
+    gridScalar(a + k, c + k, cs + k, sn + k, cd + k, sd + k, n - k, r);
+
+    t[0] = s[0][0] + s[0][1] + r[0];
+    t[1] = -(s[1][0] + s[1][1]) + r[1];
+    t[2] = -(s[2][0] + s[2][1]) + r[2];
+
+    return;
+}
+#endif
+
+#ifdef SIMD_X86
+TARGET_AVX2
+static void gridAVX2(const double *a, const double *c, double *cs, double *sn,
+                     const double *cd, const double *sd, int n, double t[3])
+{
+    __m256d x0 = _mm256_setzero_pd(), x1 = _mm256_setzero_pd(), x2 = _mm256_setzero_pd();
+    __m256d va, vc, ac, co, si, vcd, vsd;
+    double s[3][4], ac1, co1, si1;
+    int k;
+
+    for (k = 0; k + 4 <= n; k += 4)
+    {
+        va = _mm256_loadu_pd(a + k);
+        vc = _mm256_loadu_pd(c + k);
+        co = _mm256_loadu_pd(cs + k);
+        si = _mm256_loadu_pd(sn + k);
+        vcd = _mm256_loadu_pd(cd + k);
+        vsd = _mm256_loadu_pd(sd + k);
+        ac = _mm256_mul_pd(va, vc);
+        x0 = _mm256_fmadd_pd(va, co, x0);
+        x1 = _mm256_fmadd_pd(ac, si, x1);
+        x2 = _mm256_fmadd_pd(_mm256_mul_pd(ac, vc), co, x2);
+        _mm256_storeu_pd(cs + k, _mm256_sub_pd(_mm256_mul_pd(co, vcd), _mm256_mul_pd(si, vsd)));
+        _mm256_storeu_pd(sn + k, _mm256_add_pd(_mm256_mul_pd(si, vcd), _mm256_mul_pd(co, vsd)));
+    }
+    _mm256_storeu_pd(s[0], x0);
+    _mm256_storeu_pd(s[1], x1);
+    _mm256_storeu_pd(s[2], x2);
+    t[0] = (s[0][0] + s[0][1]) + (s[0][2] + s[0][3]);
+    t[1] = -((s[1][0] + s[1][1]) + (s[1][2] + s[1][3]));
+    t[2] = -((s[2][0] + s[2][1]) + (s[2][2] + s[2][3]));
+
+    for ( ; k < n; k++)
+    {
+        co1 = cs[k];
+        si1 = sn[k];
+        ac1 = a[k] * c[k];
+        t[0] += a[k] * co1;
+        t[1] -= ac1 * si1;
+        t[2] -= ac1 * c[k] * co1;
+        cs[k] = co1 * cd[k] - si1 * sd[k];
+        sn[k] = si1 * cd[k] + co1 * sd[k];
+    }
+
+    return;
+}
+#endif
+
+#ifdef VSOP_NEON
+static void gridNEON(const double *a, const double *c, double *cs, double *sn,
+                     const double *cd, const double *sd, int n, double t[3])
+{
+    float64x2_t x0 = vdupq_n_f64(0), x1 = vdupq_n_f64(0), x2 = vdupq_n_f64(0);
+    float64x2_t va, vc, ac, co, si, vcd, vsd;
+    double r[3];
+    int k;
+
+    for (k = 0; k + 2 <= n; k += 2)
+    {
+        va = vld1q_f64(a + k);
+        vc = vld1q_f64(c + k);
+        co = vld1q_f64(cs + k);
+        si = vld1q_f64(sn + k);
+        vcd = vld1q_f64(cd + k);
+        vsd = vld1q_f64(sd + k);
+        ac = vmulq_f64(va, vc);
+        x0 = vfmaq_f64(x0, va, co);
+        x1 = vfmaq_f64(x1, ac, si);
+        x2 = vfmaq_f64(x2, vmulq_f64(ac, vc), co);
+        vst1q_f64(cs + k, vsubq_f64(vmulq_f64(co, vcd), vmulq_f64(si, vsd)));
+        vst1q_f64(sn + k, vaddq_f64(vmulq_f64(si, vcd), vmulq_f64(co, vsd)));
+    }
+    gridScalar(a + k, c + k, cs + k, sn + k, cd + k, sd + k, n - k, r);
+
+    t[0] = vaddvq_f64(x0) + r[0];
+    t[1] = -vaddvq_f64(x1) + r[1];
+    t[2] = -vaddvq_f64(x2) + r[2];
+
+    return;
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// vsopInit     Split the term tables into amplitude, phase and frequency
+//              arrays and pick the series kernel
+
+static void vsopInit(void)
+{
+    struct pTerms *pt;
+    struct vsopSeries *vs;
+    double *block;
+#ifdef SKYPI_VSOP_COMPACT
+    float *floats;
+#endif
+    int i, j, k, total;
+
+    for (i = 1, total = 0; i <= 6; i++)
+    {
+        for (j = 0; j < 18; j++)
+            total += planetTerms[i][j].termCount;
+    }
+    block = malloc((4 * total + 6 * 18) * sizeof(double));
+#ifdef SKYPI_VSOP_COMPACT
+    floats = malloc(total * sizeof(float));
+    if (floats == NULL)
+        block = NULL;
+#endif
+    if (block == NULL)
+    {
+        printf("Out of memory for planet terms\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 1; i <= 6; i++)
+    {
+        for (j = 0; j < 18; j++)
+        {
+            pt = &planetTerms[i][j];
+            vs = &vsopSeries[i][j];
+            vs->n = pt->termCount;
+            vs->a = block;
+            vs->b = block + vs->n;
+            vs->c = block + 2 * vs->n;
+            vs->tail = block + 3 * vs->n;
+            block += 4 * vs->n + 1;
+            for (k = 0; k < vs->n; k++)
+            {
+                vs->a[k] = pt->termArray[3 * k];
+                vs->b[k] = pt->termArray[3 * k + 1];
+                vs->c[k] = pt->termArray[3 * k + 2];
+            }
+            vs->tail[vs->n] = 0;
+            for (k = vs->n - 1; k >= 0; k--)
+                vs->tail[k] = vs->tail[k + 1] + fabs(vs->a[k]);
+#ifdef SKYPI_VSOP_COMPACT
+            vs->af = floats;
+            floats += vs->n;
+            for (k = 0; k < vs->n; k++)
+                vs->af[k] = vs->a[k];
+            for (vs->nHead = 0; vs->tail[vs->nHead] * FLT_EPSILON / 2 > VSOPCOMPACTTOL; vs->nHead++)
+                ;
+#endif
+        }
+    }
+
+    switch (simdlevel())
+    {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+        seriesSum = seriesAVX2;
+#ifdef SKYPI_VSOP_COMPACT
+        seriesSumF = seriesAVX2F;
+#endif
+        gridSeries = gridAVX2;
+        break;
+#endif
+#if defined(SIMD_X86) && defined(__SSE2__)
+    case SIMD_SSE2:
+        seriesSum = seriesSSE2;
+#ifdef SKYPI_VSOP_COMPACT
+        seriesSumF = seriesSSE2F;
+#endif
+        gridSeries = gridSSE2;
+        break;
+#endif
+#ifdef VSOP_NEON
+    case SIMD_NEON:
+        seriesSum = seriesNEON;
+#ifdef SKYPI_VSOP_COMPACT
+        seriesSumF = seriesNEONF;
+#endif
+        gridSeries = gridNEON;
+        break;
+#endif
+    default:
+        seriesSum = seriesScalar;
+#ifdef SKYPI_VSOP_COMPACT
+        seriesSumF = seriesScalarF;
+#endif
+        gridSeries = gridScalar;
+        break;
+    }
+
+    return;
+}
+
+/*  EPHCONTEXTINIT  --  Set up a context computing into pi[7] for the given
+						series and site.  */
+
+void ephContextInit(struct ephContext *ec, struct planet *pi, int qPC, double siteLat, double siteLon)
+{
+	ec->qPC = qPC;
+	ec->prec = 0;
+	ec->siteLat = siteLat;
+	ec->siteLon = siteLon;
+	ec->pi = pi;
+}
 
 /*  CALCPLANET  --  Calculate planetary positions and altitude and azimuth from
 					viewer's position.  */
 
 void calcPlanets(double jd, double siteLat, double siteLon, int qPC)
 {
+	ephContextInit(&legacyCtx, planet_info, qPC, siteLat, siteLon);
+	calcPlanetsCtx(&legacyCtx, jd);
+}
+
+void calcPlanetsCtx(const struct ephContext *ec, double jd)
+{
+	planetsCtx(ec, jd);
+	horizPlanetsCtx(ec, jd);
+}
+
+/*  HORIZPLANETS  --  Local hour angle, altitude and azimuth of the
+					  positions in planet_info.  */
+
+void horizPlanets(double jd, double siteLat, double siteLon)
+{
+	legacyCtx.siteLat = siteLat;
+	legacyCtx.siteLon = siteLon;
+	horizPlanetsCtx(&legacyCtx, jd);
+}
+
+void horizPlanetsCtx(const struct ephContext *ec, double jd)
+{
+	struct planet *pi = ec->pi;
 	int i;
-	double igmst, latsin, latcos;
+	double lst, m[3][3], ang[14], sn[14], cs[14], h[3][7], x, y, z;
 
-    quickPlanetCalc = qPC;
+	horizmatrix(jd, ec->siteLat, ec->siteLon, m);
+	lst = dtr(epochGmst(jd) * 15) + ec->siteLon;
 
-	planets(jd);
-	igmst = gmst(jd);
-	latsin = sin(siteLat);
-	latcos = cos(siteLat);
+	/* As EQTOHORIZ and HORIZAZALT, a batch of seven */
+
+	for (i = 0; i <= 6; i++) {
+		pi[i].lha = fixangr(lst - pi[i].ra);
+		ang[i] = pi[i].ra;
+		ang[7 + i] = pi[i].dec;
+	}
+	vecsincos(ang, sn, cs, 14);
+	for (i = 0; i <= 6; i++) {
+		x = cs[7 + i] * cs[i];
+		y = cs[7 + i] * sn[i];
+		z = sn[7 + i];
+		h[0][i] = m[0][0] * x + m[0][1] * y + m[0][2] * z;
+		h[1][i] = m[1][0] * x + m[1][1] * y + m[1][2] * z;
+		h[2][i] = max(-1.0, min(1.0, m[2][0] * x + m[2][1] * y + m[2][2] * z));
+	}
+	vecatan2(h[1], h[0], ang, 7);
+	vecasin(h[2], ang + 7, 7);
 	for (i = 0; i <= 6; i++) {
-		planet_info[i].lha = fixangr(dtr(igmst * 15) + siteLon - planet_info[i].ra);
-		planet_info[i].az = atan2(sin(planet_info[i].lha),
-                                  cos(planet_info[i].lha) * latsin - tan(planet_info[i].dec) * latcos);
-		planet_info[i].alt = asin(latsin * sin(planet_info[i].dec) +
-								  latcos * cos(planet_info[i].dec) * cos(planet_info[i].lha));
+		pi[i].az = ang[i];
+		pi[i].alt = ang[7 + i];
 	}
 }
 
-/*  PLANETPOS  --  Calculate position of a single planet from the
-				   terms defining it.  */
+/*  Truncation
 
-static void planetPos(int planet, double jd,
-                        double *l, double *b, double *r, double *ldyn, double *bdyn)
+    The terms of every series are stored by decreasing amplitude, so the
+    first n terms leave out at most tail[n], the sum of the remaining
+    amplitudes, and the series of power j at most tail[n] * |tau|^j. Given
+    a precision target (ephContext.prec, in arcseconds) each series takes
+    the fewest terms keeping that bound within its share of the target.
+
+    The target is split evenly over the 18 series of the planet and the 18
+    of the Earth. A longitude or latitude error dl moves the planet by up
+    to r * dl, which seen from the Earth at the least distance d is an
+    angle of r * dl / d; a radius error dr is at most dr / d. vsopReach
+    holds the greatest r and least d of each body (for the Earth the least
+    distance of any planet, as its error enters every geocentric place).
+    The bound is on the series alone, not on their error against the real
+    sky, and the grids (vsopGridOpen) always sum the full or quick series.
+*/
+
+static const double vsopReach[7][2] = {
+    { 0, 0 },
+    { 0.467, 0.50 },                    // Mercury
+    { 0.728, 0.26 },                    // Venus
+    { 1.017, 0.26 },                    // Earth
+    { 1.666, 0.37 },                    // Mars
+    { 5.46, 3.9 },                      // Jupiter
+    { 10.1, 8.0 }                       // Saturn
+};
+
+// seriesTerms  Fewest leading terms of a series leaving out no more than
+//              lim (tail is decreasing, so a binary search)
+
+static int seriesTerms(const struct vsopSeries *vs, double tn, double lim)
 {
-	int i, j, k, nterms;
-	double x, Tn;
-	double y[3];
-	double ld;
-	double tau = (jd - 2451545.0) / 365250.0;
-	struct pTerms *pt;
-	double *abc;
-	int isSun = FALSE;
+    int lo = 0, hi = vs->n, mid;
 
-    if (planet == 0) {
-        isSun = TRUE;
-        planet = 3;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (vs->tail[mid] * tn <= lim)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
-    pt = planetTerms[planet];
+
+    return lo;
+}
+
+// seriesValue  Sum of the first n terms of a series at tau
+
+static double seriesValue(const struct vsopSeries *vs, int n, double tau)
+{
+#ifdef SKYPI_VSOP_COMPACT
+    int h = min(n, vs->nHead);
+
+    if (h == 0)
+        return seriesSumF(vs->af, vs->b, vs->c, n, tau);
+    if (h == n)
+        return seriesSum(vs->a, vs->b, vs->c, n, tau);
+    return seriesSum(vs->a, vs->b, vs->c, h, tau) +
+           seriesSumF(vs->af + h, vs->b + h, vs->c + h, n - h, tau);
+#else
+    return seriesSum(vs->a, vs->b, vs->c, n, tau);
+#endif
+}
+
+/*  SERIESAT  --  Sum the longitude, latitude and radius series of a
+				  planet (3 for the Earth) at tau, to within prec radians
+				  of geocentric place if prec > 0.  */
+
+static void seriesAt(int planet, double tau, int qPC, double prec, double y[3])
+{
+	int i, j, nterms;
+	double x, Tn, share;
+	const struct vsopSeries *vs;
+
+    pthread_once(&vsopOnce, vsopInit);
+    vs = vsopSeries[planet];
     for (i = 0 ; i < 3 ; i++) {
         y[i] = 0;
         Tn = 1; /* T^0 = 1 */
-        for (j = 0 ; j < 6 ; j++) {
-            x = 0;
-            abc = pt[i * 6 + j].termArray;
-            nterms = pt[i * 6 + j].termCount;
-            if (quickPlanetCalc) {
+        share = prec / 36 * vsopReach[planet][1];
+        if (i != 2) {
+            share /= vsopReach[planet][0];
+        }
+        for (j = 0 ; j < 6 ; j++, vs++) {
+            nterms = vs->n;
+            if (qPC) {
                 nterms = min(nterms, 6);
+            } else if (prec > 0) {
+                nterms = seriesTerms(vs, fabs(Tn), share);
             }
-            for (k = 0 ; k < nterms; abc += 3, k++) {
-                x += abc[0] * cos(abc[1] + abc[2] * tau);
-            }
+            x = seriesValue(vs, nterms, tau);
             y[i] += x * Tn;
             Tn *= tau;
         }
     }
+}
+
+/*  DYNTOFK5  --  Heliocentric position from the series sums y at tau,
+				  converted from the dynamical to the FK5 equator and
+				  ecliptic.  */
+
+static void dynToFK5(int planet, double tau, const double y[3],
+                        double *l, double *b, double *r, double *ldyn, double *bdyn)
+{
+	double ld;
 
 	*ldyn = fixangr(y[0]);
 	*bdyn = y[1];
@@ -88,121 +873,616 @@ static void planetPos(int planet, double jd,
 	ld = *ldyn - dtr(1.397 * tau + 0.00031 * tau * tau);
 	*b = *bdyn + astor(0.03916 * (cos(ld) - sin(ld)));
 	*l = *ldyn + astor(-0.09033 + 0.03916 * tan(*bdyn) * (cos(ld) + sin(ld)));
-	if (isSun) {
+	if (planet == 0) {
 		*l = fixangr(*l + PI);
 	}
 }
 
+/*  PLANETPOS  --  Calculate position of a single planet from the
+				   terms defining it.  */
+
+static void planetPos(const struct ephContext *ec, int planet, double jd,
+                        double *l, double *b, double *r, double *ldyn, double *bdyn)
+{
+	double y[3];
+	double tau = (jd - 2451545.0) / 365250.0;
+
+	seriesAt((planet == 0) ? 3 : planet, tau, ec->qPC, astor(ec->prec), y);
+	dynToFK5(planet, tau, y, l, b, r, ldyn, bdyn);
+}
+
+/*  Uniform time grids
+
+    Sampling the series at evenly spaced times need not take a cosine per
+    term per sample: each term's argument B + C * tau advances by the same
+    C * dtau at every step, so its cosine and sine follow by a rotation,
+
+        cos(x + d) = cos x cos d - sin x sin d
+        sin(x + d) = sin x cos d + cos x sin d
+
+    four multiplies and two adds. The same cosine and sine give the first
+    and second time derivatives of each series, so the position one light
+    time earlier is a second-order Taylor step from the sample (its error
+    is below 1e-5 arcsec even for Mercury). Rounding in the rotation makes
+    the terms drift slowly, so every VSOPANCHOR steps they are taken
+    afresh from the exact argument. The VSOP_TEST_PROGRAM build of this
+    file compares grid positions with planetsAt().
+*/
+
+#define VSOPANCHOR  32
+
+// gridTerms    Terms of a series as the grid sums them
+
+static int gridTerms(const struct vsopSeries *vs, int qPC)
+{
+    return qPC ? min(vs->n, 6) : vs->n;
+}
+
+// gridAnchor   Cosine and sine of every term from the exact argument
+
+static void gridAnchor(struct vsopGrid *g)
+{
+    const struct vsopSeries *vs;
+    double tau = (g->jd0 + g->k * g->step - J2000) / 365250.0, x;
+    int i, j, k, n, t = 0;
+
+    for (i = 1; i <= 6; i++)
+    {
+        for (j = 0; j < 18; j++)
+        {
+            vs = &vsopSeries[i][j];
+            n = gridTerms(vs, g->qPC);
+            for (k = 0; k < n; k++, t++)
+            {
+                x = vs->b[k] + vs->c[k] * tau;
+                g->cs[t] = cos(x);
+                g->sn[t] = sin(x);
+            }
+        }
+    }
+
+    return;
+}
+
+// gridSample   Series of every planet and their first two derivatives
+//              (per millennium) at the current sample, then move to the next
+
+static void gridSample(struct vsopGrid *g)
+{
+    const struct vsopSeries *vs;
+    double tau = (g->jd0 + g->k * g->step - J2000) / 365250.0, t[3], Tn, Tn1, Tn2;
+    double *y;
+    int i, j, n, v, off = 0;
+
+    for (i = 1; i <= 6; i++)
+    {
+        for (v = 0; v < 3; v++)
+        {
+            y = g->y[i][v];
+            y[0] = y[1] = y[2] = 0;
+            Tn = 1;                         // tau^j and its two derivatives
+            Tn1 = Tn2 = 0;
+            for (j = 0; j < 6; j++)
+            {
+                vs = &vsopSeries[i][v * 6 + j];
+                n = gridTerms(vs, g->qPC);
+                gridSeries(vs->a, vs->c, g->cs + off, g->sn + off, g->cd + off, g->sd + off, n, t);
+                off += n;
+
+                y[0] += t[0] * Tn;
+                y[1] += t[1] * Tn + t[0] * Tn1;
+                y[2] += t[2] * Tn + 2 * t[1] * Tn1 + t[0] * Tn2;
+                Tn2 = (j + 1) * Tn1;
+                Tn1 = (j + 1) * Tn;
+                Tn *= tau;
+            }
+        }
+    }
+
+    // Rounding in the rotations drifts, take the terms afresh now and then
+    if (++g->k % VSOPANCHOR == 0)
+        gridAnchor(g);
+
+    return;
+}
+
+/*  VSOPGRIDOPEN  --  Prepare to sample the planets at jd0, jd0 + step,
+					  ... (-1 if out of memory).  */
+
+int vsopGridOpen(struct vsopGrid *g, double jd0, double step, int qPC)
+{
+    const struct vsopSeries *vs;
+    double dtau = step / 365250.0;
+    int i, j, k, n, t;
+
+    pthread_once(&vsopOnce, vsopInit);
+    memset(g, 0, sizeof(*g));
+    g->jd0 = jd0;
+    g->step = step;
+    g->qPC = qPC;
+
+    for (i = 1; i <= 6; i++)
+    {
+        for (j = 0; j < 18; j++)
+            g->nTerms += gridTerms(&vsopSeries[i][j], qPC);
+    }
+    g->cs = malloc(4 * g->nTerms * sizeof(double));
+    if (g->cs == NULL)
+    {
+        printf("Out of memory for planet grid\n");
+        return -1;
+    }
+    g->sn = g->cs + g->nTerms;
+    g->cd = g->sn + g->nTerms;
+    g->sd = g->cd + g->nTerms;
+
+    for (i = 1, t = 0; i <= 6; i++)
+    {
+        for (j = 0; j < 18; j++)
+        {
+            vs = &vsopSeries[i][j];
+            n = gridTerms(vs, qPC);
+            for (k = 0; k < n; k++, t++)
+            {
+                g->cd[t] = cos(vs->c[k] * dtau);
+                g->sd[t] = sin(vs->c[k] * dtau);
+            }
+        }
+    }
+    gridAnchor(g);
+
+    return 0;
+}
+
+void vsopGridClose(struct vsopGrid *g)
+{
+    free(g->cs);
+    memset(g, 0, sizeof(*g));
+}
+
+/*  GRIDPOS  --  Position of a planet dt days from jd: from the series, or
+				 from the current grid sample and its derivatives.  */
+
+static void gridPos(const struct ephContext *ec, const struct vsopGrid *g, int planet, double jd, double dt,
+                        double *l, double *b, double *r, double *ldyn, double *bdyn)
+{
+	const double (*yg)[3];
+	double y[3], h = dt / 365250.0;
+	int i;
+
+	if (g == NULL) {
+		planetPos(ec, planet, jd + dt, l, b, r, ldyn, bdyn);
+		return;
+	}
+
+	yg = g->y[(planet == 0) ? 3 : planet];
+	for (i = 0; i < 3; i++) {
+		y[i] = yg[i][0] + h * (yg[i][1] + 0.5 * h * yg[i][2]);
+	}
+	dynToFK5(planet, (jd - J2000) / 365250.0 + h, y, l, b, r, ldyn, bdyn);
+}
+
 /*	PLANETSPOS	--	Calculate positions for planets */
 
 void planets(double jd)
 {
-	int i;
-	double l, b, r, ld, bd, x, y, z, tau, jc, glon, glat, theta,
-		   aberrE, aberrPI, aberrDlambda, aberrDbeta, epsilon,
-		   ecos, esin, nPsi, nEps, tra,
-		   sunL, sunB, sunR;	   /* Sun position */
+	planetsCtx(&legacyCtx, jd);
+}
+
+void planetsCtx(const struct ephContext *ec, double jd)
+{
+	apparentPlanets(ec, jd, NULL);
+}
+
+/*	PLANETSAT	--	Calculate positions for planets into pi[7], shortcut
+					series if qPC (reentrant)  */
+
+void planetsAt(double jd, int qPC, struct planet *pi)
+{
+	struct ephContext ec;
+
+	ephContextInit(&ec, pi, qPC, 0, 0);
+	apparentPlanets(&ec, jd, NULL);
+}
+
+/*	PLANETSGRID	--	Positions for the next time of a grid from
+					vsopGridOpen into pi[7]  */
+
+void planetsGrid(struct vsopGrid *g, struct planet *pi)
+{
+	struct ephContext ec;
+	double jd = g->jd0 + g->k * g->step;
+
+	ephContextInit(&ec, pi, g->qPC, 0, 0);
+	gridSample(g);
+	apparentPlanets(&ec, jd, g);
+}
+
+/*	APPARENTPLANETS	--	Apparent places of the Sun, Moon and planets at jd
+						into the context's table, heliocentric positions
+						from grid g if not NULL
+
+	The Sun and the five planets go through each step together, so the
+	sines, cosines and arc tangents of a step are taken in one batch.  */
+
+#define NBODY	6
 
-    // Keep GCC happy
-    sunL = sunB = sunR = 0;
+static const int vsopBody[NBODY] = { 0, 1, 2, 4, 5, 6 };	/* Slot 3 is the Moon */
+
+/*	HELIORECT  --  Heliocentric rectangular ecliptic coordinates of the
+				   bodies, leaving the sines and cosines of the longitudes
+				   and then the latitudes in sn and cs.  */
+
+static void helioRect(const double *ld, const double *bd, const double *rv,
+						double *sn, double *cs, double *x, double *y, double *z)
+{
+	double ang[2 * NBODY];
+	int k;
+
+	for (k = 0; k < NBODY; k++) {
+		ang[k] = ld[k];
+		ang[NBODY + k] = bd[k];
+	}
+	vecsincos(ang, sn, cs, 2 * NBODY);
+	for (k = 0; k < NBODY; k++) {
+		x[k] = rv[k] * cs[NBODY + k] * cs[k];
+		y[k] = rv[k] * cs[NBODY + k] * sn[k];
+		z[k] = rv[k] * sn[NBODY + k];
+	}
+}
+
+static void apparentPlanets(const struct ephContext *ec, double jd, const struct vsopGrid *g)
+{
+	struct planet *pi = ec->pi;
+	int i, k;
+	double l, b, r, ld[NBODY], bd[NBODY], rv[NBODY], x[NBODY], y[NBODY], z[NBODY],
+		   sn[3 * NBODY], cs[3 * NBODY], num[2 * NBODY], den[2 * NBODY], fkLat[NBODY], fkLon[NBODY],
+		   glon[2 * NBODY], *glat = glon + NBODY, tau, jc, theta,
+		   aberrE, aberrPI, aberrDlambda, aberrDbeta, epsilon,
+		   ecos, esin, nPsi, nEps, tanBd, sunX, sunY, sunZ;
 
 	/* Calculate obliquity of the ecliptic and nutation
 	   in obliquity and longitude.	These depend solely upon
 	   the epoch and thus can be used for all the calculations
 	   below. */
 
-    epsilon = dtr(obliqeq(jd));
-    nutation(jd, &nPsi, &nEps);
+    epsilon = dtr(epochObliquity(jd));
+    epochNutation(jd, &nPsi, &nEps);
     epsilon += nEps;				/* Correct obliquity for nutation */
     esin = sin(epsilon);
     ecos = cos(epsilon);
 
-	for (i = 0; i <= 6; i++)
-	{
-        if (i == 3) {				// Plug moon position in slot 3
-            highmoon(jd, &l, &b, &r, quickPlanetCalc);
-            ecliptoeq(jd, l, b, &planet_info[3].ra, &planet_info[3].dec);
-            planet_info[i].dist = r;	// Note that moon distance is from Earth's centre
-        } else {
-            planetPos(i, jd, &l, &b, &r, &ld, &bd);
-            if (i == 0) {
-                sunL = ld;
-                sunB = bd;
-                sunR = r;
-                x = -r * cos(bd) * cos(ld);
-                y = -r * cos(bd) * sin(ld);
-                z = -r * sin(bd);
-                r = 0;
-            } else {
-                x = r * cos(bd) * cos(ld) - sunR * cos(sunB) * cos(sunL);
-                y = r * cos(bd) * sin(ld) - sunR * cos(sunB) * sin(sunL);
-                z = r * sin(bd) 		  - sunR * sin(sunB);
-            }
+    // Plug moon position in slot 3
+    highmoonCtx(ec, jd, &l, &b, &r);
+    ecliptoeq(jd, l, b, &pi[3].ra, &pi[3].dec);
+    pi[3].dist = r;	// Note that moon distance is from Earth's centre
 
-            planet_info[i].hrv = r;			/* Heliocentric radius vector */
-            planet_info[i].hlong = rtd(l);	/* Heliocentric FK5 longitude */
-            planet_info[i].hlat = rtd(b);	/* Heliocentric FK5 latitude */
-            planet_info[i].dhlong = rtd(ld);/* Heliocentric dynamical longitude */
-            planet_info[i].dhlat = rtd(bd); /* Heliocentric dynamical latitude */
-            planet_info[i].dist = sqrt(x * x + y * y + z * z); /* True distance from Earth */
-
-            /* Light travel time over true distance from Earth. */
-            tau = 0.0057755183 * planet_info[i].dist;
-
-            /* Recompute apparent position taking into count
-               speed of light delay. */
-
-            planetPos(i, jd - tau, &l, &b, &r, &ld, &bd);
-            if (i == 0) {
-                x = -r * cos(bd) * cos(ld);
-                y = -r * cos(bd) * sin(ld);
-                z = -r * sin(bd);
-                r = 0;
-            } else {
-                x = r * cos(bd) * cos(ld) - sunR * cos(sunB) * cos(sunL);
-                y = r * cos(bd) * sin(ld) - sunR * cos(sunB) * sin(sunL);
-                z = r * sin(bd) 		  - sunR * sin(sunB);
-            }
+	for (k = 0; k < NBODY; k++) {
+		i = vsopBody[k];
+		gridPos(ec, g, i, jd, 0.0, &l, &b, &rv[k], &ld[k], &bd[k]);
+		pi[i].hrv = (i == 0) ? 0 : rv[k];	/* Heliocentric radius vector */
+		pi[i].hlong = rtd(l);	/* Heliocentric FK5 longitude */
+		pi[i].hlat = rtd(b);	/* Heliocentric FK5 latitude */
+		pi[i].dhlong = rtd(ld[k]);/* Heliocentric dynamical longitude */
+		pi[i].dhlat = rtd(bd[k]); /* Heliocentric dynamical latitude */
+	}
 
-            tau = 0.0057755183 * sqrt(x * x + y * y + z * z);
+	/* The Sun's series give the Earth: geocentric positions are those
+	   of the planets less the Earth's (at jd), the Sun's is minus the
+	   Earth's. */
 
-            /* Geocentric longitude and latitude, corrected for
-               light travel time. */
+	helioRect(ld, bd, rv, sn, cs, x, y, z);
+	sunX = x[0];
+	sunY = y[0];
+	sunZ = z[0];
+	theta = fixangr(ld[0] + PI);
+	for (k = 0; k < NBODY; k++) {
+		i = vsopBody[k];
+		x[k] = (k == 0) ? -x[k] : x[k] - sunX;
+		y[k] = (k == 0) ? -y[k] : y[k] - sunY;
+		z[k] = (k == 0) ? -z[k] : z[k] - sunZ;
+		pi[i].dist = sqrt(x[k] * x[k] + y[k] * y[k] + z[k] * z[k]); /* True distance from Earth */
 
-            glon = atan2(y, x);
-            glat = atan2(z, sqrt(x * x + y * y));
+		/* Light travel time over true distance from Earth. */
+		tau = 0.0057755183 * pi[i].dist;
 
-            /* Compute aberration. */
+		/* Recompute apparent position taking into count
+		   speed of light delay. */
+		gridPos(ec, g, i, jd, -tau, &l, &b, &rv[k], &ld[k], &bd[k]);
+	}
 
-            theta = fixangr(sunL + PI);
-            jc = (jd - J2000) / JulianCentury;
-            aberrE = 0.016708617 - 0.000042037 * jc - 0.0000001236 * (jc * jc);
-            aberrPI = dtr(102.93735 + 0.71953 * jc + 0.00046 * (jc * jc));
-            aberrDlambda = ((-Kappa * cos(theta - glon)) +
-                            (aberrE * Kappa * cos(aberrPI - glon))) / cos(glat);
-            aberrDbeta = (-Kappa) * sin(glat) * (sin(theta - glon) -
-                         aberrE * sin(aberrPI - glon));
+	helioRect(ld, bd, rv, sn, cs, x, y, z);
+	for (k = 0; k < NBODY; k++) {
+		x[k] = (k == 0) ? -x[k] : x[k] - sunX;
+		y[k] = (k == 0) ? -y[k] : y[k] - sunY;
+		z[k] = (k == 0) ? -z[k] : z[k] - sunZ;
 
-            /* Correct for aberration. */
+		/* Geocentric longitude and latitude, corrected for
+		   light travel time. */
+		num[k] = y[k];
+		den[k] = x[k];
+		num[NBODY + k] = z[k];
+		den[NBODY + k] = sqrt(x[k] * x[k] + y[k] * y[k]);
+	}
+	vecatan2(num, den, glon, 2 * NBODY);
 
-            glon += dtr(aberrDlambda);
-            glat += dtr(aberrDbeta);
+	/* Reduction to the FK5 system, from the dynamical longitude and
+	   latitude of the light-time position (before sn and cs are
+	   reused). */
 
-            /* Reduce to the FK5 system. */
+	for (k = 0; k < NBODY; k++) {
+		tanBd = sn[NBODY + k] / cs[NBODY + k];
+		fkLat[k] = astor(0.03916 * (cs[k] - sn[k]));
+		fkLon[k] = astor((-0.09033 + 0.03916 * tanBd * (cs[k] + sn[k])));
+	}
 
-            glat += astor(0.03916 * (cos(ld) - sin(ld)));
-            glon += astor((-0.09033 + 0.03916 * tan(bd) * (cos(ld) + sin(ld))));
+	/* Compute aberration. */
 
-            /* Correct for nutation. */
+	jc = (jd - J2000) / JulianCentury;
+	aberrE = 0.016708617 - 0.000042037 * jc - 0.0000001236 * (jc * jc);
+	aberrPI = dtr(102.93735 + 0.71953 * jc + 0.00046 * (jc * jc));
+	for (k = 0; k < NBODY; k++) {
+		den[k] = theta - glon[k];
+		den[NBODY + k] = aberrPI - glon[k];
+	}
+	vecsincos(den, sn, cs, 2 * NBODY);
+	vecsincos(glat, sn + 2 * NBODY, cs + 2 * NBODY, NBODY);
+	for (k = 0; k < NBODY; k++) {
+		aberrDlambda = ((-Kappa * cs[k]) +
+						(aberrE * Kappa * cs[NBODY + k])) / cs[2 * NBODY + k];
+		aberrDbeta = (-Kappa) * sn[2 * NBODY + k] * (sn[k] -
+					 aberrE * sn[NBODY + k]);
 
-            glon += nPsi;
+		/* Correct for aberration, reduce to FK5 and correct for
+		   nutation. */
 
-            /* Transform into apparent right ascension and declination. */
+		glon[k] += dtr(aberrDlambda);
+		glat[k] += dtr(aberrDbeta);
+		glat[k] += fkLat[k];
+		glon[k] += fkLon[k];
+		glon[k] += nPsi;
+	}
+
+	/* Transform into apparent right ascension and declination. */
 
-            tra = atan2(sin(glon) * ecos - tan(glat) * esin, cos(glon));
-            planet_info[i].dec = asin(sin(glat) * ecos + cos(glat) * esin * sin(glon));
-            planet_info[i].ra = fixangr(tra);
+	vecsincos(glon, sn, cs, 2 * NBODY);
+	for (k = 0; k < NBODY; k++) {
+		num[k] = sn[k] * ecos - sn[NBODY + k] / cs[NBODY + k] * esin;
+		den[k] = cs[k];
+		den[NBODY + k] = sn[NBODY + k] * ecos + cs[NBODY + k] * esin * sn[k];
+	}
+	vecatan2(num, den, glon, NBODY);
+	vecasin(den + NBODY, glat, NBODY);
+	for (k = 0; k < NBODY; k++) {
+		i = vsopBody[k];
+		pi[i].ra = fixangr(glon[k]);
+		pi[i].dec = glat[k];
+	}
+}
+
+
+//-------------------------------------------------------------------------------
+#ifdef VSOP_TEST_PROGRAM
+
+/*  cc -O2 -DVSOP_TEST_PROGRAM -IInclude Lib/Vsop87.c Lib/Astro.c Lib/VecMath.c \
+       Lib/EphCache.c -lm -lpthread  */
+
+#include <time.h>
+
+// Term-by-term libm sum, as planetPos did before the series kernels
+
+static volatile double sink;
+
+static double seriesRef(const struct pTerms *pt, double tau)
+{
+    double x = 0;
+    int k;
+
+    for (k = 0; k < pt->termCount; k++)
+        x += pt->termArray[3 * k] * cos(pt->termArray[3 * k + 1] + pt->termArray[3 * k + 2] * tau);
+
+    return x;
+}
+
+static double secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+    const struct vsopSeries *vs;
+    struct vsopGrid g;
+    struct planet gp[7], dp[7];
+    double tau, amp, err, worst, jd, t0, tRef, tNew;
+    int level, best, i, j, k, n, qPC, bad = 0;
+
+    vsopInit();
+    best = simdlevel();
+    for (level = SIMD_SCALAR; level <= best; level++)
+    {
+        simdforce(level);
+        if (simdlevel() != level)
+            continue;
+#ifndef SIMD_X86
+        if ((level == SIMD_SSE2) || (level == SIMD_AVX2))
+            continue;
+#endif
+#ifndef VSOP_NEON
+        if (level == SIMD_NEON)
+            continue;
+#endif
+        vsopInit();
+
+        // Every series from 1000 to 3000 AD
+        worst = 0;
+        for (tau = -1.0; tau <= 1.0; tau += 0.000731)
+        {
+            for (i = 1; i <= 6; i++)
+            {
+                for (j = 0; j < 18; j++)
+                {
+                    vs = &vsopSeries[i][j];
+                    for (k = 0, amp = 0; k < vs->n; k++)
+                        amp += fabs(vs->a[k]);
+                    if (amp == 0)
+                        continue;
+                    err = fabs(seriesSum(vs->a, vs->b, vs->c, vs->n, tau) - seriesRef(&planetTerms[i][j], tau)) / amp;
+                    worst = max(worst, err);
+                }
+            }
+        }
+
+        n = 2000;
+        t0 = secs();
+        for (k = 0; k < n; k++)
+        {
+            tau = (k - n / 2) * 1e-4;
+            for (i = 1; i <= 6; i++)
+                for (j = 0; j < 18; j++)
+                    sink += seriesRef(&planetTerms[i][j], tau);
         }
+        tRef = secs() - t0;
+        t0 = secs();
+        for (k = 0; k < n; k++)
+        {
+            tau = (k - n / 2) * 1e-4;
+            for (i = 1; i <= 6; i++)
+                for (j = 0; j < 18; j++)
+                {
+                    vs = &vsopSeries[i][j];
+                    sink += seriesSum(vs->a, vs->b, vs->c, vs->n, tau);
+                }
+        }
+        tNew = secs() - t0;
+
+        printf("%-6s  worst error %.2e of amplitude sum, %.1f us per epoch (libm loop %.1f us)\n",
+               simdname(level), worst, tNew / n * 1e6, tRef / n * 1e6);
+        bad += (worst > VSOPTOLERANCE);
+
+#ifdef SKYPI_VSOP_COMPACT
+        // Float amplitudes against double, within the bound on their rounding
+        worst = 0;
+        for (tau = -1.0; tau <= 1.0; tau += 0.000731)
+        {
+            for (i = 1; i <= 6; i++)
+            {
+                for (j = 0; j < 18; j++)
+                {
+                    vs = &vsopSeries[i][j];
+                    err = fabs(seriesValue(vs, vs->n, tau) - seriesSum(vs->a, vs->b, vs->c, vs->n, tau)) -
+                          VSOPTOLERANCE * vs->tail[0];
+                    worst = max(worst, err);
+                    bad += (err > vs->tail[vs->nHead] * FLT_EPSILON / 2);
+                }
+            }
+        }
+        t0 = secs();
+        for (k = 0; k < n; k++)
+        {
+            tau = (k - n / 2) * 1e-4;
+            for (i = 1; i <= 6; i++)
+                for (j = 0; j < 18; j++)
+                {
+                    vs = &vsopSeries[i][j];
+                    sink += seriesValue(vs, vs->n, tau);
+                }
+        }
+        printf("        compact amplitudes: worst change %.2e, %.1f us per epoch\n", worst, (secs() - t0) / n * 1e6);
+#endif
     }
+
+    // Term tables are by decreasing amplitude (truncation and the compact
+    // head rely on it)
+    for (i = 1; i <= 6; i++)
+        for (j = 0; j < 18; j++)
+            for (k = 1; k < vsopSeries[i][j].n; k++)
+                bad += (fabs(vsopSeries[i][j].a[k]) > fabs(vsopSeries[i][j].a[k - 1]));
+
+    // Whole update, full and quick
+    simdforce(best);
+    vsopInit();
+    for (qPC = FALSE; qPC <= TRUE; qPC++)
+    {
+        t0 = secs();
+        for (jd = J2000; jd < J2000 + 100; jd += 0.1)
+            calcPlanets(jd, 0, 0, qPC);
+        printf("calcPlanets() %s: %.1f us\n", qPC ? "quick" : "full", (secs() - t0) / 1000 * 1e6);
+    }
+
+    // Daily grid for ten years against planetsAt()
+    for (qPC = FALSE; qPC <= TRUE; qPC++)
+    {
+        n = 3653;
+        if (vsopGridOpen(&g, J2000 - 1000.3, 1.0, qPC) < 0)
+            return EXIT_FAILURE;
+        worst = err = 0;
+        for (k = 0; k < n; k++)
+        {
+            planetsGrid(&g, gp);
+            planetsAt(g.jd0 + k * g.step, qPC, dp);
+            for (i = 0; i <= 6; i++)
+            {
+                worst = max(worst, fabs(remainder(gp[i].ra - dp[i].ra, PI * 2)) * cos(dp[i].dec));
+                worst = max(worst, fabs(gp[i].dec - dp[i].dec));
+                err = max(err, fabs(gp[i].dist / dp[i].dist - 1));
+            }
+        }
+        vsopGridClose(&g);
+
+        vsopGridOpen(&g, J2000, 1.0, qPC);
+        t0 = secs();
+        for (k = 0; k < n; k++)
+            planetsGrid(&g, gp);
+        tNew = secs() - t0;
+        vsopGridClose(&g);
+        t0 = secs();
+        for (k = 0; k < n; k++)
+            planetsAt(J2000 + k, qPC, dp);
+        tRef = secs() - t0;
+
+        printf("planetsGrid() %s: worst %.2g arcsec, distance %.2g, %.1f us (planetsAt %.1f us)\n",
+               qPC ? "quick" : "full", rtd(worst) * 3600, err, tNew / n * 1e6, tRef / n * 1e6);
+        bad += (rtd(worst) * 3600 > 1e-4);
+    }
+
+    // Truncated series against the full ones, 1900 to 2100 AD
+    {
+        static const double target[] = { 1.0, 60.0, 600.0 };
+        struct ephContext ec;
+
+        for (j = 0; j < 3; j++)
+        {
+            ephContextInit(&ec, gp, FALSE, 0, 0);
+            ec.prec = target[j];
+            srand(1);
+            worst = tNew = tRef = 0;
+            for (k = 0; k < 2000; k++)
+            {
+                jd = J2000 + (rand() % 73050) - 36525 + (rand() % 1000) / 1000.0;
+                t0 = secs();
+                planetsCtx(&ec, jd);
+                tNew += secs() - t0;
+                t0 = secs();
+                planetsAt(jd, FALSE, dp);
+                tRef += secs() - t0;
+                for (i = 0; i <= 6; i++)
+                {
+                    err = acos(min(1.0, sin(gp[i].dec) * sin(dp[i].dec) +
+                                   cos(gp[i].dec) * cos(dp[i].dec) * cos(gp[i].ra - dp[i].ra)));
+                    worst = max(worst, err);
+                }
+            }
+            printf("planetsCtx() to %g arcsec: worst %.3g arcsec, %.1f us (full %.1f us)\n",
+                   target[j], rtd(worst) * 3600, tNew / k * 1e6, tRef / k * 1e6);
+            bad += (rtd(worst) * 3600 > target[j]);
+        }
+    }
+
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
+#endif
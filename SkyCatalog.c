@@ -0,0 +1,644 @@
+/* SkyCatalog.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "SkyPi.h"
+#include "StarCat.h"
+#include "VecMath.h"
+
+//  skypi-catalog   Convert large star catalog exports to the SkyPi binary
+//                  or tiled catalog format.
+//
+//  The input CSV must start with a header line. Columns are found by name,
+//  so full HYG v3 and Gaia archive exports are read as they come:
+//
+//      HYG v3:     rarad, decrad (or ra in hours, dec in degrees), mag,
+//                  spect, proper (or bf), pmra, pmdec, ci
+//      Gaia:       ra, dec (degrees), phot_g_mean_mag, pmra, pmdec,
+//                  bp_rp, ref_epoch
+//
+//  The input is memory-mapped and split at line boundaries into one chunk
+//  per core. Each chunk is scanned 16 bytes at a time for delimiters
+//  (SSE2/NEON compare and mask), fields are converted only for the columns
+//  used and the chunk results are joined in input order.
+
+#define MAXFIELD    64                  // Longest field converted
+
+// Columns used
+enum {
+    COL_RA = 0,
+    COL_DEC,
+    COL_MAG,
+    COL_SPECT,
+    COL_NAME,
+    COL_ALTNAME,
+    COL_PMRA,
+    COL_PMDEC,
+    COL_COLOR,
+    COL_EPOCH,
+    NCOLS
+};
+
+// Header names of each column, first one present wins
+static const char *colNames[NCOLS][4] = {
+    { "rarad", "ra", NULL },
+    { "decrad", "dec", NULL },
+    { "mag", "phot_g_mean_mag", "vmag", NULL },
+    { "spect", "sp_type", NULL },
+    { "proper", NULL },
+    { "bf", NULL },
+    { "pmra", NULL },
+    { "pmdec", NULL },
+    { "ci", "bp_rp", NULL },
+    { "ref_epoch", NULL }
+};
+
+struct chunk {
+    pthread_t thread;
+    const char *start, *end;            // Whole lines of the input
+    struct growBuf stars;
+    struct growBuf names;               // Star name = offset + 1 (0 = none)
+    uint32_t nLines, nBad;
+};
+
+// Input layout, set from the header
+static int *colSlot;                    // Input column -> used column (-1 = skip)
+static int nCols;
+static int colMatch[NCOLS];             // Header name matched (-1 = absent)
+static double raScale, decScale;
+
+// Options
+static double magLimit;
+static double epoch;
+static char lineCat[200];
+static int nThreads;
+static int bTiled;
+static char raUnit;
+
+//-------------------------------------------------------------------------------
+
+void Usage(void)
+{
+    printf("SkyPi catalog converter V%d.%d\n\n", VERSION_MAJOR, VERSION_MINOR);
+    printf("skypi-catalog [options] input.csv output\n\n");
+    printf(" options:\n");
+    printf("   -c file     Copy constellation lines from starmap DB\n");
+    printf("   -e year     Catalog epoch (default: ref_epoch column or 2000)\n");
+    printf("   -j n        Conversion threads (default: all cores)\n");
+    printf("   -m mag      Faintest star magnitude to keep (default: all)\n");
+    printf("   -t          Write tiled catalog\n");
+    printf("   -u h|d|r    Units of an 'ra' column (default: hours for HYG, else degrees)\n");
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// delimMask    Bit mask of the ',', '"' and '\n' bytes in 16 bytes at p
+
+static inline uint32_t delimMask(const char *p)
+{
+#if defined(SIMD_X86) && defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m;
+
+    m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+
+    return _mm_movemask_epi8(m);
+#elif defined(SIMD_NEON)
+    static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t m;
+    uint8x8_t s;
+
+    m = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(',')), vceqq_u8(v, vdupq_n_u8('\n'))),
+                 vceqq_u8(v, vdupq_n_u8('"')));
+    // One bit per byte, then fold each half into a byte
+    m = vandq_u8(m, vld1q_u8(bits));
+    s = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+    s = vpadd_u8(s, s);
+    s = vpadd_u8(s, s);
+
+    return vget_lane_u16(vreinterpret_u16_u8(s), 0);
+#else
+    uint32_t mask = 0;
+    int k;
+
+    for (k = 0; k < 16; k++)
+    {
+        if ((p[k] == ',') || (p[k] == '\n') || (p[k] == '"'))
+            mask |= 1 << k;
+    }
+
+    return mask;
+#endif
+}
+
+// tailMask     delimMask for the last n (< 16) bytes
+
+static uint32_t tailMask(const char *p, int n)
+{
+    uint32_t mask = 0;
+    int k;
+
+    for (k = 0; k < n; k++)
+    {
+        if ((p[k] == ',') || (p[k] == '\n') || (p[k] == '"'))
+            mask |= 1 << k;
+    }
+
+    return mask;
+}
+
+//-------------------------------------------------------------------------------
+// Field conversion
+
+// getField     Copy a used field, without quotes and blanks. Returns length.
+
+static int getField(const char *field[], const int len[], int col, char *buf)
+{
+    const char *p = field[col];
+    int n = len[col];
+
+    if (p == NULL)
+        return 0;
+
+    while ((n > 0) && ((*p == '"') || (*p == ' ')))
+    {
+        p++;
+        n--;
+    }
+    while ((n > 0) && ((p[n - 1] == '"') || (p[n - 1] == ' ') || (p[n - 1] == '\r')))
+        n--;
+
+    n = min(n, MAXFIELD - 1);
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+
+    return n;
+}
+
+static int getNumber(const char *field[], const int len[], int col, double *val)
+{
+    char buf[MAXFIELD];
+    char *cptr;
+
+    if (getField(field, len, col, buf) == 0)
+        return FALSE;
+
+    *val = strtod(buf, &cptr);
+
+    return (cptr != buf);
+}
+
+// spectClass   Spectral class letter from the spectral type, else from the
+//              colour index (B-V for HYG, BP-RP for Gaia)
+
+static char spectClass(const char *field[], const int len[])
+{
+    static const double bv[] = { -0.30, -0.02, 0.30, 0.58, 0.81, 1.40 };
+    static const double bprp[] = { -0.35, 0.00, 0.40, 0.75, 1.00, 1.80 };
+    char buf[MAXFIELD];
+    const double *ci;
+    double c;
+    char *p;
+    int k;
+
+    if (getField(field, len, COL_SPECT, buf) > 0)
+    {
+        // First capital letter (skips "sd" and similar prefixes)
+        for (p = buf; (*p != '\0') && ((*p < 'A') || (*p > 'Z')); p++)
+            ;
+        if ((*p != '\0') && (strchr("OBAFGKMW", *p) != NULL))
+            return *p;
+    }
+
+    if (getNumber(field, len, COL_COLOR, &c))
+    {
+        ci = (colMatch[COL_COLOR] == 0) ? bv : bprp;
+        for (k = 0; (k < 6) && (c >= ci[k]); k++)
+            ;
+        return "OBAFGKM"[k];
+    }
+
+    return ' ';
+}
+
+// convertLine  Add the star of one input line to a chunk
+
+static void convertLine(struct chunk *ck, const char *field[], const int len[])
+{
+    struct catStar cs;
+    char    name[MAXFIELD];
+    double  ra, dec, mag, pmRA, pmDec, ep, dt;
+    int     n;
+
+    ck->nLines++;
+    if (!getNumber(field, len, COL_RA, &ra) || !getNumber(field, len, COL_DEC, &dec) ||
+        !getNumber(field, len, COL_MAG, &mag))
+    {
+        ck->nBad++;
+        return;
+    }
+
+    // Too faint (or the Sun)
+    if ((mag > magLimit) || (mag <= CATLINEMAG))
+        return;
+
+    ra *= raScale;
+    dec *= decScale;
+    if (!getNumber(field, len, COL_PMRA, &pmRA))
+        pmRA = 0.0;
+    if (!getNumber(field, len, COL_PMDEC, &pmDec))
+        pmDec = 0.0;
+
+    // Bring positions to J2000
+    if ((epoch != 0.0) || !getNumber(field, len, COL_EPOCH, &ep))
+        ep = (epoch != 0.0) ? epoch : 2000.0;
+    dt = 2000.0 - ep;
+    if (dt != 0.0)
+    {
+        dec += catPM(pmDec) * dt;
+        ra += catPM(pmRA) * dt / max(cos(dec), 1e-6);
+        dec = max(-PI / 2, min(PI / 2, dec));
+    }
+
+    packStar(&cs, ra, dec, mag, spectClass(field, len), pmRA, pmDec);
+
+    n = getField(field, len, COL_NAME, name);
+    if (n == 0)
+        n = getField(field, len, COL_ALTNAME, name);
+    if (n > 0)
+        cs.name = growAppend(&ck->names, name, n + 1) + 1;
+
+    growAppend(&ck->stars, &cs, sizeof(cs));
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// parseChunk   Split the lines of a chunk into fields and convert them
+
+static void *parseChunk(void *arg)
+{
+    struct chunk *ck = arg;
+    const char *field[NCOLS];
+    int     len[NCOLS];
+    const char *p, *q, *fld, *line;
+    uint32_t mask;
+    int     col, slot, bQuote;
+
+    memset(field, 0, sizeof(field));
+    fld = line = ck->start;
+    col = 0;
+    bQuote = FALSE;
+
+    for (p = ck->start; p < ck->end; p += 16)
+    {
+        mask = ((ck->end - p) >= 16) ? delimMask(p) : tailMask(p, ck->end - p);
+        while (mask != 0)
+        {
+            q = p + __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            // Commas inside quotes do not split
+            if (*q == '"')
+            {
+                bQuote = !bQuote;
+                continue;
+            }
+            if (bQuote && (*q == ','))
+                continue;
+
+            if ((col < nCols) && ((slot = colSlot[col]) >= 0))
+            {
+                field[slot] = fld;
+                len[slot] = q - fld;
+            }
+            col++;
+            fld = q + 1;
+
+            if (*q == '\n')
+            {
+                // Skip blank lines
+                if (q > line)
+                    convertLine(ck, field, len);
+                line = fld;
+                memset(field, 0, sizeof(field));
+                col = 0;
+                bQuote = FALSE;
+            }
+        }
+    }
+
+    // Last line without newline
+    if (fld < ck->end)
+    {
+        if ((col < nCols) && ((slot = colSlot[col]) >= 0))
+        {
+            field[slot] = fld;
+            len[slot] = ck->end - fld;
+        }
+        convertLine(ck, field, len);
+    }
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------
+// parseHeader  Find the used columns by name, returns start of data
+
+static const char *parseHeader(const char *data, const char *end)
+{
+    const char *eol;
+    char    *line, **names;
+    int     k, n, c;
+
+    eol = memchr(data, '\n', end - data);
+    if (eol == NULL)
+        eol = end;
+
+    line = strndup(data, eol - data);
+    names = malloc((eol - data + 1) * sizeof(char *));
+    if ((line == NULL) || (names == NULL))
+    {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    nCols = csv_parse(line, names, eol - data + 1);
+
+    colSlot = malloc(max(nCols, 1) * sizeof(int));
+    for (c = 0; c < nCols; c++)
+        colSlot[c] = -1;
+
+    for (k = 0; k < NCOLS; k++)
+    {
+        colMatch[k] = -1;
+        for (n = 0; (colMatch[k] < 0) && (colNames[k][n] != NULL); n++)
+        {
+            for (c = 0; c < nCols; c++)
+            {
+                if ((strcasecmp(names[c], colNames[k][n]) == 0) && (colSlot[c] < 0))
+                {
+                    colSlot[c] = k;
+                    colMatch[k] = n;
+                    break;
+                }
+            }
+        }
+    }
+
+    if ((colMatch[COL_RA] < 0) || (colMatch[COL_DEC] < 0) || (colMatch[COL_MAG] < 0))
+    {
+        printf("Input needs a header line naming ra, dec and magnitude columns\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Angle units: HYG gives RA in hours, Gaia in degrees
+    if (raUnit == '\0')
+        raUnit = ((colMatch[COL_NAME] >= 0) || (colMatch[COL_ALTNAME] >= 0)) ? 'h' : 'd';
+    raScale = (colMatch[COL_RA] == 0) ? 1.0 :
+              (raUnit == 'h') ? dtr(15.0) : (raUnit == 'd') ? dtr(1.0) : 1.0;
+    decScale = (colMatch[COL_DEC] == 0) ? 1.0 : (raUnit == 'r') ? 1.0 : dtr(1.0);
+
+    free(names);
+    free(line);
+
+    return (eol < end) ? eol + 1 : end;
+}
+
+//-------------------------------------------------------------------------------
+
+void parse_options(int argc, char **argv)
+{
+    char *cptr;
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "?c:e:hj:m:tu:")) != -1)
+    {
+        switch (opt) {
+        // Constellation lines
+        case 'c':
+            strcpy(lineCat, optarg);
+            break;
+
+        // Position epoch
+        case 'e':
+            epoch = strtod(optarg, &cptr);
+            if ((cptr == optarg) || (*cptr != '\0'))
+            {
+                printf("Invalid epoch: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        // Thread count
+        case 'j':
+            nThreads = atoi(optarg);
+            if (nThreads <= 0)
+            {
+                printf("Invalid thread count: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        // Star magnitude limit
+        case 'm':
+            magLimit = strtod(optarg, &cptr);
+            if ((cptr == optarg) || (*cptr != '\0'))
+            {
+                printf("Invalid magnitude limit: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 't':
+            bTiled = TRUE;
+            break;
+
+        // RA units
+        case 'u':
+            raUnit = *optarg;
+            if ((raUnit != 'h') && (raUnit != 'd') && (raUnit != 'r'))
+            {
+                printf("Invalid RA units: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        // Give help and quit
+        case 'h':
+        case '?':
+            Usage();
+            exit(EXIT_SUCCESS);
+
+        // Unrecognized option - give help and fail
+        default:
+            Usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    struct chunk *chunks;
+    struct growBuf stars = { NULL, 0, 0 };
+    struct growBuf segs = { NULL, 0, 0 };
+    struct growBuf names = { NULL, 0, 0 };
+    struct starCat cat;
+    struct catStar *cs;
+    struct stat st;
+    struct timespec t0, t1;
+    const char *data, *end, *p;
+    uint32_t k, base, nLines, nBad;
+    int     fd, n, rc;
+
+    // Default options
+    magLimit = 99.0;
+    nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    parse_options(argc, argv);
+
+    if (argc != (optind + 2))
+    {
+        Usage();
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    fd = open(argv[optind], O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) < 0) || (st.st_size == 0))
+    {
+        printf("Cannot open catalog: %s\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        printf("Cannot map catalog: %s\nError (%d) - %s\n", argv[optind], errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    end = data + st.st_size;
+
+    p = parseHeader(data, end);
+
+    // One chunk of whole lines per thread
+    nThreads = max(1, min(nThreads, (int)((end - p) / 65536) + 1));
+    chunks = calloc(nThreads, sizeof(struct chunk));
+    if (chunks == NULL)
+    {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (n = 0; n < nThreads; n++)
+    {
+        chunks[n].start = p;
+        p = (n == nThreads - 1) ? end : max(p, data + (st.st_size * (n + 1)) / nThreads);
+        if (p < end)
+        {
+            p = memchr(p, '\n', end - p);
+            p = (p == NULL) ? end : p + 1;
+        }
+        chunks[n].end = p;
+    }
+
+    for (n = 0; n < nThreads; n++)
+    {
+        rc = pthread_create(&chunks[n].thread, NULL, parseChunk, &chunks[n]);
+        if (rc != 0)
+        {
+            printf("Cannot start conversion thread - %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Join chunks in input order
+    growAppend(&names, "", 1);
+    nLines = nBad = 0;
+    for (n = 0; n < nThreads; n++)
+    {
+        pthread_join(chunks[n].thread, NULL);
+
+        base = names.used;
+        if (chunks[n].names.used > 0)
+            growAppend(&names, chunks[n].names.data, chunks[n].names.used);
+        cs = (struct catStar *)chunks[n].stars.data;
+        for (k = 0; k < chunks[n].stars.used / sizeof(struct catStar); k++)
+        {
+            if (cs[k].name != 0)
+                cs[k].name += base - 1;
+        }
+        if (chunks[n].stars.used > 0)
+            growAppend(&stars, chunks[n].stars.data, chunks[n].stars.used);
+
+        nLines += chunks[n].nLines;
+        nBad += chunks[n].nBad;
+        free(chunks[n].stars.data);
+        free(chunks[n].names.data);
+    }
+    munmap((void *)data, st.st_size);
+
+    // Constellation lines from an existing starmap DB
+    if (lineCat[0] != '\0')
+    {
+        if (openStarCat(lineCat, &cat) < 0)
+            exit(EXIT_FAILURE);
+        growAppend(&segs, cat.segs, cat.hdr->nSegs * sizeof(struct catSeg));
+        closeStarCat(&cat);
+    }
+
+    if (makeStarCat(&stars, &segs, &names, &cat) < 0)
+    {
+        printf("Cannot build catalog\n");
+        exit(EXIT_FAILURE);
+    }
+    rc = bTiled ? writeStarTiles(&cat, argv[optind + 1]) : writeStarCat(&cat, argv[optind + 1]);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("%u of %u stars (%u bad lines), %u line vertices, %d threads, %.2f s\n",
+           cat.hdr->nStars, nLines, nBad, cat.hdr->nSegs, nThreads,
+           (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+
+    closeStarCat(&cat);
+
+    exit((rc == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
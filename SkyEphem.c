@@ -0,0 +1,165 @@
+/* SkyEphem.c
+ *
+ * Copyright (C) 2013        Ted Hess (Kitschensync)
+ *
+ * SkyPi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SkyPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SkyPi; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "SkyPi.h"
+#include "EphCache.h"
+
+//  skypi-ephem     Fit the Sun, Moon and planets over a span of years and
+//                  write an ephemeris file for SkyPi '-e'.
+//
+//  Segments are fitted from the full VSOP87 and lunar series in one
+//  process per core; each process writes its records straight into the
+//  file. Twenty years take about 7300 segments of 8 series runs each.
+
+#define EPHYEARS    20                  // Default span
+
+static char startDate[16];
+static double years;
+static int nJobs;
+static int bQuick;
+
+void Usage(void)
+{
+    printf("SkyPi ephemeris generator V%d.%d\n\n", VERSION_MAJOR, VERSION_MINOR);
+    printf("skypi-ephem [options] output\n\n");
+    printf(" options:\n");
+    printf("   -j n        Worker processes (default: all cores)\n");
+    printf("   -Q          Fit the quick (truncated) series\n");
+    printf("   -s date     First day, yyyy-mm-dd (default: a year ago)\n");
+    printf("   -y years    Years covered (default: %d)\n", EPHYEARS);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+
+void parse_options(int argc, char **argv)
+{
+    char *cptr;
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "?hj:Qs:y:")) != -1)
+    {
+        switch (opt) {
+        // Process count
+        case 'j':
+            nJobs = atoi(optarg);
+            if (nJobs <= 0)
+            {
+                printf("Invalid process count: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'Q':
+            bQuick = TRUE;
+            break;
+
+        // First day
+        case 's':
+            strncpy(startDate, optarg, sizeof(startDate) - 1);
+            break;
+
+        // Span
+        case 'y':
+            years = strtod(optarg, &cptr);
+            if ((cptr == optarg) || (*cptr != '\0') || (years <= 0))
+            {
+                printf("Invalid year count: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        // Give help and quit
+        case 'h':
+        case '?':
+            Usage();
+            exit(EXIT_SUCCESS);
+
+        // Unrecognized option - give help and fail
+        default:
+            Usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    struct tm tmStart;
+    struct timespec t0, t1;
+    time_t  now;
+    double  jdStart;
+    uint32_t nSegs;
+    int     rc;
+
+    // Default options
+    years = EPHYEARS;
+    nJobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    parse_options(argc, argv);
+
+    if (argc != (optind + 1))
+    {
+        Usage();
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&tmStart, 0, sizeof(tmStart));
+    if (startDate[0] != '\0')
+    {
+        if ((strptime(startDate, "%Y-%m-%d", &tmStart) == NULL))
+        {
+            printf("Invalid start date: %s\n", startDate);
+            exit(EXIT_FAILURE);
+        }
+        jdStart = jtime(&tmStart);
+    } else {
+        now = time(NULL);
+        gmtime_r(&now, &tmStart);
+        jdStart = jtime(&tmStart) - 365.25;
+    }
+
+    // Segment boundaries as the run-time cache has them
+    jdStart = floor(jdStart / EPHSEGDAYS) * EPHSEGDAYS;
+    nSegs = (uint32_t)ceil(years * 365.25 / EPHSEGDAYS);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = writeEphFile(argv[optind], jdStart, nSegs, bQuick, nJobs);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (rc == 0)
+        printf("%u segments from JD %.1f, %d processes, %.2f s\n", nSegs, jdStart, min(nJobs, (int)nSegs),
+               (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+
+    exit((rc == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
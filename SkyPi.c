@@ -32,6 +32,12 @@
 #include <sys/stat.h>
 
 #include "SkyPi.h"
+#include "StarCat.h"
+#include "SkyProj.h"
+#include "SkyLayer.h"
+#include "SkyLabel.h"
+#include "SkyPick.h"
+#include "EphCache.h"
 
 // defines for 4dgl constants
 #include "Include/Picaso_const4D.h"
@@ -61,10 +67,41 @@ static char rtcval[24];
 // Location of starmap DB
 #define HYGDEFAULT "/usr/local/lib/SkyPi/starmap.csv"
 static char starMap[200];
+static char tileMap[200];
+static char lineMap[200];
+#define EPHDEFAULT "/usr/local/lib/SkyPi/ephem.bin"
+static char ephMap[200];
+static struct ephFile ephFile;          // Precomputed planet positions
+// Object layers, layers[0] is the star field
+static struct skyLayer layers[MAXLAYERS];
+static int nLayers;
+static short *starX, *starY;            // Projected objects for current frame
+static uint32_t *starIdx;
+static double magLimit;
 static int bCLines;
+static struct lineSet lineSet;          // Constellation lines
+static WORD *lineX, *lineY;             // Projected polyline
+static double labelMag;                 // Label stars brighter than this
+static int bQuickPlanets;               // Truncated planet series
+static double planetPrec;               // Series precision target (arcsec), 0 for full
+static struct ephCache ephCache;         // Fitted planet positions
+static struct ephContext skyEph;         // Planets for the site, into planet_info
+static int bEphCache;
+
+// Font metrics, read from the display once per font
+static struct fontMetrics fontCache[FONT3 + 1];
+static int fontLoaded[FONT3 + 1];
 
 // Julian date/time
 static double  JD;
+// Equatorial (of date) to horizon rotation for current frame
+static double  horMatrix[3][3];
+// J2000 catalog to horizon rotation for current frame
+static double  starMatrix[3][3];
+// J2000 to true equator of date (precession, nutation), updated daily
+#define APPARENTDAYS    1.0
+static double  appMatrix[3][3];
+static double  appJD;
 
 // LatLong of Hudson, MA (in radians)
 static double Latitude = dtr(42.38050);
@@ -96,12 +133,22 @@ void Usage(void)
     printf("SkyPi [options] [device]\n\n");
     printf(" device    Comms port to which display is attached (default: %s)\n", SERIALDEFAULT);
     printf(" options:\n");
+    printf("   -c          Draw constellation lines\n");
+    printf("   -C file     Constellation line file (implies -c)\n");
+    printf("   -d file[,mag] Deep-sky object layer, optional magnitude limit\n");
+    printf("   -e file     Ephemeris file from skypi-ephem (default: %s)\n", EPHDEFAULT);
     printf("   -f file     Path name of starmap DB (default: %s)\n", HYGDEFAULT);
     printf("   -l lat,long Observer decimal latitude & logitude\n");
+    printf("   -L mag      Label named stars brighter than mag (default: 1.5)\n");
+    printf("   -m mag      Faintest star magnitude to plot (default: 6.0)\n");
+    printf("   -p arcsec   Planet and Moon series to this precision (half a pixel: %.0f)\n", rtd(0.5 / YPixRad) * 3600);
     printf("   -q          Disable cuckoo chimes\n");
+    printf("   -Q          Quick (truncated) planet and Moon series\n");
+    printf("   -T file     Write tiled copy of starmap DB to file and exit\n");
     printf("   -s speed    Serial device baudrate (default: 9600)\n");
     printf("   -t          Use system time instead of LCD clock\n");
     printf("   -w hh:mm    Display wake time (default: 06:30)\n");
+    printf("   -x file[,mag] Labelled target list layer, optional magnitude limit\n");
     printf("   -z hh:mm    Display sleep time (default: 23:30)\n");
     printf("   -B          Run in background (daemonize)\n");
 
@@ -124,81 +171,132 @@ int errCallback(int ErrCode, unsigned char Errbyte)
 }
 
 //-------------------------------------------------------------------------------
-// X/Y projection calc
+// X/Y projection calc (overlays: vreal precision, see SkyProj.h)
 
 
 void XYFromAzAlt(double az, double alt, int *iX, int *iY)
 {
-    double X, Y;
-    double CentralAngle;
+    vreal X, Y;
+    vreal CentralAngle;
+    vreal vaz = az, valt = alt;
 
     // use stereographic projection from equator
-    CentralAngle = acos(cos(alt) * cos(az));
+    CentralAngle = vacos(vcos(valt) * vcos(vaz));
     // get altitude and azimuth in pixels
     if (CentralAngle != 0)
     {
-        Y = CentralAngle * YPixRad * sin(alt) / sin(CentralAngle);
-        X = CentralAngle * XPixRad * cos(alt) * sin(az) / sin(CentralAngle);
+        Y = CentralAngle * (vreal)YPixRad * vsin(valt) / vsin(CentralAngle);
+        X = CentralAngle * (vreal)XPixRad * vcos(valt) * vsin(vaz) / vsin(CentralAngle);
     } else {
         X = Y = 0.0;
     }
 
-    *iX = 240 + (int)floor(X);      // center on screen
-    *iY = 271 - (int)floor(Y);      // inverty Y coordinate
+    *iX = 240 + (int)vfloor(X);     // center on screen
+    *iY = 271 - (int)vfloor(Y);     // inverty Y coordinate
 
     return;
 }
 
 //-------------------------------------------------------------------------------
-// AzAlt    Convert RA & DEC to Azimuth/Altitude (local)
+// XYFromHorizon    Projection calc from a horizon unit vector
+//                  (x south, y west, z zenith)
 
-void AzAlt(double ra, double dec, double *az, double *alt)
+void XYFromHorizon(const double h[3], int *iX, int *iY)
 {
-    double igmst, latsin, latcos, lha;
+    vreal X, Y, S;
+    vreal CentralAngle;
+    vreal h0 = h[0], h1 = h[1], h2 = h[2];
+
+    // Same projection as XYFromAzAlt: cos(CentralAngle) = h[0]
+    S = vsqrt(h1 * h1 + h2 * h2);
+    if (S != 0)
+    {
+        CentralAngle = vatan2(S, h0);
+        Y = CentralAngle * (vreal)YPixRad * h2 / S;
+        X = CentralAngle * (vreal)XPixRad * h1 / S;
+    } else {
+        X = Y = 0.0;
+    }
+
+    *iX = 240 + (int)vfloor(X);     // center on screen
+    *iY = 271 - (int)vfloor(Y);     // inverty Y coordinate
 
-    igmst = gmst(JD);
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// AzAlt    Convert RA & DEC to Azimuth/Altitude (local)
 
-	latsin = sin(Latitude);
-	latcos = cos(Latitude);
+void AzAlt(double ra, double dec, double *az, double *alt)
+{
+    double h[3];
 
-    lha = fixangr(dtr(igmst * 15.0) + Longitude - ra);
-    *az = atan2(sin(lha), cos(lha) * latsin - tan(dec) * latcos);
-    *alt = asin(latsin * sin(dec) + latcos * cos(dec) * cos(lha));
+    eqtohoriz(horMatrix, ra, dec, h);
+    horizazalt(h, az, alt);
 
     return;
 }
 
 //-------------------------------------------------------------------------------
-// csv_parse
+// fontMetrics  Character widths and height of a display font (asked of the
+//              display once, then cached)
 
-int csv_parse(char *sLine, char *sElems[], int nElem)
+const struct fontMetrics *fontMetrics(int font)
 {
-    char   *p;
-    size_t n;
+    struct fontMetrics *fm = &fontCache[font];
+    int c;
 
-    p = sLine;
-    n = 0;
-    while (TRUE)
+    if (!fontLoaded[font])
     {
-        // Nothing of use
-        if (*p == '\0')
-            return n;
+        txt_FontID(font);
+        for (c = ' '; c < 127; c++)
+            fm->width[c] = charwidth(c);
+        fm->height = charheight('M');
+        fontLoaded[font] = TRUE;
+    }
+
+    return fm;
+}
+
+//-------------------------------------------------------------------------------
+// drawLabels   Place queued labels clear of each other and the objects
+//              drawn, then send them
 
-        // Save the string
-        sElems[n++] = p;
-        // Find the next field
-        while ((*p != ',') && (*p != '\n'))
-            p++;
+void drawLabels(void)
+{
+    const struct skyLabel *lb;
+    int k;
 
-        // Nothing else of use or too many fields
-        if ((*p == '\0') || (n >= nElem))
-            return n;
+    placeLabels(fontMetrics(FONT1));
 
-        // Split the field
-        *p++ = '\0';
+    txt_FontID(FONT1);
+    txt_BGcolour(BLACK);
+    txt_Opacity(TRANSPARENT);
+    for (k = 0; (lb = getLabel(k)) != NULL; k++)
+    {
+        if (!lb->bPlaced)
+            continue;
+        txt_FGcolour(lb->color);
+        gfx_MoveTo(lb->lx, lb->ly);
+        putStr((char *)lb->text);
     }
 
-	return  n;
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// clockArea    Screen rectangle of the time display (touch it to set the clock)
+
+void clockArea(int *x0, int *y0, int *x1, int *y1)
+{
+    const struct fontMetrics *fm = fontMetrics(FONT2);
+
+    *x0 = 0;
+    *y0 = SCRHEIGHT - fm->height - 4;
+    *x1 = 8 + textWidth(fm, "00:00 WWWW");
+    *y1 = SCRHEIGHT - 1;
+
+    return;
 }
 
 //-------------------------------------------------------------------------------
@@ -207,6 +305,7 @@ int csv_parse(char *sLine, char *sElems[], int nElem)
 void dpyTime(void)
 {
     char tmpBuf[16];
+    const struct fontMetrics *fm = fontMetrics(FONT2);
 
     // Get current time
     ttime = time(NULL);
@@ -221,132 +320,355 @@ void dpyTime(void)
     txt_Opacity(OPAQUE);
 
     // Display text in lower left corner
-    gfx_MoveTo(8, 272 - charheight('9') - 2);
+    gfx_MoveTo(8, 272 - fm->height - 2);
     putStr(tmpBuf);
 
     return;
 }
 
 //-------------------------------------------------------------------------------
-// plotStarField    Read and parse database (optional constellation lines)
+// Star occupancy grid
+//
+// Stars are collected into a per-frame grid of display pixels rather than
+// being drawn as they are read. Stars landing on the same pixel are merged
+// (the brightest one supplies size and colour) and glyphs completely covered
+// by a larger glyph are never sent. Display traffic is then bounded by the
+// screen area instead of the size of the starmap DB.
+
+#define MAXGLYPH    2           // Largest star radius drawn
+
+struct starGlyph {
+    short   X, Y;
+    float   mag;                // Brightest magnitude at this pixel
+    WORD    color;
+    short   size;               // Radius (0 = single pixel)
+};
 
-void plotStarField(const char *fname, int bConstellaltions)
+static int starGrid[SCRHEIGHT][SCRWIDTH];           // Glyph index + 1 (0 = empty)
+static unsigned char starCover[SCRHEIGHT][SCRWIDTH];  // Pixel already drawn
+static struct starGlyph starList[SCRHEIGHT * SCRWIDTH];
+static int nGlyphs;
+
+void clearStars(void)
 {
-    FILE    *fd;
-    size_t  n;
-    char    tmpBuf[120];
-    char    *starInfo[6];
-    char    *pBuffer = &tmpBuf[0];
-    size_t  nSize = sizeof(tmpBuf);
+    memset(starGrid, 0, sizeof(starGrid));
+    memset(starCover, 0, sizeof(starCover));
+    nGlyphs = 0;
 
-    double az, alt;
-    static int iX, iY, iMAG;
-    WORD    color;
+    return;
+}
+
+// addStar  Merge a star into the occupancy grid
+
+void addStar(int iX, int iY, int nSize, double mag, WORD color)
+{
+    struct starGlyph *sg;
+    int k;
 
-    // Open DB file
-    fd = fopen(fname, "r");
-    if (fd == NULL)
+    if ((iX < 0) || (iX >= SCRWIDTH) || (iY < 0) || (iY >= SCRHEIGHT))
+        return;
+
+    k = starGrid[iY][iX];
+    if (k == 0)
     {
-        printf("Cannot open starmap DB file: %s\nError (%d) - %s\n", fname, errno, strerror(errno));
-        exit(EXIT_FAILURE);
+        // New pixel
+        sg = &starList[nGlyphs++];
+        starGrid[iY][iX] = nGlyphs;
+        sg->X = iX;
+        sg->Y = iY;
+    } else {
+        // Keep the brighter of the two
+        sg = &starList[k - 1];
+        if (mag >= sg->mag)
+            return;
     }
 
-    gfx_ClipWindow(0, 0, 479, 271);
-    gfx_Clipping(ON);
+    sg->mag = mag;
+    sg->color = color;
+    sg->size = min(nSize, MAXGLYPH);
 
-    while(!feof(fd))
-    {
-        n = getline(&pBuffer, &nSize, fd);
-        if (n == -1)
-            break;
+    return;
+}
 
-        if (n >= sizeof(tmpBuf))
+// glyphCover   Test (and optionally mark) the pixels under a glyph
+//              Returns TRUE if every pixel was already covered
+
+static int glyphCover(struct starGlyph *sg, int bMark)
+{
+    int dx, dy, x, y;
+    int r = sg->size;
+    int bCovered = TRUE;
+
+    for (dy = -r; dy <= r; dy++)
+    {
+        y = sg->Y + dy;
+        if ((y < 0) || (y >= SCRHEIGHT))
+            continue;
+        for (dx = -r; dx <= r; dx++)
         {
-            printf("Line too long: '%s'\n", tmpBuf);
-            exit(EXIT_FAILURE);
+            x = sg->X + dx;
+            if ((x < 0) || (x >= SCRWIDTH) || ((dx * dx + dy * dy) > (r * r)))
+                continue;
+            if (!starCover[y][x])
+            {
+                if (!bMark)
+                    return FALSE;
+                bCovered = FALSE;
+                starCover[y][x] = TRUE;
+            }
         }
+    }
+
+    return bCovered;
+}
+
+// drawStars    Send merged glyphs to display, largest first
+
+void drawStars(void)
+{
+    struct starGlyph *sg;
+    int k, nSize;
 
-        n = csv_parse(tmpBuf, &starInfo[0], 6);
-        if (n != 5)
+    for (nSize = MAXGLYPH; nSize >= 0; nSize--)
+    {
+        for (k = 0; k < nGlyphs; k++)
         {
-            printf("Too many fields: %d, %s\n", n, starInfo[0]);
-            exit(EXIT_FAILURE);
+            sg = &starList[k];
+            if (sg->size != nSize)
+                continue;
+
+            // Hidden under a larger star?
+            if (glyphCover(sg, FALSE))
+                continue;
+            glyphCover(sg, TRUE);
+
+            if (nSize == 0)
+            {
+                gfx_PutPixel(sg->X, sg->Y, sg->color);
+            } else {
+                gfx_CircleFilled(sg->X, sg->Y, nSize, sg->color);
+                labelBlock(sg->X - nSize, sg->Y - nSize, sg->X + nSize, sg->Y + nSize, TRUE);
+            }
         }
-        // Convert RA, DEC to screen coords
+    }
 
-        AzAlt(atof(starInfo[1]), atof(starInfo[2]), &az, &alt);
-        XYFromAzAlt(az, alt, &iX, &iY);
+#ifdef DEBUG_PRINT
+    printf("Star glyphs: %d\n", nGlyphs);
+#endif
 
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// apparentPlace    Bring the J2000 catalog to the equator and equinox of
+//                  date. The precession/nutation rotation is folded into
+//                  the frame matrix, proper motion moves the stars.
+
+static void apparentPlace(double jd)
+{
+    double years = (jd - J2000) / 365.25;
+    int k;
+
+    apparentmatrix(jd, appMatrix);
+    for (k = 0; k < nLayers; k++)
+    {
+        layerEpoch(&layers[k], years);
+        if (layerHorizon(&layers[k], appMatrix, Latitude) < 0)
+            exit(EXIT_FAILURE);
+    }
+    lineEpoch(&lineSet, years);
+    appJD = jd;
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// plotObject   Draw a deep-sky or target marker glyph
+
+static void plotObject(const struct skyLayer *ly, const struct catStar *cs, int iX, int iY)
+{
+    if (ly->style == LAYER_MARKS)
+    {
+        // Cross hair and label
+        gfx_Hline(iY, iX - 4, iX + 4, LIME);
+        gfx_Vline(iX, iY - 4, iY + 4, LIME);
+        labelBlock(iX - 4, iY - 4, iX + 4, iY + 4, TRUE);
+        addLabel(iX, iY, 4, &ly->cat.names[cs->name], LIME, LABELPRIMIN);
+        return;
+    }
+
+    labelBlock(iX - 4, iY - 4, iX + 4, iY + 4, TRUE);
+
+    // Deep-sky outline by object type
+    switch (cs->spect)
+    {
+    case 'G':
+        gfx_Ellipse(iX, iY, 4, 2, SKYBLUE);
+        break;
+    case 'N':
+        gfx_Rectangle(iX - 3, iY - 3, iX + 3, iY + 3, DARKSALMON);
+        break;
+    case 'P':
+        gfx_Circle(iX, iY, 2, LIGHTCYAN);
+        gfx_PutPixel(iX, iY, LIGHTCYAN);
+        break;
+    case 'C':
+        gfx_Circle(iX, iY, 3, GOLD);
+        gfx_Hline(iY, iX - 3, iX + 3, GOLD);
+        gfx_Vline(iX, iY - 3, iY + 3, GOLD);
+        break;
+    default:
+        gfx_Circle(iX, iY, 3, GOLD);
+        break;
+    }
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+// plotStore    Project objects first..last-1 of a layer store and add
+//              star glyphs to the grid or draw object glyphs
+
+static void plotStore(const struct skyLayer *ly, const struct starStore *ss, uint32_t first, uint32_t last)
+{
+    const struct catStar *cs;
+    uint32_t k, i, nVis;
+
+    nVis = projectRange(starMatrix, ss->x, ss->y, ss->z, first, last, starX, starY, starIdx, 0);
+
+    for (k = 0; k < nVis; k++)
+    {
+        i = starIdx[k];
+        cs = &ly->cat.stars[ss->id[i]];
 #ifdef DEBUG_PRINT
-        printf("%-10s: RA = %.02f, DEC = %.02f, MAG = %d",
-                starInfo[0], rtd(atof(starInfo[1])), rtd(atof(starInfo[2])), atoi(starInfo[3]));
-        printf(", Az = %.02f, Alt = %.02f\n", az, alt);
+        printf("%-10s: MAG = %.02f, X = %d, Y = %d\n",
+                &ly->cat.names[cs->name], ss->mag[i], starX[k], starY[k]);
 #endif
-        // Want constellation lines?
-        if (bConstellaltions)
+        addPick(starX[k], starY[k], (ly->style == LAYER_STARS) ? PICK_STAR : PICK_OBJECT,
+                ly - layers, ss->id[i], ss->mag[i]);
+        if (ly->style == LAYER_STARS)
         {
-            if (*(starInfo[4]) == 'S')
-            {
-                gfx_MoveTo(iX, iY);              //start a constellation line
-            }
+            addStar(starX[k], starY[k], ss->size[i], ss->mag[i], ss->color[i]);
+            if (ss->mag[i] <= labelMag)
+                addLabel(starX[k], starY[k], max(ss->size[i], 0), &ly->cat.names[cs->name], LIGHTGREY, ss->mag[i]);
+        } else
+            plotObject(ly, cs, starX[k], starY[k]);
+    }
 
-            if ((*(starInfo[4]) == 'N') || (*(starInfo[4]) == 'E'))
-            {
-                gfx_Set(OBJECT_COLOUR, 0x0204);
-                gfx_LineTo(iX, iY);            //continue a constellation line
-            }
-        }
+    return;
+}
 
-        iMAG = (int)round(4.0 - atof(starInfo[3]));
+//-------------------------------------------------------------------------------
+// plotLayer    Rotate, project and cull the objects of the visible sky cells
+//              of a layer, from its resident store or tile cache. Only cells
+//              above the horizon on the layer timeline are looked at.
 
-        // Skip over line drawing entries
-        if (iMAG < 6)
+static void plotLayer(struct skyLayer *ly)
+{
+    struct starTiles *st = &ly->tiles;
+    struct starStore *ss = &ly->ss;
+    const struct starCell *sc;
+    const struct starStore *ts;
+    uint32_t w, k, t, first, last;
+    uint64_t bits;
+
+    first = last = 0;
+    for (w = 0; w < ly->rs.nWords; w++)
+    {
+        for (bits = ly->rs.up[w]; bits != 0; bits &= bits - 1)
         {
-            if((iX >= 0 && iX <= 479) && (iY >= 0 && iY <= 271))
+            k = w * 64 + __builtin_ctzll(bits);
+
+            if (ly->bTiled)
             {
-                // Map spectrum type
-                switch (*(starInfo[4]))
+                // Fetch only the tiles of visible cells reaching magLimit
+                if (!cellVisible(starMatrix, &st->cells[k]))
+                    continue;
+
+                for (t = k * st->th->nBands; t < (k + 1) * st->th->nBands; t++)
                 {
-                case 'A':   color = LIGHTBLUE; break;   //blue-white
-                case 'B':   color = BLUE; break;   //blue
-                case 'F':   color = WHITE; break;  //white
-                case 'G':   color = YELLOW; break;  //yellow
-                case 'K':   color = ORANGE; break;  //orange
-                case 'M':   color = RED; break;     //red
-                case 'O':   color = BLUE; break;    //bright blue
-                case 'W':   color = WHITE; break;   //white
-                default:    color = WHITE; break;  //white
+                    if (tileNeeded(st, t, ly->magLimit) && ((ts = getTile(st, t)) != NULL))
+                        plotStore(ly, ts, 0, tileStars(ts, ly->magLimit));
                 }
+            } else {
+                // Adjacent visible cells are projected as one run
+                sc = &ss->cells[k];
+                if (!cellVisible(starMatrix, sc))
+                    continue;
 
-                // Draw star according to MAG
-
-                switch(iMAG)
+                if (sc->first != last)
                 {
-                case 5:
-                    gfx_CircleFilled(iX, iY, 2, color);
-                    break;
+                    plotStore(ly, ss, first, last);
+                    first = sc->first;
+                }
+                last = sc->first + sc->count;
+            }
+        }
+    }
+    if (!ly->bTiled)
+        plotStore(ly, ss, first, last);
 
-                case 4:
-                case 3:
-                    gfx_CircleFilled(iX, iY, 1, color);
-                    break;
+    return;
+}
 
-                //case 2:
-                //    gfx_CircleFilled(iX, iY, 1, color);
-                //    break;
+//-------------------------------------------------------------------------------
+// plotStarField    Plot all object layers, optional constellation lines
 
-                default:
-                    //visible print a dot
-                    gfx_PutPixel(iX, iY, color);
-                    break;
-                }
+void plotStarField(int bConstellaltions)
+{
+    const struct starCell *sc;
+    const struct starStore *ls = &lineSet.ss;
+    uint32_t k, v, i;
+    int n;
+
+    double h[3];
+    int iX, iY;
+
+    gfx_ClipWindow(0, 0, 479, 271);
+    gfx_Clipping(ON);
+
+    clearStars();
+
+    // Want constellation lines? Visible figures go out as one polyline each.
+    if (bConstellaltions)
+    {
+        for (k = 0, sc = lineSet.lines; k < lineSet.nLines; k++, sc++)
+        {
+            if (!cellVisible(starMatrix, sc))
+                continue;
+
+            for (v = 0; v < sc->count; v++)
+            {
+                i = sc->first + v;
+                h[0] = starMatrix[0][0] * ls->x[i] + starMatrix[0][1] * ls->y[i] + starMatrix[0][2] * ls->z[i];
+                h[1] = starMatrix[1][0] * ls->x[i] + starMatrix[1][1] * ls->y[i] + starMatrix[1][2] * ls->z[i];
+                h[2] = starMatrix[2][0] * ls->x[i] + starMatrix[2][1] * ls->y[i] + starMatrix[2][2] * ls->z[i];
+                XYFromHorizon(h, &iX, &iY);
+                lineX[v] = iX;
+                lineY[v] = iY;
+                if (v > 0)
+                    labelLine(lineX[v - 1], lineY[v - 1], iX, iY);
             }
+            gfx_Polyline(sc->count, lineX, lineY, 0x0204);
         }
     }
 
-    gfx_Clipping(OFF);
+    // Star layers are merged, then drawn together
+    for (n = 0; n < nLayers; n++)
+    {
+        if (layers[n].style == LAYER_STARS)
+            plotLayer(&layers[n]);
+    }
+    drawStars();
 
-    fclose(fd);
+    // Object markers on top of the stars
+    for (n = 0; n < nLayers; n++)
+    {
+        if (layers[n].style != LAYER_STARS)
+            plotLayer(&layers[n]);
+    }
+
+    gfx_Clipping(OFF);
 
     return;
 }
@@ -382,6 +704,8 @@ void plotPlanets(void)
         if ((iX >= 0 && iX <= 479) &&(iY >= 0 && iY <= 271))
         {
             nSize = pp_data[kPlanet].Size;
+            addPick(iX, iY, PICK_PLANET, kPlanet, 0, PICKPLANETMAG);
+            labelBlock(iX - nSize, iY - nSize, iX + nSize, iY + nSize, TRUE);
             if ((kPlanet == SUN) || (kPlanet == MOON))
             {
                 // Just draw object without label
@@ -389,15 +713,12 @@ void plotPlanets(void)
             } else {
                 gfx_Circle(iX, iY, nSize, pp_data[kPlanet].Color);
                 if (kPlanet == SATURN)
+                {
                     gfx_Ellipse(iX, iY, 6, 2, YELLOW);    //Saturn rings
-                // Select font & style
-                txt_FontID(FONT1);
-                txt_BGcolour(BLACK);
-                txt_FGcolour(WHITE);
-		txt_Opacity(TRANSPARENT);
-                // Add planet label
-                gfx_MoveTo(iX + nSize + 1, iY + nSize + 1);
-                putStr(pp_data[kPlanet].Name);
+                    labelBlock(iX - 6, iY - 2, iX + 6, iY + 2, TRUE);
+                }
+                // Planet labels are placed first
+                addLabel(iX, iY, (kPlanet == SATURN) ? 6 : nSize, pp_data[kPlanet].Name, WHITE, LABELPRIMIN);
             }
         }
     }
@@ -408,6 +729,93 @@ void plotPlanets(void)
 }
 
 //-------------------------------------------------------------------------------
+// identify     Show name, magnitude and position of the object nearest a
+//              tap in a box in the top left corner. Only the box is sent;
+//              the sky it covers comes back with the next frame.
+
+#define INFOX   4
+#define INFOY   4
+
+void identify(int x, int y)
+{
+    static int boxW;                    // Width of the last box shown
+    const struct fontMetrics *fm = fontMetrics(FONT1);
+    const struct skyPick *pk;
+    const struct skyLayer *ly;
+    const struct catStar *cs;
+    const char *name;
+    char line1[64], line2[40];
+    double h[3], az, alt;
+    int w, boxH;
+
+    line2[0] = '\0';
+    pk = nearestPick(x, y, PICKRADIUS);
+    if (pk == NULL)
+    {
+        strcpy(line1, "Nothing here");
+    } else {
+        if (pk->kind == PICK_PLANET)
+        {
+            snprintf(line1, sizeof(line1), "%s", pp_data[pk->layer].Name);
+            az = planet_info[pk->layer].az;
+            alt = planet_info[pk->layer].alt;
+        } else {
+            ly = &layers[pk->layer];
+            cs = &ly->cat.stars[pk->id];
+            name = &ly->cat.names[cs->name];
+            if (*name == '\0')
+                name = (pk->kind == PICK_STAR) ? "Star" : "Object";
+            snprintf(line1, sizeof(line1), "%s  mag %.2f", name, cs->mag / 100.0);
+            eqtohoriz(starMatrix, catRA(cs), catDec(cs), h);
+            horizazalt(h, &az, &alt);
+        }
+        // Azimuth shown from North through East
+        snprintf(line2, sizeof(line2), "Alt %.1f  Az %.1f", rtd(alt), fixangle(rtd(az) + 180.0));
+    }
+
+    // Clear the old box, then draw the new one
+    w = max(textWidth(fm, line1), textWidth(fm, line2)) + 8;
+    boxH = 2 * fm->height + 6;
+    gfx_RectangleFilled(INFOX, INFOY, INFOX + max(boxW, w), INFOY + boxH, BLACK);
+    boxW = w;
+    gfx_Rectangle(INFOX, INFOY, INFOX + boxW, INFOY + boxH, DIMGRAY);
+
+    txt_FontID(FONT1);
+    txt_FGcolour(WHITE);
+    txt_BGcolour(BLACK);
+    txt_Opacity(OPAQUE);
+    gfx_MoveTo(INFOX + 4, INFOY + 2);
+    putStr(line1);
+    gfx_MoveTo(INFOX + 4, INFOY + 4 + fm->height);
+    putStr(line2);
+
+    return;
+}
+
+//-------------------------------------------------------------------------------
+
+// Grid pen: draws and keeps labels off the lines
+
+static int penX, penY;
+
+static void gridMoveTo(int x, int y)
+{
+    gfx_MoveTo(x, y);
+    penX = x;
+    penY = y;
+
+    return;
+}
+
+static void gridLineTo(int x, int y)
+{
+    gfx_LineTo(x, y);
+    labelLine(penX, penY, x, y);
+    penX = x;
+    penY = y;
+
+    return;
+}
 
 void drawAzAltGrid(void)
 {
@@ -431,11 +839,11 @@ void drawAzAltGrid(void)
     {
         alt = 0;
         XYFromAzAlt(dtr(az), dtr(0), &x, &y);
-        gfx_MoveTo(x, y);
+        gridMoveTo(x, y);
         for (alt = alt + step; alt <= 90.0; alt += step)
         {
             XYFromAzAlt(dtr(az), dtr(alt), &x, &y);
-            gfx_LineTo(x, y);
+            gridLineTo(x, y);
         }
     }
 
@@ -444,11 +852,11 @@ void drawAzAltGrid(void)
     {
         az = -150.0;
         XYFromAzAlt(dtr(az), dtr(alt), &x, &y);
-        gfx_MoveTo(x, y);
+        gridMoveTo(x, y);
         for (az = az + step; az <= 150.0; az += step)
         {
             XYFromAzAlt(dtr(az), dtr(alt), &x, &y);
-            gfx_LineTo(x, y);
+            gridLineTo(x, y);
         }
     }
 
@@ -456,13 +864,13 @@ void drawAzAltGrid(void)
     gfx_Set(OBJECT_COLOUR, SALMON);
 
     // Get current obliquity of ecliptic
-    eps = dtr(obliqeq(JD));
+    eps = dtr(epochObliquity(JD));
     esin = sin(eps);
     ecos = cos(eps);
     // ecliptic intersects equator at 0 longitude
     AzAlt(0.0, 0.0, &az, &alt);
     XYFromAzAlt(az, alt, &x, &y);
-    gfx_MoveTo(x, y);
+    gridMoveTo(x, y);
 
     for (eqlat = 0; eqlat <= dtr(360.0); eqlat += dtr(step))
     {
@@ -471,7 +879,7 @@ void drawAzAltGrid(void)
 
         AzAlt(eqra, eqdec, &az, &alt);
         XYFromAzAlt(az, alt, &x, &y);
-        gfx_LineTo(x, y);
+        gridLineTo(x, y);
     }
 
     gfx_Clipping(OFF);
@@ -529,7 +937,7 @@ void parse_options(int argc, char **argv)
     int opt, idx;
 
     optind = 0;
-    while ((opt = getopt(argc, argv, "?Bcf:hl:qs:tw:z:")) != -1)
+    while ((opt = getopt(argc, argv, "?BcC:d:e:f:hl:L:m:p:qQs:tT:w:x:z:")) != -1)
     {
         switch (opt) {
         // Silence the bird
@@ -537,16 +945,50 @@ void parse_options(int argc, char **argv)
             bChimes = FALSE;
             break;
 
+        // Truncated planet and Moon series
+        case 'Q':
+            bQuickPlanets = TRUE;
+            break;
+
         // Draw constellation lines
         case 'c':
             bCLines = TRUE;
             break;
 
+        // Constellation line file
+        case 'C':
+            strcpy(lineMap, optarg);
+            bCLines = TRUE;
+            break;
+
+        // Ephemeris file
+        case 'e':
+            strcpy(ephMap, optarg);
+            break;
+
         // Location of starmap file
         case 'f':
             strcpy(starMap, optarg);
             break;
 
+        // Deep-sky object and target list layers
+        case 'd':
+        case 'x':
+            if (nLayers == MAXLAYERS)
+            {
+                printf("Too many catalog layers: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            if (parseLayer(optarg, (opt == 'd') ? LAYER_DSO : LAYER_MARKS, 99.0, &layers[nLayers]) < 0)
+                exit(EXIT_FAILURE);
+            nLayers++;
+            break;
+
+        // Convert starmap DB to tiled catalog
+        case 'T':
+            strcpy(tileMap, optarg);
+            break;
+
         // Don't get date/time from LCD clock
         case 't':
             useSystemTime = TRUE;
@@ -584,6 +1026,36 @@ void parse_options(int argc, char **argv)
             exit(EXIT_FAILURE);
             break;
 
+        // Star label magnitude limit
+        case 'L':
+            labelMag = strtod(optarg, &cptr);
+            if ((cptr == optarg) || (*cptr != '\0'))
+            {
+                printf("Invalid label magnitude: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        // Star magnitude limit
+        case 'm':
+            magLimit = strtod(optarg, &cptr);
+            if ((cptr == optarg) || (*cptr != '\0'))
+            {
+                printf("Invalid magnitude limit: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        // Planet series precision target
+        case 'p':
+            planetPrec = strtod(optarg, &cptr);
+            if ((cptr == optarg) || (*cptr != '\0') || (planetPrec <= 0))
+            {
+                printf("Invalid planet precision: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
         // Sleep / Wake times
         case 'w':
             if (strptime(optarg, "%H:%M", &tmLocal) == NULL)
@@ -632,7 +1104,10 @@ int main(int argc, char **argv)
 	int bTouched;
 	WORD LCDSave = 0;
 	WORD sHdl;
-	struct stat mstat;
+	uint32_t nBuf;
+	int k;
+	int tX, tY, x0, y0, x1, y1;
+	double prefMatrix[3][3];
 
 	TimeLimit4D = 2000;
 	Callback4D = errCallback;
@@ -646,7 +1121,10 @@ int main(int argc, char **argv)
     useSystemTime = FALSE;
     strcpy(comport, SERIALDEFAULT);
     strcpy(starMap, HYGDEFAULT);
+    magLimit = 6.0;
+    labelMag = 1.5;
     comspeed = BAUD_9600;
+    nLayers = 1;                        // Star field
 
     parse_options(argc, argv);
 
@@ -662,11 +1140,51 @@ int main(int argc, char **argv)
     if (argc > optind)
         strcpy(comport, argv[optind]);
 
-    // Check if DB exists
-    rc = stat(starMap, &mstat);
-    if (rc < 0)
+    // Convert starmap DB (compiles binary cache if needed)
+    if (tileMap[0] != '\0')
+    {
+        if (openStarCat(starMap, &layers[0].cat) < 0)
+            exit(EXIT_FAILURE);
+        exit((writeStarTiles(&layers[0].cat, tileMap) == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Open starmap DB and object layers. Tiled catalogs are streamed
+    // through a tile cache, otherwise drawable objects are loaded once.
+    strcpy(layers[0].fname, starMap);
+    layers[0].style = LAYER_STARS;
+    layers[0].magLimit = magLimit;
+    nBuf = 0;
+    for (k = 0; k < nLayers; k++)
+    {
+        if (openLayer(&layers[k]) < 0)
+            exit(EXIT_FAILURE);
+        nBuf = max(nBuf, layerMaxRun(&layers[k]));
+    }
+
+    // Constellation lines from line file, else from the starmap DB
+    if (loadLineSet(&layers[0].cat, (lineMap[0] != '\0') ? lineMap : NULL, &lineSet) < 0)
+        exit(EXIT_FAILURE);
+    lineX = malloc((lineSet.maxLine + 1) * sizeof(WORD));
+    lineY = malloc((lineSet.maxLine + 1) * sizeof(WORD));
+
+    // Precomputed planet positions, if installed
+    if (ephMap[0] != '\0')
+    {
+        if (openEphFile(ephMap, &ephFile) < 0)
+        {
+            printf("Cannot open ephemeris file: %s\n", ephMap);
+            exit(EXIT_FAILURE);
+        }
+    } else
+        openEphFile(EPHDEFAULT, &ephFile);
+
+    // Per-frame projection buffers
+    starX = malloc((nBuf + 1) * sizeof(short));
+    starY = malloc((nBuf + 1) * sizeof(short));
+    starIdx = malloc((nBuf + 1) * sizeof(uint32_t));
+    if ((starX == NULL) || (starY == NULL) || (starIdx == NULL) || (lineX == NULL) || (lineY == NULL))
     {
-        printf("Cannot locate starmap DB: %s\nError (%d) - %s\n", starMap, errno, strerror(errno));
+        printf("Out of memory\n");
         exit(EXIT_FAILURE);
     }
 
@@ -687,6 +1205,14 @@ int main(int argc, char **argv)
                    FE_UNDERFLOW);
     feclearexcept(FE_ALL_EXCEPT);
 
+    // Planet positions fitted in the background (worker shares FP traps),
+    // unless the series are cut to a precision target and cheap enough to
+    // run every frame
+    if (planetPrec == 0)
+        bEphCache = (ephOpen(&ephCache, bQuickPlanets) == 0);
+    ephContextInit(&skyEph, planet_info, bQuickPlanets, Latitude, Longitude);
+    skyEph.prec = planetPrec;
+
 restart:
     // Open display serial port
     rc = OpenComm(comport, comspeed);
@@ -768,26 +1294,63 @@ restart:
         // Get Julian date inf
         JD = jtime(&tmGMT);
 
+        // Precession, nutation and proper motion change slowly
+        if (fabs(JD - appJD) >= APPARENTDAYS)
+            apparentPlace(JD);
+
+        // Sidereal time and site rotation for this frame
+        horizmatrix(JD, Latitude, Longitude, horMatrix);
+        matmul3(horMatrix, appMatrix, starMatrix);
+        for (k = 0; k < nLayers; k++)
+            riseSetSweep(&layers[k].rs, dtr(epochGmst(JD) * 15.0) + Longitude);
+
         // Only if display enabled
         if (LCDSave == 0)
         {
             // Start by clearing display
             gfx_Cls();
 
+            // Keep labels clear of the clock
+            clearLabels();
+            clearPicks();
+            clockArea(&x0, &y0, &x1, &y1);
+            labelBlock(x0, y0, x1, y1, TRUE);
+
             // Screen grid
             drawAzAltGrid();
 
-            // Calculate Sun, Moon, etc. (QuickPlanetCalc := true)
-            calcPlanets(JD, Latitude, Longitude, TRUE);
+            // Calculate Sun, Moon, etc. (full series unless -Q or -p): from the
+            // ephemeris file if it covers JD, else from the ephemeris cache
+            // once its segment is fitted
+            if (ephFilePlanets(&ephFile, JD, skyEph.pi) == 0)
+                horizPlanetsCtx(&skyEph, JD);
+            else if (bEphCache)
+            {
+                ephPlanets(&ephCache, JD, skyEph.pi);
+                horizPlanetsCtx(&skyEph, JD);
+            } else
+                calcPlanetsCtx(&skyEph, JD);
 
             // Plot the star database (no constellation lines)
-            plotStarField(starMap, bCLines);
+            plotStarField(bCLines);
 
             // Now plot the planets
             plotPlanets();
 
+            // Names of planets, targets and bright stars
+            drawLabels();
+
             // Show current time
             dpyTime();
+
+            // Read ahead tiles the sky is turning into view
+            horizmatrix(JD + TILELOOKAHEAD, Latitude, Longitude, prefMatrix);
+            matmul3(prefMatrix, appMatrix, prefMatrix);
+            for (k = 0; k < nLayers; k++)
+            {
+                if (layers[k].bTiled)
+                    prefetchTiles(&layers[k].tiles, prefMatrix, layers[k].magLimit);
+            }
         }
 
         // Enable full-screen touch
@@ -815,8 +1378,21 @@ restart:
             // Service touch while waiting
             if (touch_Get(TOUCH_STATUS) == TOUCH_RELEASED)
             {
+                tX = touch_Get(TOUCH_GETX);
+                tY = touch_Get(TOUCH_GETY);
                 // Reset touch
                 touch_Set(TOUCH_REGIONDEFAULT);
+
+                // A tap on the sky names the object under it, a tap on
+                // the clock (or any tap with the display off) falls through
+                clockArea(&x0, &y0, &x1, &y1);
+                if ((LCDSave == 0) && !((tX >= x0) && (tX <= x1) && (tY >= y0) && (tY <= y1)))
+                {
+                    identify(tX, tY);
+                    if (sleeping)
+                        napCount = napMins;
+                    continue;
+                }
                 bTouched = TRUE;
                 break;
             }